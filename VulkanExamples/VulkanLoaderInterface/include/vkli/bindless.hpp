@@ -0,0 +1,99 @@
+/*
+    bindless.hpp: A global bindless descriptor table built on descriptor indexing.
+
+    -One large update-after-bind descriptor set holds partially bound arrays of sampled images
+    -(binding 0), storage buffers (binding 1) and samplers (binding 2). Resources are added to the
+    -table once and then referred to in shaders by their integer handle, so draws never rebind
+    -descriptor sets per material.
+
+    -Handles come from a free list per array. A released handle is only reused once the frame that
+    -released it has retired on the GPU, as that frame's commands may still index it.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace vkli {
+    // The value of each type is also its binding number in the descriptor set.
+    enum BindlessType {BINDLESS_SAMPLED_IMAGE, BINDLESS_STORAGE_BUFFER, BINDLESS_SAMPLER, BINDLESS_TYPE_COUNT};
+
+    struct BindlessCapacity {
+        uint32_t sampled_images {16384};
+        uint32_t storage_buffers {16384};
+        uint32_t samplers {256};
+    };
+
+    class BindlessTable {
+        public:
+            static constexpr uint32_t INVALID_HANDLE {UINT32_MAX};
+
+            // adds the descriptor indexing features the table needs to features, pass these to
+            // VkLoader::CreateDevice before constructing a BindlessTable.
+            static void RequireFeatures(DeviceFeatures& features);
+
+            // this constructor will throw a std::runtime_error if the descriptor set cannot be created.
+            // The capacities are clamped to the device's update-after-bind limits, and scaled down together
+            // if their sum exceeds the per stage resource limit.
+            BindlessTable(VkLoader& loader, const BindlessCapacity& capacity = {});
+            ~BindlessTable();
+            BindlessTable(const BindlessTable&) = delete;
+            BindlessTable& operator=(const BindlessTable&) = delete;
+
+            // write a descriptor into a free slot, returns INVALID_HANDLE if the array is full.
+            uint32_t AddSampledImage(VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            uint32_t AddStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+            uint32_t AddSampler(VkSampler sampler);
+
+            // the slot is recycled by the first Retire call with completed_frame >= frame. Releasing
+            // a handle that is not live (a second release, for example) is an error and ignored.
+            void Release(BindlessType type, uint32_t handle, uint64_t frame);
+            // call once per frame with the newest frame whose commands are known to have completed.
+            void Retire(uint64_t completed_frame);
+
+            void Bind(VkCommandBuffer cmd, VkPipelineBindPoint bind_point, VkPipelineLayout layout,
+                      uint32_t set_index = 0) const;
+
+            VkDescriptorSetLayout GetLayout() const { return m_Layout; }
+            VkDescriptorSet GetSet() const { return m_Set; }
+            uint32_t GetCapacity(BindlessType type) const { return m_Slots[type].capacity; }
+        private:
+            struct SlotAllocator {
+                uint32_t capacity {0};
+                uint32_t high_water {0}; // slots below this have been handed out at least once
+                std::vector<uint32_t> free;
+                std::vector<bool> live; // handed out and not released yet, indexed by handle
+            };
+            struct PendingRelease {
+                uint64_t frame;
+                BindlessType type;
+                uint32_t handle;
+            };
+        private:
+            uint32_t AllocSlot(BindlessType type);
+        private:
+            VkDevice m_Device;
+            VkDescriptorSetLayout m_Layout;
+            VkDescriptorPool m_Pool;
+            VkDescriptorSet m_Set;
+            std::array<SlotAllocator, BINDLESS_TYPE_COUNT> m_Slots;
+            std::deque<PendingRelease> m_Pending; // ordered by frame
+    };
+}
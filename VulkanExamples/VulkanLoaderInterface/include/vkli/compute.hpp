@@ -0,0 +1,86 @@
+/*
+    compute.hpp: Dispatching SPIR-V compute kernels over storage buffers.
+
+    -ComputeKernel wraps a compute shader whose storage buffers are set 0, bindings 0 to n - 1, with
+    -optional push constants. Bind makes a descriptor set for a list of buffers, Dispatch records
+    -the pipeline, the set, the push constants and the dispatch.
+    -ComputeBuffer is a device local storage buffer with blocking uploads and downloads.
+
+    -Both work on any device, including one created with DeviceFeatures::queue_flags set to
+    -VK_QUEUE_COMPUTE_BIT alone.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vkli {
+    class ComputeBuffer {
+        public:
+            // this constructor will throw a std::runtime_error if the buffer cannot be created.
+            ComputeBuffer(VkLoader& loader, VkDeviceSize size);
+            ~ComputeBuffer();
+            ComputeBuffer(const ComputeBuffer&) = delete;
+            ComputeBuffer& operator=(const ComputeBuffer&) = delete;
+
+            // both go through a staging buffer on the loader's queue and block until the copy is done.
+            bool Write(const void *data, VkDeviceSize size, VkDeviceSize offset = 0);
+            bool Read(void *data, VkDeviceSize size, VkDeviceSize offset = 0) const;
+
+            VkBuffer Get() const { return m_Buffer; }
+            VkDeviceSize Size() const { return m_Size; }
+        private:
+            VkLoader& m_Loader;
+            VkDeviceSize m_Size;
+            VkBuffer m_Buffer;
+            VkDeviceMemory m_Memory;
+    };
+
+    class ComputeKernel {
+        public:
+            // code is SPIR-V with the entry point main. This constructor will throw a
+            // std::runtime_error if the pipeline cannot be created.
+            ComputeKernel(VkLoader& loader, const uint32_t *code, size_t size, uint32_t buffer_count,
+                          uint32_t push_constant_size = 0);
+            ~ComputeKernel();
+            ComputeKernel(const ComputeKernel&) = delete;
+            ComputeKernel& operator=(const ComputeKernel&) = delete;
+
+            // one whole buffer per binding, in binding order. The set lives as long as the kernel,
+            // returns VK_NULL_HANDLE on failure.
+            VkDescriptorSet Bind(const std::vector<VkBuffer>& buffers);
+            // push_constants must hold push_constant_size bytes, or be nullptr if that is 0.
+            void Dispatch(VkCommandBuffer cmd, VkDescriptorSet set, const void *push_constants,
+                          uint32_t groups_x, uint32_t groups_y = 1, uint32_t groups_z = 1) const;
+
+            // makes shader and transfer writes visible to the dispatches and transfers after it.
+            static void Barrier(VkCommandBuffer cmd);
+        private:
+            bool AddPool();
+            void Destroy();
+        private:
+            VkDevice m_Device;
+            uint32_t m_BufferCount;
+            uint32_t m_PushConstantSize;
+            VkDescriptorSetLayout m_SetLayout;
+            std::vector<VkDescriptorPool> m_DescPools; // a new one is added whenever the last is full
+            VkPipelineLayout m_PipelineLayout;
+            VkPipeline m_Pipeline;
+    };
+}
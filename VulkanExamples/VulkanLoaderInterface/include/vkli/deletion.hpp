@@ -0,0 +1,113 @@
+/*
+    deletion.hpp: Deferred destruction of Vulkan objects the GPU may still be using.
+
+    -Every object is queued with a RetirePoint: a frame number whose fence the application waits
+    -on, or a value of a timeline semaphore. Frame numbers and timeline values are kept in separate
+    -queues, one for frames and one per timeline semaphore, and are never compared with each
+    -other. Collect destroys everything in one queue whose value has been reached in one batch, so
+    -freeing resources never needs vkDeviceWaitIdle.
+    -Within a queue objects are destroyed in the order they were queued, an object queued with a
+    -lower value than the one before it waits for that one too. Nothing is ever destroyed early.
+    -Retiring on a timeline semaphore needs the timelineSemaphore feature, see RequireFeatures.
+
+    -VkLoader owns one queue per logical device and drains it before destroying the device.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace vkli {
+    // a frame number converts implicitly, so Destroy(buffer, frame) retires on frames.
+    struct RetirePoint {
+        RetirePoint(uint64_t frame) : timeline{VK_NULL_HANDLE}, value{frame} {}
+        RetirePoint(VkSemaphore timeline, uint64_t value) : timeline{timeline}, value{value} {}
+        VkSemaphore timeline; // VK_NULL_HANDLE for a frame number
+        uint64_t value;
+    };
+
+    // every member function may be called from any thread.
+    class DeletionQueue {
+        public:
+            // timelineSemaphore, only needed to retire objects on timeline semaphores.
+            static void RequireFeatures(DeviceFeatures& features);
+
+            // timeline_semaphores tells whether device was created with the timelineSemaphore feature.
+            DeletionQueue(VkDevice device, bool timeline_semaphores = false);
+            // destroys everything still queued, the device must be idle.
+            ~DeletionQueue();
+            DeletionQueue(const DeletionQueue&) = delete;
+            DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+            // handle is any object listed below, cast to uint64_t.
+            void Push(VkObjectType type, uint64_t handle, RetirePoint retire);
+
+            // non dispatchable handles only have distinct types on 64 bit platforms, elsewhere Push
+            // has to be used.
+        #if UINTPTR_MAX == UINT64_MAX
+            void Destroy(VkBuffer buffer, RetirePoint retire) { Push(VK_OBJECT_TYPE_BUFFER, Raw(buffer), retire); }
+            void Destroy(VkBufferView view, RetirePoint retire) { Push(VK_OBJECT_TYPE_BUFFER_VIEW, Raw(view), retire); }
+            void Destroy(VkImage image, RetirePoint retire) { Push(VK_OBJECT_TYPE_IMAGE, Raw(image), retire); }
+            void Destroy(VkImageView view, RetirePoint retire) { Push(VK_OBJECT_TYPE_IMAGE_VIEW, Raw(view), retire); }
+            void Destroy(VkDeviceMemory memory, RetirePoint retire) { Push(VK_OBJECT_TYPE_DEVICE_MEMORY, Raw(memory), retire); }
+            void Destroy(VkSampler sampler, RetirePoint retire) { Push(VK_OBJECT_TYPE_SAMPLER, Raw(sampler), retire); }
+            void Destroy(VkShaderModule module, RetirePoint retire) { Push(VK_OBJECT_TYPE_SHADER_MODULE, Raw(module), retire); }
+            void Destroy(VkPipeline pipeline, RetirePoint retire) { Push(VK_OBJECT_TYPE_PIPELINE, Raw(pipeline), retire); }
+            void Destroy(VkPipelineLayout layout, RetirePoint retire) { Push(VK_OBJECT_TYPE_PIPELINE_LAYOUT, Raw(layout), retire); }
+            void Destroy(VkDescriptorSetLayout layout, RetirePoint retire) { Push(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, Raw(layout), retire); }
+            void Destroy(VkDescriptorPool pool, RetirePoint retire) { Push(VK_OBJECT_TYPE_DESCRIPTOR_POOL, Raw(pool), retire); }
+            void Destroy(VkRenderPass render_pass, RetirePoint retire) { Push(VK_OBJECT_TYPE_RENDER_PASS, Raw(render_pass), retire); }
+            void Destroy(VkFramebuffer framebuffer, RetirePoint retire) { Push(VK_OBJECT_TYPE_FRAMEBUFFER, Raw(framebuffer), retire); }
+            void Destroy(VkCommandPool pool, RetirePoint retire) { Push(VK_OBJECT_TYPE_COMMAND_POOL, Raw(pool), retire); }
+            void Destroy(VkQueryPool pool, RetirePoint retire) { Push(VK_OBJECT_TYPE_QUERY_POOL, Raw(pool), retire); }
+            void Destroy(VkFence fence, RetirePoint retire) { Push(VK_OBJECT_TYPE_FENCE, Raw(fence), retire); }
+            void Destroy(VkSemaphore semaphore, RetirePoint retire) { Push(VK_OBJECT_TYPE_SEMAPHORE, Raw(semaphore), retire); }
+            void Destroy(VkEvent event, RetirePoint retire) { Push(VK_OBJECT_TYPE_EVENT, Raw(event), retire); }
+        #endif
+
+            // destroys every object queued with a frame number <= completed_frame, returns how many.
+            size_t Collect(uint64_t completed_frame);
+            // destroys every object queued on timeline with a value it has reached. Objects retiring
+            // on frames or on other semaphores are left alone.
+            size_t Collect(VkSemaphore timeline);
+            // destroys everything, the device must be idle.
+            size_t Drain();
+            size_t Pending() const;
+        private:
+            struct Entry {
+                uint64_t value;
+                uint64_t handle;
+                VkObjectType type;
+            };
+            template<typename T>
+            static uint64_t Raw(T handle) { return reinterpret_cast<uint64_t>(handle); }
+            void DestroyEntry(const Entry& entry) const;
+            // destroys the entries of the queue for timeline that have reached value, without
+            // holding the lock while doing so.
+            size_t CollectQueue(VkSemaphore timeline, uint64_t value);
+        private:
+            VkDevice m_Device;
+            bool m_TimelineSemaphores;
+            mutable std::mutex m_Mutex;
+            // keyed by timeline semaphore, VK_NULL_HANDLE holds the frame numbers.
+            std::map<VkSemaphore, std::deque<Entry>> m_Queues;
+    };
+}
@@ -0,0 +1,181 @@
+/*
+    gpudriven.hpp: GPU driven culling and multi-draw-indirect rendering.
+
+    -GeometryPool packs every mesh into one shared vertex buffer and one shared index buffer, so
+    -all of them can be drawn without rebinding anything.
+    -CullingPass runs a compute shader over every instance, doing frustum culling and optionally
+    -occlusion culling against a DepthPyramid, and writes one indirect draw per visible instance.
+    -All of them are then issued with a single vkCmdDrawIndexedIndirectCount.
+
+    -Occlusion culling tests against the pyramid of the previous frame's depth buffer, so objects
+    -that just came into view can be missing for a frame while the camera moves.
+
+    -Matrices are column major. View space is +z forward and +y down, and projections map the near
+    -plane to depth 0 and the far plane to depth 1 (clip w == view space z), which is what Vulkan
+    -expects without flipping the viewport.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace vkli {
+    // vertex input of pipelines drawing from a GeometryPool: location 0 position, location 1 normal.
+    struct Vertex {
+        float position[3];
+        float normal[3];
+    };
+
+    // the layouts of MeshInfo and Instance are shared with shaders (std430).
+    struct MeshInfo {
+        uint32_t index_count;
+        uint32_t first_index;
+        int32_t vertex_offset;
+        uint32_t pad;
+        float sphere[4]; // bounding sphere in model space, centre and radius
+    };
+
+    struct Instance {
+        float model[16];
+        uint32_t mesh; // returned by GeometryPool::AddMesh
+        uint32_t pad[3];
+    };
+
+    class GeometryPool {
+        public:
+            GeometryPool(VkLoader& loader);
+            ~GeometryPool();
+            GeometryPool(const GeometryPool&) = delete;
+            GeometryPool& operator=(const GeometryPool&) = delete;
+
+            // returns the mesh index, or UINT32_MAX once the pool has been uploaded. Vertices are
+            // stored in the order the indices first use them, which keeps vertex fetches local.
+            uint32_t AddMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+            // copies every mesh into device local buffers and blocks until that is done. Meshes
+            // cannot be added afterwards.
+            bool Upload();
+            // binds the vertex buffer to binding 0 and the 32 bit index buffer.
+            void Bind(VkCommandBuffer cmd) const;
+
+            const std::vector<MeshInfo>& Meshes() const { return m_Meshes; }
+            VkBuffer GetMeshBuffer() const { return m_MeshBuffer; }
+        private:
+            VkLoader& m_Loader;
+            std::vector<Vertex> m_Vertices;
+            std::vector<uint32_t> m_Indices;
+            std::vector<MeshInfo> m_Meshes;
+            VkBuffer m_VertexBuffer, m_IndexBuffer, m_MeshBuffer;
+            VkDeviceMemory m_VertexMemory, m_IndexMemory, m_MeshMemory;
+    };
+
+    // a mip chain of the farthest depth in every texel, for occlusion culling.
+    class DepthPyramid {
+        public:
+            // depth must have a depth only format and have been created with
+            // VK_IMAGE_USAGE_SAMPLED_BIT. This constructor will throw a std::runtime_error if the
+            // pyramid cannot be created.
+            DepthPyramid(VkLoader& loader, VkImage depth, VkImageView depth_view, VkExtent2D extent,
+                         VkImageLayout depth_layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+            ~DepthPyramid();
+            DepthPyramid(const DepthPyramid&) = delete;
+            DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+            // records the reduction, outside of a render pass. The depth image must be in
+            // depth_layout, the barrier from the depth writes is recorded here.
+            void Build(VkCommandBuffer cmd) const;
+
+            // the pyramid is always in VK_IMAGE_LAYOUT_GENERAL.
+            VkImageView GetView() const { return m_View; }
+            VkSampler GetSampler() const { return m_Sampler; }
+            VkExtent2D GetExtent() const { return m_Extent; }
+            uint32_t Levels() const { return static_cast<uint32_t>(m_LevelViews.size()); }
+        private:
+            void Destroy();
+        private:
+            VkDevice m_Device;
+            VkImage m_Depth;
+            VkImageLayout m_DepthLayout;
+            VkExtent2D m_DepthExtent;
+            VkExtent2D m_Extent; // of level 0, half the depth buffer
+            VkImage m_Image;
+            VkDeviceMemory m_Memory;
+            VkImageView m_View;
+            std::vector<VkImageView> m_LevelViews;
+            VkSampler m_Sampler;
+            VkDescriptorSetLayout m_SetLayout;
+            VkDescriptorPool m_DescPool;
+            std::vector<VkDescriptorSet> m_Sets; // one per level
+            VkPipelineLayout m_PipelineLayout;
+            VkPipeline m_Pipeline;
+    };
+
+    class CullingPass {
+        public:
+            // multiDrawIndirect, drawIndirectFirstInstance and drawIndirectCount.
+            static void RequireFeatures(DeviceFeatures& features);
+
+            // pool must already be uploaded. This constructor will throw a std::runtime_error if the
+            // buffers or the pipeline cannot be created, or if there are more instances than the
+            // device's maxDrawIndirectCount.
+            CullingPass(VkLoader& loader, const GeometryPool& pool, const std::vector<Instance>& instances,
+                        const DepthPyramid& pyramid);
+            ~CullingPass();
+            CullingPass(const CullingPass&) = delete;
+            CullingPass& operator=(const CullingPass&) = delete;
+
+            // records the culling dispatch, outside of a render pass. occlusion tests against the
+            // pyramid as it was last built.
+            void Record(VkCommandBuffer cmd, const float view[16], const float proj[16], bool occlusion);
+            // records the draws, inside a render pass with a pipeline bound whose vertex input
+            // matches Vertex. Shaders find their instance at GetInstanceBuffer()[gl_InstanceIndex].
+            void Draw(VkCommandBuffer cmd) const;
+
+            // draws made by the most recent Record whose commands have finished executing.
+            uint32_t VisibleCount() const;
+            VkBuffer GetInstanceBuffer() const { return m_InstanceBuffer; }
+            uint32_t InstanceCount() const { return m_InstanceCount; }
+        private:
+            // matches CullData in cull.comp (std140).
+            struct CullUniforms {
+                float view[16];
+                float planes[6][4];
+                float p00, p11;
+                float znear;
+                float depth_a, depth_b;
+                uint32_t instance_count;
+                uint32_t occlusion;
+                uint32_t pyramid_levels;
+                float depth_size[2];
+                float pad[2];
+            };
+            void Destroy();
+        private:
+            VkDevice m_Device;
+            const GeometryPool& m_Pool;
+            const DepthPyramid& m_Pyramid;
+            uint32_t m_InstanceCount;
+            VkBuffer m_InstanceBuffer, m_DrawBuffer, m_CountBuffer, m_UniformBuffer, m_ReadbackBuffer;
+            VkDeviceMemory m_InstanceMemory, m_DrawMemory, m_CountMemory, m_UniformMemory, m_ReadbackMemory;
+            const uint32_t *m_Readback; // persistently mapped, host coherent
+            VkDescriptorSetLayout m_SetLayout;
+            VkDescriptorPool m_DescPool;
+            VkDescriptorSet m_Set;
+            VkPipelineLayout m_PipelineLayout;
+            VkPipeline m_Pipeline;
+    };
+}
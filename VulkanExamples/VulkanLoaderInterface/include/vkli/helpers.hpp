@@ -0,0 +1,31 @@
+/*
+    helpers.hpp: Small Vulkan helpers that vkli uses internally and shares with the examples.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vkli {
+    namespace helpers {
+        // throws std::runtime_error if no memory type in type_bits has all of props.
+        uint32_t FindMemoryType(VkPhysicalDevice dev, uint32_t type_bits, VkMemoryPropertyFlags props);
+        // size is in bytes, throws std::runtime_error on failure.
+        VkShaderModule CreateShaderModule(VkDevice dev, const uint32_t *code, size_t size);
+    }
+}
@@ -0,0 +1,58 @@
+/*
+    pixelconv.hpp: CPU pixel format conversion for uploads.
+
+    -Converts texels a device cannot sample or copy (vkGetPhysicalDeviceFormatProperties) into
+    -formats it can, writing straight into staging memory. Every kernel has a scalar version and,
+    -on x86, SSE2 and AVX2 versions picked at runtime from what the CPU supports. All versions
+    -give bit identical results, SetSimdLevel can force a lower one to check or time that.
+
+    -The kernels take pixel counts and tightly packed rows, src and dst must not overlap unless
+    -a kernel says so. None of them needs aligned pointers.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vkli {
+    enum class SimdLevel {Scalar, SSE2, AVX2};
+
+    // the best level the CPU (and OS) supports.
+    SimdLevel DetectSimdLevel();
+    // the level the kernels use, DetectSimdLevel() unless SetSimdLevel lowered it.
+    SimdLevel GetSimdLevel();
+    // uses level, or the best supported level below it. Returns the level now in use. Not thread
+    // safe with respect to running conversions.
+    SimdLevel SetSimdLevel(SimdLevel level);
+    const char *SimdLevelName(SimdLevel level);
+
+    // RGB8 to RGBA8, alpha set to alpha. Also BGR8 to BGRA8.
+    void ExpandRgbToRgba(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha = 255);
+    // RGBA8 to BGRA8 and back. src and dst may be the same.
+    void SwizzleRgbaToBgra(const uint8_t *src, uint8_t *dst, size_t pixels);
+    // RGBA8 with sRGB encoded colour to linear RGBA32F, alpha is divided by 255.
+    void SrgbToLinear(const uint8_t *src, float *dst, size_t pixels);
+    // linear RGBA32F to RGBA8 with sRGB encoded colour, through a 64K entry table. Within one step
+    // of the exactly rounded result, values are clamped to [0, 1] and NaN becomes 0.
+    void LinearToSrgb(const float *src, uint8_t *dst, size_t pixels);
+    // float to IEEE half with round to nearest even, overflow becomes infinity and every NaN
+    // becomes 0x7e00 (or 0xfe00).
+    void FloatToHalf(const float *src, uint16_t *dst, size_t count);
+    // the next mip level of an RGBA8 image, a 2x2 box filter rounding (sum + 2) >> 2 in every
+    // channel. dst is max(width / 2, 1) by max(height / 2, 1), an odd last column or row is
+    // dropped. Filters the stored values, convert sRGB data to linear first for correct results.
+    void DownsampleRgba(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst);
+}
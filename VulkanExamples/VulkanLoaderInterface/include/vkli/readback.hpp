@@ -0,0 +1,151 @@
+/*
+    readback.hpp: Asynchronous GPU to disk frame readback.
+
+    -Rendered images are copied into a ring of persistently mapped host-visible (host-cached if
+    -available) buffers. Copies are fenced and the fences are polled without blocking, finished
+    -slots are handed to an I/O thread which passes the mapped memory straight to a FrameSink.
+
+    -When every slot is either in flight or waiting on disk I/O, Enqueue blocks until the oldest
+    -slot is free again, so a slow disk throttles rendering instead of growing memory use.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vkli {
+    // data points into mapped memory and is only valid for the duration of FrameSink::Write.
+    struct ReadbackFrame {
+        uint64_t frame_id;
+        const uint8_t *data;
+        uint32_t width;
+        uint32_t height;
+        uint32_t row_pitch; // bytes
+        VkFormat format;
+    };
+
+    // FrameSink::Write is only ever called from the readback I/O thread, one frame at a time, in
+    // the order the frames were enqueued.
+    class FrameSink {
+        public:
+            virtual ~FrameSink() = default;
+            virtual bool Write(const ReadbackFrame& frame) = 0;
+    };
+
+    // appends every frame to a single file of tightly packed pixels, "-" writes to stdout.
+    class RawFrameSink : public FrameSink {
+        public:
+            RawFrameSink(const std::string& path);
+            ~RawFrameSink();
+            bool Write(const ReadbackFrame& frame) override;
+        private:
+            std::FILE *m_File;
+    };
+
+    // writes prefix_<frame id>.png for every frame. The PNGs are stored uncompressed, as deflate
+    // would make the I/O thread CPU bound. Only 8 bit RGBA and BGRA formats are supported.
+    class PngFrameSink : public FrameSink {
+        public:
+            PngFrameSink(const std::string& prefix);
+            bool Write(const ReadbackFrame& frame) override;
+        private:
+            std::string m_Prefix;
+            std::vector<uint8_t> m_Row; // only used to swizzle BGRA rows
+    };
+
+    class ReadbackRing {
+        public:
+            // this constructor will throw a std::runtime_error if the buffers cannot be created, the
+            // format is not supported or the extent is empty.
+            ReadbackRing(VkLoader& loader, VkExtent2D extent, VkFormat format,
+                         std::unique_ptr<FrameSink> sink, uint32_t n_slots = 3);
+            // writes out every enqueued frame before returning.
+            ~ReadbackRing();
+            ReadbackRing(const ReadbackRing&) = delete;
+            ReadbackRing& operator=(const ReadbackRing&) = delete;
+
+            // submits a copy of mip 0 of image to the loader's queue. image must be in
+            // VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL when the copy executes, wait is an optional
+            // semaphore signalled by the rendering submission. Blocks if the ring is full. Returns
+            // false if the copy could not be submitted or the device has been lost.
+            bool Enqueue(VkImage image, uint64_t frame_id, VkSemaphore wait = VK_NULL_HANDLE);
+            // hands any finished copies to the I/O thread, never blocks. Returns false once the
+            // device has been lost, the frames still in flight are then counted as failed.
+            bool Poll();
+            // blocks until every enqueued frame has been handed to the sink, returns false if any
+            // frame so far has failed to be copied or written.
+            bool Flush();
+
+            // frames the sink wrote successfully, and frames that were lost or failed to write.
+            uint64_t FramesWritten() const;
+            uint64_t FramesFailed() const;
+            // number of Enqueue calls that had to wait for a slot.
+            uint64_t Stalls() const { return m_Stalls; }
+        private:
+            enum SlotState {SLOT_FREE, SLOT_RECORDING, SLOT_GPU, SLOT_IO};
+            struct Slot {
+                VkBuffer buffer {VK_NULL_HANDLE};
+                VkDeviceMemory memory {VK_NULL_HANDLE};
+                uint8_t *mapped {nullptr};
+                VkCommandBuffer cmd {nullptr};
+                VkFence fence {VK_NULL_HANDLE};
+                uint64_t frame_id {0};
+                SlotState state {SLOT_FREE};
+            };
+        private:
+            // these expect m_Mutex to be held, Harvest drops it while blocking on a fence and
+            // returns false if a fence reports an error such as VK_ERROR_DEVICE_LOST.
+            bool Harvest(std::unique_lock<std::mutex>& lock, bool block);
+            void HandToIoLocked(uint32_t index);
+            void FailInFlightLocked(VkResult result);
+            // records the copy into slot and submits it, called without m_Mutex held.
+            bool Submit(Slot& slot, VkImage image, uint64_t frame_id, VkSemaphore wait);
+            void IoThread();
+            void Destroy();
+        private:
+            VkDevice m_Device;
+            VkQueue m_Queue;
+            VkExtent2D m_Extent;
+            VkFormat m_Format;
+            uint32_t m_RowPitch;
+            VkDeviceSize m_FrameSize;
+            bool m_Coherent;
+            VkCommandPool m_CmdPool;
+            std::vector<Slot> m_Slots;
+            uint32_t m_NextSlot;
+            std::deque<uint32_t> m_InFlight; // submission order
+            std::deque<uint32_t> m_IoQueue;
+            std::unique_ptr<FrameSink> m_Sink;
+            mutable std::mutex m_Mutex;
+            std::condition_variable m_IoCv;   // I/O thread has work, or should stop
+            std::condition_variable m_FreeCv; // a slot went back to SLOT_FREE
+            bool m_Stop;
+            bool m_DeviceLost;
+            uint64_t m_Written;
+            uint64_t m_Failed;
+            uint64_t m_Stalls;
+            std::thread m_IoThread;
+    };
+}
@@ -0,0 +1,200 @@
+/*
+    residency.hpp: Memory budget tracking and residency management.
+
+    -ResidencyPolicy decides what has to leave device local memory and what may come back. It
+    -only sees HeapSnapshots and the resources it is told about, never the device, so it can be
+    -driven with simulated heaps. When a heap goes over high_water of its budget it picks
+    -victims until the heap is back under low_water. Victims are picked by priority first, then
+    -least recently used. A victim that allows it is demoted to a host visible heap with room;
+    -any other victim is evicted. Demoted resources that are in use again are promoted back while
+    -their heap stays under high_water with them included. Resources used by a frame still in
+    -flight, and ResidencyPriority::Critical ones, are never picked.
+
+    -ResidencyManager is the Vulkan side. It reads the heap budgets through VK_EXT_memory_budget
+    -if the device has it enabled, or else counts its own allocations against a fraction of each
+    -heap. It allocates device memory for resources and sets VK_EXT_memory_priority hints from
+    -their priority. A demotable resource that does not fit the device local budget, or that the
+    -driver refuses with VK_ERROR_OUT_OF_DEVICE_MEMORY, falls back to host visible memory instead
+    -of failing. Any other resource goes to device local memory over the budget too, and fails if
+    -the driver refuses it.
+
+    -Update returns actions the application has to carry out straight away, since only it knows
+    -how to rebuild or copy a resource:
+    -    for(const ResidencyAction& action : manager.Update(frame))
+    -        Evict -> Release the allocation, recreate the resource when it is needed again
+    -        Demote / Promote -> Move to MemoryTarget::Host / Device and copy the contents
+    -Released and moved from allocations no longer count against the budget, and are Freed once
+    -the frames using them have finished, or handed to Free with the last frame using them, which
+    -leaves that wait to the loader's DeletionQueue. Actions that are not carried out are planned
+    -again.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace vkli {
+    // Critical resources are never evicted or demoted.
+    enum class ResidencyPriority : uint8_t {Low, Normal, High, Critical};
+
+    struct HeapSnapshot {
+        VkDeviceSize budget; // what this process may use without degrading
+        VkDeviceSize usage;  // what it uses now
+        bool device_local;
+        bool host_visible;   // has a host visible memory type, so it can take demoted resources
+    };
+
+    struct ResidencyAction {
+        enum Kind {Evict, Demote, Promote};
+        Kind kind;
+        uint64_t resource;
+        uint32_t heap; // where Demote and Promote move the resource to
+    };
+
+    struct ResidencyPolicyConfig {
+        float high_water {0.95f};     // of the budget, planning starts above it
+        float low_water {0.85f};      // of the budget, planning frees down to it
+        uint32_t frames_in_flight {2};
+    };
+
+    // not thread safe.
+    class ResidencyPolicy {
+        public:
+            ResidencyPolicy(const ResidencyPolicyConfig& config = {});
+
+            // heap is where the resource lives now, home the device local heap it belongs in
+            // (the same as heap unless it was demoted). Returns the id of the resource.
+            uint64_t Track(uint32_t heap, uint32_t home, VkDeviceSize size, ResidencyPriority priority,
+                           bool demotable, uint64_t frame);
+            // for a resource that was moved by a Demote or Promote.
+            void Move(uint64_t resource, uint32_t heap);
+            void Untrack(uint64_t resource);
+            void Use(uint64_t resource, uint64_t frame);
+            void SetPriority(uint64_t resource, ResidencyPriority priority);
+
+            // actions that bring every heap back under its budget, and promotions that fit.
+            std::vector<ResidencyAction> Plan(const std::vector<HeapSnapshot>& heaps, uint64_t frame) const;
+            // whether size more bytes keep heap under high_water.
+            bool Fits(const HeapSnapshot& heap, VkDeviceSize size) const;
+
+            size_t Tracked() const { return m_Resources.size(); }
+            const ResidencyPolicyConfig& Config() const { return m_Config; }
+        private:
+            struct Resource {
+                uint32_t heap;
+                uint32_t home;
+                VkDeviceSize size;
+                ResidencyPriority priority;
+                bool demotable;
+                uint64_t last_used;
+            };
+            // host visible heap, other than from, with room for size bytes, or UINT32_MAX.
+            uint32_t DemotionHeap(const std::vector<HeapSnapshot>& heaps, uint32_t from, VkDeviceSize size) const;
+        private:
+            ResidencyPolicyConfig m_Config;
+            std::unordered_map<uint64_t, Resource> m_Resources;
+            uint64_t m_NextId;
+    };
+
+    enum class MemoryTarget {Device, Host};
+
+    struct ResidencyConfig {
+        // set these when the device was created with VK_EXT_memory_budget / VK_EXT_memory_priority,
+        // the latter with the memoryPriority feature enabled through DeviceFeatures::next.
+        bool memory_budget {false};
+        bool memory_priority {false};
+        float own_budget {0.8f};       // of each heap's size, without VK_EXT_memory_budget
+        VkDeviceSize budget_limit {0}; // caps every heap's budget when not 0, for testing
+        ResidencyPolicyConfig policy;
+    };
+
+    struct ResidencyAllocation {
+        uint64_t resource {0};
+        VkDeviceMemory memory {VK_NULL_HANDLE};
+        VkDeviceSize size {0};
+        uint32_t memory_type {0};
+        uint32_t heap {0};
+        bool device_local {false};
+        ResidencyPriority priority {ResidencyPriority::Normal};
+    };
+
+    struct ResidencyStats {
+        uint64_t allocated;   // allocations made
+        uint64_t fallbacks;   // of those, ones that wanted device local memory and got host memory
+        uint64_t failed;      // allocations that could not be made at all
+        uint64_t evictions;   // planned by Update
+        uint64_t demotions;
+        uint64_t promotions;
+    };
+
+    // not thread safe.
+    class ResidencyManager {
+        public:
+            // this constructor will throw a std::runtime_error if loader has no logical device.
+            ResidencyManager(VkLoader& loader, const ResidencyConfig& config = {});
+            // every allocation must have been freed.
+            ~ResidencyManager();
+            ResidencyManager(const ResidencyManager&) = delete;
+            ResidencyManager& operator=(const ResidencyManager&) = delete;
+
+            // allocates memory for reqs, in target if it fits the budget. Device falls back to host
+            // visible memory if the resource is demotable. Returns an allocation with a null
+            // memory handle on failure.
+            ResidencyAllocation Allocate(const VkMemoryRequirements& reqs, ResidencyPriority priority,
+                                         bool demotable, uint64_t frame, MemoryTarget target = MemoryTarget::Device);
+            // allocates new memory in target for the resource of from, which keeps its memory but
+            // no longer belongs to the resource. from is then freed like any other allocation.
+            // Returns an allocation with a null memory handle, and leaves from alone, on failure.
+            ResidencyAllocation Move(ResidencyAllocation& from, const VkMemoryRequirements& reqs, MemoryTarget target);
+            // untracks the resource, its memory stays allocated until Free but is no longer counted.
+            void Release(ResidencyAllocation& allocation);
+            // the memory must not be in use any more. Untracks the resource if it was not released
+            // or moved from.
+            void Free(ResidencyAllocation& allocation);
+            // the same for memory frames up to retire_frame may still use. It stops counting straight
+            // away, and is freed by the loader's DeletionQueue once Collect has seen retire_frame.
+            void Free(ResidencyAllocation& allocation, uint64_t retire_frame);
+            void Use(const ResidencyAllocation& allocation, uint64_t frame) { m_Policy.Use(allocation.resource, frame); }
+            // the memory priority hint only changes with the next Move.
+            void SetPriority(ResidencyAllocation& allocation, ResidencyPriority priority);
+
+            std::vector<ResidencyAction> Update(uint64_t frame);
+            // the budget and usage of every heap, as the policy sees them.
+            std::vector<HeapSnapshot> Heaps() const;
+            const ResidencyPolicy& Policy() const { return m_Policy; }
+            ResidencyStats Stats() const { return m_Stats; }
+        private:
+            // a memory type in type_bits for target, or UINT32_MAX.
+            uint32_t FindType(uint32_t type_bits, MemoryTarget target) const;
+            bool TryAllocate(const VkMemoryRequirements& reqs, uint32_t type, ResidencyPriority priority,
+                             ResidencyAllocation& allocation);
+            // takes the allocation out of the policy and the heap usage.
+            void Forget(const ResidencyAllocation& allocation);
+        private:
+            VkLoader& m_Loader;
+            VkDevice m_Device;
+            VkPhysicalDevice m_PhysDevice;
+            ResidencyConfig m_Config;
+            VkPhysicalDeviceMemoryProperties m_MemProps;
+            ResidencyPolicy m_Policy;
+            std::vector<VkDeviceSize> m_HeapUsage; // what this manager has allocated, per heap
+            std::vector<VkDeviceSize> m_Retiring;  // of that, released and moved from memory
+            ResidencyStats m_Stats;
+    };
+}
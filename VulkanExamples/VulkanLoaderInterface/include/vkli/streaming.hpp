@@ -0,0 +1,168 @@
+/*
+    streaming.hpp: Asynchronous texture streaming from memory mapped KTX2 and DDS files.
+
+    -Load returns immediately. A worker pool maps the file, parses its header, checks the format
+    -with vkGetPhysicalDeviceFormatProperties and creates the image, then the mip tail (every level
+    -no larger than StreamerConfig::tail_size) is uploaded as one unit so something can be drawn as
+    -soon as possible. The larger levels follow one at a time, highest priority texture first.
+
+    -Level data is copied from the mapping into staging memory by the workers, and the copies into
+    -the images are submitted to the loader's transfer queue. Update must be called once per frame
+    -to submit filled batches and publish finished levels.
+
+    -RGB8 and BGR8 textures, which few devices can sample, are uploaded as RGBA8 / BGRA8 with an
+    -opaque alpha channel. The workers expand them while copying into staging memory, with the
+    -SIMD kernels of pixelconv.hpp.
+
+    -Supercompressed KTX2 files (BasisLZ, zstd, ...) are rejected, vkli has no transcoder.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vkli {
+    class WorkerPool;
+
+    typedef uint32_t TextureId;
+
+    struct StreamerConfig {
+        VkDeviceSize batch_size {16 << 20};  // staging bytes per upload batch
+        uint32_t batches {3};                // upload batches that can be in flight at once
+        VkDeviceSize tail_size {64 << 10};   // levels at most this big are uploaded first, together
+        unsigned worker_threads {0};         // 0 = one per hardware thread
+    };
+
+    enum TextureState {TEXTURE_LOADING, TEXTURE_STREAMING, TEXTURE_RESIDENT, TEXTURE_FAILED};
+
+    // image and view are valid from TEXTURE_STREAMING on. Every level of the image is kept in
+    // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, but only levels >= resident_level hold data, so
+    // sampling must clamp the LOD to resident_level (e.g. textureLod or a sampler's minLod).
+    struct StreamedTexture {
+        TextureState state;
+        VkImage image;
+        VkImageView view;
+        VkFormat format;
+        VkExtent3D extent;
+        uint32_t levels;
+        uint32_t layers;
+        uint32_t resident_level; // == levels while nothing is resident
+    };
+
+    class TextureStreamer {
+        public:
+            // this constructor will throw a std::runtime_error if the staging batches cannot be created.
+            TextureStreamer(VkLoader& loader, const StreamerConfig& config = {});
+            // waits for in flight uploads, and destroys every image the streamer created.
+            ~TextureStreamer();
+            TextureStreamer(const TextureStreamer&) = delete;
+            TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+            // the file type is detected from its contents, not its name.
+            TextureId Load(const std::string& path, float priority = 0.0f);
+            // a higher priority streams sooner.
+            void SetPriority(TextureId id, float priority);
+            // call once per frame from the thread that submits to the loader's queues.
+            void Update();
+
+            StreamedTexture Get(TextureId id) const;
+            // true once no texture is loading or has levels left to upload.
+            bool Idle() const;
+        private:
+            struct Level {
+                VkExtent3D extent;
+                uint64_t layer_size; // bytes of one array layer
+                std::vector<uint64_t> layer_offsets; // into the mapped file
+            };
+            struct Texture {
+                std::string path;
+                TextureState state {TEXTURE_LOADING};
+                float priority {0.0f};
+                const uint8_t *file {nullptr};
+                size_t file_size {0};
+                VkImage image {VK_NULL_HANDLE};
+                VkDeviceMemory memory {VK_NULL_HANDLE};
+                VkImageView view {VK_NULL_HANDLE};
+                VkFormat format {VK_FORMAT_UNDEFINED};
+                VkExtent3D extent {1, 1, 1};
+                uint32_t block_w {1}, block_h {1}, block_bytes {0};
+                uint32_t file_block_bytes {0}; // less than block_bytes when 3 byte texels are expanded
+                uint32_t layers {1};
+                bool cube {false};
+                std::vector<Level> levels;
+                // upload cursor, only touched by Update. Levels [0, next_level) still need uploading,
+                // level next_level - 1 is copied from next_layer / next_unit onwards.
+                uint32_t next_level {0}, next_layer {0}, next_unit {0};
+                uint32_t resident_level {0};
+                bool initialised {false}; // every level has been moved out of VK_IMAGE_LAYOUT_UNDEFINED
+            };
+            struct Copy {
+                TextureId id;
+                uint32_t level, layer;
+                uint32_t unit_begin, unit_count; // block rows, or slices of a 3D image
+                VkDeviceSize staging_offset;
+            };
+            enum BatchState {BATCH_FREE, BATCH_FILLING, BATCH_SUBMITTED};
+            struct Batch {
+                VkBuffer buffer {VK_NULL_HANDLE};
+                VkDeviceMemory memory {VK_NULL_HANDLE};
+                uint8_t *mapped {nullptr};
+                VkCommandBuffer cmd {nullptr};
+                VkFence fence {VK_NULL_HANDLE};
+                BatchState state {BATCH_FREE};
+                VkDeviceSize used {0};
+                std::atomic<uint32_t> pending_copies {0}; // staging copies still running on workers
+                std::vector<Copy> copies;
+                std::vector<std::pair<TextureId, uint32_t>> completes; // texture, new resident level
+            };
+        private:
+            static bool ParseKtx2(Texture& tex, std::string& error);
+            static bool ParseDds(Texture& tex, std::string& error);
+            void Prepare(TextureId id);
+            bool SelectFormat(Texture& tex, std::string& error) const;
+            bool CreateImage(Texture& tex, std::string& error);
+            void ReleaseTexture(Texture& tex);
+            void Retire();
+            bool FillBatch(Batch& batch);
+            bool SubmitBatch(Batch& batch);
+            // a level is copied in units of block rows, or of slices for 3D images.
+            uint64_t UnitSize(const Texture& tex, uint32_t level) const;
+            uint32_t UnitCount(const Texture& tex, uint32_t level) const;
+            uint64_t StagingLayerSize(const Texture& tex, uint32_t level) const;
+            void Destroy();
+        private:
+            VkDevice m_Device;
+            VkPhysicalDevice m_PhysDevice;
+            VkQueue m_Queue;
+            uint32_t m_QueueFamily;
+            uint32_t m_GraphicsFamily;
+            StreamerConfig m_Config;
+            VkCommandPool m_CmdPool;
+            std::vector<std::unique_ptr<Batch>> m_Batches;
+            std::deque<Batch *> m_Filling;   // in the order they were filled
+            std::deque<Batch *> m_Submitted; // in the order they were submitted
+            mutable std::mutex m_Mutex;    // guards Texture::state and the texture list
+            std::deque<Texture> m_Textures;
+            std::unique_ptr<WorkerPool> m_Pool;
+    };
+}
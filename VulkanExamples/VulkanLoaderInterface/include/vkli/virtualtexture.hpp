@@ -0,0 +1,179 @@
+/*
+    virtualtexture.hpp: Virtual texturing on sparse resident images.
+
+    -A VirtualTexture reserves a sparse resident image that can be far larger than device memory,
+    -and backs it with a fixed pool of memory pages. Every page holds one tile (the image's sparse
+    -block, 64KiB for the standard block shapes). Only the mip tail is resident from the start.
+    -Shaders mark the tiles they want in a feedback buffer, one bit per tile of every level below
+    -the mip tail (see VirtualTextureInfo). Update reads the feedback of a finished frame. It makes
+    -the requested tiles and their coarser parents resident, coarsest first. When the pool is full
+    -it evicts the least recently used pages, and it asks a PageProvider for the texels.
+    -Every bind and unbind of a frame goes to a single vkQueueBindSparse.
+
+    -A page is only evicted once no frame in flight can have requested it. A frame in flight can
+    -still sample a tile it did not request, so the bind also waits on the release semaphore every
+    -frame's submit signals, and no frame ever sees a page change under it.
+
+    -Per frame, with slot = frame % frames_in_flight, once the slot's previous frame has finished:
+    -    VkSemaphore bound {vt.Update(slot)};   // wait on it in the frame's submit, if not null
+    -    vt.RecordBegin(cmd);                    // before the render pass
+    -    ... draw, writing feedback into GetFeedbackBuffer(slot) ...
+    -    vt.RecordEnd(cmd);
+    -    submit cmd, waiting on bound and signalling GetReleaseSemaphore(slot)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vkli/vkli.hpp"
+
+#include <cstdint>
+#include <list>
+#include <vector>
+
+namespace vkli {
+    // produces the texels of a virtual texture, from a tiled file, procedurally, ... Called on the
+    // thread that calls VirtualTexture::Update, and by its constructor for the mip tail.
+    class PageProvider {
+        public:
+            virtual ~PageProvider() = default;
+            // writes extent.width * extent.height texels of level, from texel offset on, with
+            // tightly packed rows. Returning false leaves the tile missing, it is asked for again
+            // the next time a frame requests it. Tiles of the mip tail must not fail.
+            virtual bool Fill(uint32_t level, VkOffset2D offset, VkExtent2D extent, void *dst) = 0;
+    };
+
+    struct VirtualTextureConfig {
+        VkFormat format {VK_FORMAT_R8G8B8A8_UNORM}; // an uncompressed colour format
+        VkExtent2D extent {16384, 16384};
+        uint32_t levels {0};                 // 0 = the full mip chain
+        uint32_t pool_pages {1024};          // the memory budget, in pages
+        uint32_t max_uploads_per_frame {32}; // tiles made resident by one Update at most
+        uint32_t frames_in_flight {2};
+    };
+
+    // layout shared with shaders (std140 and std430). Tile (x, y) of level l < sparse_levels is
+    // feedback bit level_tiles[l][0] + y * level_tiles[l][1] + x, in an array of uint.
+    struct VirtualTextureInfo {
+        uint32_t width, height;
+        uint32_t tile_width, tile_height;
+        uint32_t sparse_levels; // levels below the mip tail
+        uint32_t levels;
+        uint32_t pad[2];
+        uint32_t level_tiles[16][4]; // first feedback bit, tiles across, tiles down, unused
+    };
+
+    struct VirtualTextureStats {
+        uint32_t resident_pages;
+        uint32_t requested;  // tiles requested by the last feedback, parents included
+        uint32_t uploaded;   // by the last Update
+        uint32_t evicted;    // by the last Update
+        uint32_t missing;    // requested but not resident after the last Update
+        VkDeviceSize page_size;
+        VkDeviceSize virtual_size; // what the whole image would take if it were resident
+    };
+
+    class VirtualTexture {
+        public:
+            // sparseBinding, sparseResidencyImage2D, shaderResourceResidency for the residency checks
+            // in shaders, and a queue with VK_QUEUE_SPARSE_BINDING_BIT.
+            static void RequireFeatures(DeviceFeatures& features);
+
+            // provider must outlive the texture. This constructor will throw a std::runtime_error if
+            // the format cannot be sparse resident, or the image, the pool or the mip tail cannot
+            // be created.
+            VirtualTexture(VkLoader& loader, PageProvider& provider, const VirtualTextureConfig& config = {});
+            ~VirtualTexture();
+            VirtualTexture(const VirtualTexture&) = delete;
+            VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+            // processes the feedback the slot's previous frame wrote, which must have finished, and
+            // binds and fills pages for it once every frame submitted before has finished. Returns a
+            // semaphore the slot's next submit must wait on (at VK_PIPELINE_STAGE_TRANSFER_BIT), or
+            // VK_NULL_HANDLE if binding failed.
+            VkSemaphore Update(uint32_t slot);
+            // outside of a render pass, before anything samples the image or writes feedback:
+            // copies the new tiles into the image and clears the slot's feedback.
+            void RecordBegin(VkCommandBuffer cmd) const;
+            // after the last feedback write, makes the feedback visible to the next Update.
+            void RecordEnd(VkCommandBuffer cmd) const;
+
+            // the image is always in VK_IMAGE_LAYOUT_GENERAL.
+            VkImage GetImage() const { return m_Image; }
+            VkImageView GetView() const { return m_View; }
+            VkSampler GetSampler() const { return m_Sampler; }
+            VkBuffer GetFeedbackBuffer(uint32_t slot) const { return m_Frames[slot].feedback; }
+            // every submit after an Update(slot) must signal it, the next Update waits on it.
+            VkSemaphore GetReleaseSemaphore(uint32_t slot) const { return m_Frames[slot].released; }
+            const VirtualTextureInfo& Info() const { return m_Info; }
+            VirtualTextureStats Stats() const { return m_Stats; }
+        private:
+            struct Frame {
+                VkBuffer feedback {VK_NULL_HANDLE};
+                VkDeviceMemory feedback_memory {VK_NULL_HANDLE};
+                const uint32_t *feedback_bits {nullptr};
+                VkBuffer staging {VK_NULL_HANDLE};
+                VkDeviceMemory staging_memory {VK_NULL_HANDLE};
+                uint8_t *staging_data {nullptr};
+                VkSemaphore bound {VK_NULL_HANDLE};
+                VkSemaphore released {VK_NULL_HANDLE}; // signalled by the slot's submit
+            };
+            struct Page {
+                uint32_t tile;       // none while free
+                uint64_t last_used;  // frame number
+                std::list<uint32_t>::iterator lru;
+            };
+            static constexpr uint32_t none {UINT32_MAX}; // no page, or no tile
+
+            void CreatePool();
+            void InitialiseTail(const std::vector<VkSparseImageMemoryRequirements>& sparse_reqs);
+            void Destroy();
+            void Touch(uint32_t page);
+            // a free page, or the least recently used one if no frame in flight can still want it.
+            // evicted is set to the tile that has to be unbound, or none.
+            uint32_t AcquirePage(uint32_t& evicted);
+            VkSparseImageMemoryBind TileBind(uint32_t tile, uint32_t page) const;
+            void TileRegion(uint32_t tile, uint32_t& level, VkOffset3D& offset, VkExtent3D& extent) const;
+            // the tile of the next coarser level covering tile, or none at the last sparse level.
+            uint32_t ParentTile(uint32_t tile) const;
+        private:
+            VkDevice m_Device;
+            VkPhysicalDevice m_PhysDevice;
+            VkQueue m_Queue;
+            uint32_t m_QueueFamily;
+            PageProvider& m_Provider;
+            VirtualTextureConfig m_Config;
+            VirtualTextureInfo m_Info;
+            VirtualTextureStats m_Stats;
+            uint32_t m_TexelSize;
+            VkDeviceSize m_TileBytes;
+            uint32_t m_MemoryType;
+            VkPipelineStageFlags m_ShaderStages; // that can sample the image on this queue
+            VkImage m_Image;
+            VkImageView m_View;
+            VkSampler m_Sampler;
+            VkDeviceMemory m_TailMemory;
+            std::vector<VkDeviceMemory> m_Chunks; // the page pool, pages_per_chunk pages each
+            uint32_t m_TileCount;
+            std::vector<uint32_t> m_TilePages;   // page of every tile, or none
+            std::vector<Page> m_Pages;
+            std::vector<uint32_t> m_FreePages;
+            std::list<uint32_t> m_Lru;           // resident pages, least recently used first
+            std::vector<Frame> m_Frames;
+            std::vector<VkSemaphore> m_Released;     // submitted releases the next bind waits on
+            std::vector<VkBufferImageCopy> m_Copies; // from m_Frames[m_Slot].staging, for RecordBegin
+            uint32_t m_Slot;
+            uint64_t m_Frame;
+    };
+}
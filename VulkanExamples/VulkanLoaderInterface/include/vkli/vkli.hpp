@@ -23,12 +23,15 @@
 #include "vkli/vkapi.hpp"
 #include "GLFW/glfw3.h"
 
+#include <future>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <vector>
 
 namespace vkli {
+    class DeletionQueue;
+
     inline VkApplicationInfo default_app_info {
         VK_STRUCTURE_TYPE_APPLICATION_INFO,
         nullptr,
@@ -71,16 +74,52 @@ namespace vkli {
         std::vector<VkPresentModeKHR> prmodes;
     };
 
+    // Optional features for CreateDevice. A physical device is only considered if it supports every
+    // feature set to VK_TRUE here, in the same way as it must support every requested extension.
+    struct DeviceFeatures {
+        VkPhysicalDeviceFeatures core {};
+        VkPhysicalDeviceVulkan12Features v12 {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+        // a chain of extension feature structures (VkPhysicalDeviceMemoryPriorityFeaturesEXT, ...),
+        // passed on to the device as it is. Unlike the features above these are not checked against
+        // the physical devices, their extensions must be requested and supported by every device.
+        // The chain must stay valid until the device has been created.
+        void *next {nullptr};
+        // what the main queue (GetQueue) must support. VK_QUEUE_COMPUTE_BIT alone gives a compute
+        // only device, which prefers a family without graphics and needs no window or surface.
+        VkQueueFlags queue_flags {VK_QUEUE_GRAPHICS_BIT};
+    };
+
+    // everything VkLoader::CreateAsync needs to get from nothing to a logical device.
+    struct LoaderConfig {
+        std::vector<std::string> layers;
+        std::vector<std::string> instance_extensions;
+        std::vector<std::string> device_extensions;
+        DeviceFeatures features;
+        VkApplicationInfo app_info {default_app_info};
+    };
+
     struct DeviceFPs {
         VkDevice dev;
         PFN_vkCreateSwapchainKHR vkCreateSwapchainKHR;
     };
 
+    // terminates GLFW. Only the main thread may call this, and only after a VkLoader::CreateAsync
+    // that failed. A loader that was created terminates GLFW itself.
+    void TerminateGlfw();
+
     class VkLoader {
         public:
             // this constructor will throw a std::runtime_error if a working Vulkan Loader cannot be found.
             VkLoader();
             ~VkLoader();
+            // finds the Vulkan Loader, creates the instance and creates the device on a background
+            // thread, and returns straight away so the caller can create its window and load assets
+            // in the meantime. Must be called from the main thread, which GLFW is initialised on, and
+            // throws a std::runtime_error straight away if GLFW cannot be initialised.
+            // The future rethrows a std::runtime_error naming the stage that failed. The loader it
+            // returns terminates GLFW when it is destroyed. After a failure GLFW is still
+            // initialised, and the main thread has to call TerminateGlfw once it is done with it.
+            static std::future<std::unique_ptr<VkLoader>> CreateAsync(LoaderConfig config);
             bool CreateInstance(VkInstanceCreateInfo& create_info);
             bool CreateInstance(std::vector<std::string>& layers,
                                 std::vector<std::string>& extensions,
@@ -89,13 +128,28 @@ namespace vkli {
                                 std::vector<PriorityList>& extensions, 
                                 VkApplicationInfo& app_info = default_app_info);
             bool CreateDevice(VkDeviceCreateInfo& create_info, VkPhysicalDevice& pdev);
-            bool CreateDevice(std::vector<std::string>& extensions);
+            bool CreateDevice(std::vector<std::string>& extensions, const DeviceFeatures *features = nullptr);
             bool CreateSurface();
+            // the same, with a window the caller created (with GLFW_CLIENT_API set to GLFW_NO_API).
+            bool CreateSurface(GLFWwindow *window);
+            VkInstance GetInstance() const { return m_Instance; }
+            VkDevice GetDevice() const { return m_Device; }
+            VkPhysicalDevice GetPhysicalDevice() const { return m_PhysDevice; }
+            VkQueue GetQueue() const { return m_Queue; }
+            uint32_t GetQueueFamily() const { return m_QueueFamily; }
+            // a dedicated transfer queue if the device has one, otherwise the same queue as GetQueue.
+            VkQueue GetTransferQueue() const { return m_TransferQueue; }
+            uint32_t GetTransferQueueFamily() const { return m_TransferQueueFamily; }
+            // only valid once a logical device exists, drained before the device is destroyed.
+            DeletionQueue& GetDeletionQueue() const { return *m_DeletionQueue; }
         public:
             LoaderInfo m_ldrinfo;
             InstanceInfo m_instinfo;
             SwapchainInfo m_swapinfo;
         private:
+            // loads the entry points only, GLFW and the loader info are left to CreateAsync.
+            struct DeferredInit {};
+            VkLoader(DeferredInit);
             void InitLoaderInfo();
             void FillFromPriorityLists(std::vector<std::string>& output, 
                                        const std::vector<PriorityList>& PLists,
@@ -104,7 +158,13 @@ namespace vkli {
             VkInstance m_Instance;
             VkDevice m_Device; // for now just use 1 device
             VkPhysicalDevice m_PhysDevice;
+            VkQueue m_Queue;
+            uint32_t m_QueueFamily;
+            VkQueue m_TransferQueue;
+            uint32_t m_TransferQueueFamily;
+            std::unique_ptr<DeletionQueue> m_DeletionQueue;
             GLFWwindow *m_Window;
+            bool m_TerminateGlfw; // only the thread that initialised GLFW may terminate it
             VkSurfaceKHR *m_Surface; // temporary
             VkSwapchainKHR *m_Swapchain;
             DeviceFPs m_dfps;
@@ -0,0 +1,257 @@
+/*
+    bindless.cpp: Implementation of the global bindless descriptor table from bindless.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/bindless.hpp"
+#include "vkli-internal.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace vkli {
+    void BindlessTable::RequireFeatures(DeviceFeatures& features) {
+        features.v12.runtimeDescriptorArray = VK_TRUE;
+        features.v12.descriptorBindingPartiallyBound = VK_TRUE;
+        features.v12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        features.v12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        features.v12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        features.v12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        features.v12.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+    }
+
+    BindlessTable::BindlessTable(VkLoader& loader, const BindlessCapacity& capacity)
+        : m_Device{loader.GetDevice()}, m_Layout{VK_NULL_HANDLE}, m_Pool{VK_NULL_HANDLE}, m_Set{VK_NULL_HANDLE}
+    {
+        if(m_Device == nullptr)
+            throw std::runtime_error("[ERROR] BindlessTable needs a logical device, call CreateDevice first.");
+
+        VkPhysicalDeviceVulkan12Properties v12_props {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES};
+        VkPhysicalDeviceProperties2 props2 {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &v12_props};
+        vkGetPhysicalDeviceProperties2(loader.GetPhysicalDevice(), &props2);
+
+        m_Slots[BINDLESS_SAMPLED_IMAGE].capacity = std::min({capacity.sampled_images,
+            v12_props.maxDescriptorSetUpdateAfterBindSampledImages,
+            v12_props.maxPerStageDescriptorUpdateAfterBindSampledImages});
+        m_Slots[BINDLESS_STORAGE_BUFFER].capacity = std::min({capacity.storage_buffers,
+            v12_props.maxDescriptorSetUpdateAfterBindStorageBuffers,
+            v12_props.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+        m_Slots[BINDLESS_SAMPLER].capacity = std::min({capacity.samplers,
+            v12_props.maxDescriptorSetUpdateAfterBindSamplers,
+            v12_props.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+        // every binding is visible to all stages, so the three together also have to fit the
+        // per stage resource limit. Scaling them down keeps their proportions.
+        uint64_t total {0};
+        for(const auto& slots : m_Slots) total += slots.capacity;
+        const uint64_t max_resources {v12_props.maxPerStageUpdateAfterBindResources};
+        if(total > max_resources) {
+            std::clog << "[INFO] Bindless capacities add up to " << total << " descriptors, the device allows "
+                      << max_resources << " per stage. Scaling them down." << std::endl;
+            for(auto& slots : m_Slots)
+                slots.capacity = static_cast<uint32_t>(slots.capacity * max_resources / total);
+        }
+
+        const std::array<VkDescriptorType, BINDLESS_TYPE_COUNT> types {
+            VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            VK_DESCRIPTOR_TYPE_SAMPLER
+        };
+
+        std::array<VkDescriptorSetLayoutBinding, BINDLESS_TYPE_COUNT> bindings;
+        std::array<VkDescriptorBindingFlags, BINDLESS_TYPE_COUNT> binding_flags;
+        std::array<VkDescriptorPoolSize, BINDLESS_TYPE_COUNT> pool_sizes;
+        for(uint32_t i = 0; i < BINDLESS_TYPE_COUNT; i++) {
+            bindings[i] = {
+                i, // binding, the same as the BindlessType
+                types[i],
+                m_Slots[i].capacity,
+                VK_SHADER_STAGE_ALL,
+                nullptr // immutable samplers
+            };
+            binding_flags[i] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                               VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                               VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+            pool_sizes[i] = {types[i], m_Slots[i].capacity};
+        }
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+            nullptr,
+            static_cast<uint32_t>(binding_flags.size()),
+            binding_flags.data()
+        };
+
+        VkDescriptorSetLayoutCreateInfo layout_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            &flags_info,
+            VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+            static_cast<uint32_t>(bindings.size()),
+            bindings.data()
+        };
+
+        if(vkCreateDescriptorSetLayout(m_Device, &layout_info, nullptr, &m_Layout) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Creating the bindless descriptor set layout failed");
+
+        VkDescriptorPoolCreateInfo pool_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            nullptr,
+            VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+            1, // max sets
+            static_cast<uint32_t>(pool_sizes.size()),
+            pool_sizes.data()
+        };
+
+        if(vkCreateDescriptorPool(m_Device, &pool_info, nullptr, &m_Pool) != VK_SUCCESS) {
+            vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+            throw std::runtime_error("[ERROR] Creating the bindless descriptor pool failed");
+        }
+
+        VkDescriptorSetAllocateInfo alloc_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            nullptr,
+            m_Pool,
+            1,
+            &m_Layout
+        };
+
+        if(vkAllocateDescriptorSets(m_Device, &alloc_info, &m_Set) != VK_SUCCESS) {
+            vkDestroyDescriptorPool(m_Device, m_Pool, nullptr);
+            vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+            throw std::runtime_error("[ERROR] Allocating the bindless descriptor set failed");
+        }
+
+        std::clog << "[INFO] Bindless table created with " << m_Slots[BINDLESS_SAMPLED_IMAGE].capacity
+                  << " images, " << m_Slots[BINDLESS_STORAGE_BUFFER].capacity << " buffers, "
+                  << m_Slots[BINDLESS_SAMPLER].capacity << " samplers" << std::endl;
+    }
+
+    BindlessTable::~BindlessTable() {
+        // the set is freed with the pool.
+        if(m_Pool) vkDestroyDescriptorPool(m_Device, m_Pool, nullptr);
+        if(m_Layout) vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+    }
+
+    uint32_t BindlessTable::AllocSlot(BindlessType type) {
+        SlotAllocator& slots {m_Slots[type]};
+        if(!slots.free.empty()) {
+            uint32_t handle {slots.free.back()};
+            slots.free.pop_back();
+            slots.live[handle] = true;
+            return handle;
+        }
+        if(slots.high_water < slots.capacity) {
+            slots.live.push_back(true);
+            return slots.high_water++;
+        }
+
+        std::clog << "[ERROR] Bindless table is full for binding " << type << std::endl;
+        return INVALID_HANDLE;
+    }
+
+    uint32_t BindlessTable::AddSampledImage(VkImageView view, VkImageLayout layout) {
+        uint32_t handle {AllocSlot(BINDLESS_SAMPLED_IMAGE)};
+        if(handle == INVALID_HANDLE) return handle;
+
+        VkDescriptorImageInfo image_info {VK_NULL_HANDLE, view, layout};
+        VkWriteDescriptorSet write {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            nullptr,
+            m_Set,
+            BINDLESS_SAMPLED_IMAGE,
+            handle, // array element
+            1,
+            VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+            &image_info,
+            nullptr,
+            nullptr
+        };
+        vkUpdateDescriptorSets(m_Device, 1, &write, 0, nullptr);
+        return handle;
+    }
+
+    uint32_t BindlessTable::AddStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+        uint32_t handle {AllocSlot(BINDLESS_STORAGE_BUFFER)};
+        if(handle == INVALID_HANDLE) return handle;
+
+        VkDescriptorBufferInfo buffer_info {buffer, offset, range};
+        VkWriteDescriptorSet write {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            nullptr,
+            m_Set,
+            BINDLESS_STORAGE_BUFFER,
+            handle,
+            1,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            nullptr,
+            &buffer_info,
+            nullptr
+        };
+        vkUpdateDescriptorSets(m_Device, 1, &write, 0, nullptr);
+        return handle;
+    }
+
+    uint32_t BindlessTable::AddSampler(VkSampler sampler) {
+        uint32_t handle {AllocSlot(BINDLESS_SAMPLER)};
+        if(handle == INVALID_HANDLE) return handle;
+
+        VkDescriptorImageInfo image_info {sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED};
+        VkWriteDescriptorSet write {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            nullptr,
+            m_Set,
+            BINDLESS_SAMPLER,
+            handle,
+            1,
+            VK_DESCRIPTOR_TYPE_SAMPLER,
+            &image_info,
+            nullptr,
+            nullptr
+        };
+        vkUpdateDescriptorSets(m_Device, 1, &write, 0, nullptr);
+        return handle;
+    }
+
+    void BindlessTable::Release(BindlessType type, uint32_t handle, uint64_t frame) {
+        SlotAllocator& slots {m_Slots[type]};
+        if(handle == INVALID_HANDLE || handle >= slots.high_water) {
+            std::clog << "[ERROR] Releasing invalid bindless handle " << handle << std::endl;
+            return;
+        }
+        // a second release would put the slot on the free list twice, and two later Adds would
+        // share it.
+        if(!slots.live[handle]) {
+            std::clog << "[ERROR] Releasing bindless handle " << handle << " twice" << std::endl;
+            return;
+        }
+        slots.live[handle] = false;
+        // the stale descriptor can stay in the slot, the bindings are partially bound.
+        m_Pending.push_back({frame, type, handle});
+    }
+
+    void BindlessTable::Retire(uint64_t completed_frame) {
+        while(!m_Pending.empty() && m_Pending.front().frame <= completed_frame) {
+            const PendingRelease& release {m_Pending.front()};
+            m_Slots[release.type].free.push_back(release.handle);
+            m_Pending.pop_front();
+        }
+    }
+
+    void BindlessTable::Bind(VkCommandBuffer cmd, VkPipelineBindPoint bind_point, VkPipelineLayout layout,
+                             uint32_t set_index) const
+    {
+        vkCmdBindDescriptorSets(cmd, bind_point, layout, set_index, 1, &m_Set, 0, nullptr);
+    }
+}
@@ -0,0 +1,270 @@
+/*
+    compute.cpp: Implementation of the compute kernel helpers from compute.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/compute.hpp"
+#include "vkli-internal.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace vkli {
+    namespace {
+        const uint32_t sets_per_pool {32};
+
+        // copies between host memory and a device local buffer through a staging buffer.
+        bool StagedCopy(VkLoader& loader, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                        void *host, bool to_device) {
+            VkDevice dev {loader.GetDevice()};
+            VkBuffer staging {VK_NULL_HANDLE};
+            VkDeviceMemory staging_memory {VK_NULL_HANDLE};
+            void *mapped {nullptr};
+            try {
+                helpers::CreateBuffer(dev, loader.GetPhysicalDevice(), size,
+                                      to_device ? VK_BUFFER_USAGE_TRANSFER_SRC_BIT : VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                      staging, staging_memory);
+                if(vkMapMemory(dev, staging_memory, 0, size, 0, &mapped) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Mapping a staging buffer failed");
+                if(to_device) std::memcpy(mapped, host, size);
+                helpers::ImmediateSubmit(dev, loader.GetQueue(), loader.GetQueueFamily(), [&](VkCommandBuffer cmd) {
+                    VkBufferCopy region {to_device ? 0 : offset, to_device ? offset : 0, size};
+                    if(to_device) vkCmdCopyBuffer(cmd, staging, buffer, 1, &region);
+                    else vkCmdCopyBuffer(cmd, buffer, staging, 1, &region);
+                });
+                if(!to_device) std::memcpy(host, mapped, size);
+            } catch(std::runtime_error& e) {
+                std::clog << e.what() << std::endl;
+                mapped = nullptr;
+            }
+            bool ok {mapped != nullptr};
+            if(staging) vkDestroyBuffer(dev, staging, nullptr);
+            if(staging_memory) vkFreeMemory(dev, staging_memory, nullptr);
+            return ok;
+        }
+    }
+
+    ComputeBuffer::ComputeBuffer(VkLoader& loader, VkDeviceSize size)
+        : m_Loader{loader}, m_Size{size}, m_Buffer{VK_NULL_HANDLE}, m_Memory{VK_NULL_HANDLE}
+    {
+        if(loader.GetDevice() == nullptr)
+            throw std::runtime_error("[ERROR] ComputeBuffer needs a logical device, call CreateDevice first.");
+        if(size == 0)
+            throw std::runtime_error("[ERROR] ComputeBuffer cannot be empty");
+        helpers::CreateBuffer(loader.GetDevice(), loader.GetPhysicalDevice(), size,
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_Buffer, m_Memory);
+    }
+
+    ComputeBuffer::~ComputeBuffer() {
+        vkDestroyBuffer(m_Loader.GetDevice(), m_Buffer, nullptr);
+        vkFreeMemory(m_Loader.GetDevice(), m_Memory, nullptr);
+    }
+
+    bool ComputeBuffer::Write(const void *data, VkDeviceSize size, VkDeviceSize offset) {
+        if(size == 0 || offset + size > m_Size) {
+            std::clog << "[ERROR] ComputeBuffer write out of range" << std::endl;
+            return false;
+        }
+        return StagedCopy(m_Loader, m_Buffer, offset, size, const_cast<void *>(data), true);
+    }
+
+    bool ComputeBuffer::Read(void *data, VkDeviceSize size, VkDeviceSize offset) const {
+        if(size == 0 || offset + size > m_Size) {
+            std::clog << "[ERROR] ComputeBuffer read out of range" << std::endl;
+            return false;
+        }
+        return StagedCopy(m_Loader, m_Buffer, offset, size, data, false);
+    }
+
+    ComputeKernel::ComputeKernel(VkLoader& loader, const uint32_t *code, size_t size, uint32_t buffer_count,
+                                 uint32_t push_constant_size)
+        : m_Device{loader.GetDevice()}, m_BufferCount{buffer_count}, m_PushConstantSize{push_constant_size},
+          m_SetLayout{VK_NULL_HANDLE}, m_PipelineLayout{VK_NULL_HANDLE}, m_Pipeline{VK_NULL_HANDLE}
+    {
+        if(m_Device == nullptr)
+            throw std::runtime_error("[ERROR] ComputeKernel needs a logical device, call CreateDevice first.");
+        if(buffer_count == 0)
+            throw std::runtime_error("[ERROR] ComputeKernel needs at least one buffer binding");
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(loader.GetPhysicalDevice(), &props);
+        if(push_constant_size % 4 != 0 || push_constant_size > props.limits.maxPushConstantsSize)
+            throw std::runtime_error("[ERROR] ComputeKernel push constants must be a multiple of 4 bytes and fit the device limit");
+
+        try {
+            std::vector<VkDescriptorSetLayoutBinding> bindings(buffer_count);
+            for(uint32_t i = 0; i < buffer_count; i++)
+                bindings[i] = {i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr};
+            VkDescriptorSetLayoutCreateInfo layout_info {
+                VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                nullptr,
+                0,
+                buffer_count,
+                bindings.data()
+            };
+            if(vkCreateDescriptorSetLayout(m_Device, &layout_info, nullptr, &m_SetLayout) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Compute kernel descriptor set layout creation failed");
+
+            VkPushConstantRange push_range {VK_SHADER_STAGE_COMPUTE_BIT, 0, push_constant_size};
+            VkPipelineLayoutCreateInfo pipeline_layout_info {
+                VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                nullptr,
+                0,
+                1,
+                &m_SetLayout,
+                push_constant_size ? 1u : 0u,
+                push_constant_size ? &push_range : nullptr
+            };
+            if(vkCreatePipelineLayout(m_Device, &pipeline_layout_info, nullptr, &m_PipelineLayout) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Compute kernel pipeline layout creation failed");
+
+            VkShaderModule module {helpers::CreateShaderModule(m_Device, code, size)};
+            VkComputePipelineCreateInfo pipeline_info {
+                VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                nullptr,
+                0,
+                {
+                    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                    nullptr,
+                    0,
+                    VK_SHADER_STAGE_COMPUTE_BIT,
+                    module,
+                    "main",
+                    nullptr
+                },
+                m_PipelineLayout,
+                VK_NULL_HANDLE,
+                -1
+            };
+            VkResult result {vkCreateComputePipelines(m_Device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &m_Pipeline)};
+            vkDestroyShaderModule(m_Device, module, nullptr);
+            if(result != VK_SUCCESS) {
+                m_Pipeline = VK_NULL_HANDLE;
+                throw std::runtime_error("[ERROR] Compute kernel pipeline creation failed");
+            }
+        } catch(std::runtime_error&) {
+            Destroy();
+            throw;
+        }
+    }
+
+    ComputeKernel::~ComputeKernel() {
+        Destroy();
+    }
+
+    void ComputeKernel::Destroy() {
+        if(m_Pipeline) vkDestroyPipeline(m_Device, m_Pipeline, nullptr);
+        if(m_PipelineLayout) vkDestroyPipelineLayout(m_Device, m_PipelineLayout, nullptr);
+        for(VkDescriptorPool pool : m_DescPools) vkDestroyDescriptorPool(m_Device, pool, nullptr);
+        if(m_SetLayout) vkDestroyDescriptorSetLayout(m_Device, m_SetLayout, nullptr);
+        m_Pipeline = VK_NULL_HANDLE;
+        m_PipelineLayout = VK_NULL_HANDLE;
+        m_DescPools.clear();
+        m_SetLayout = VK_NULL_HANDLE;
+    }
+
+    bool ComputeKernel::AddPool() {
+        VkDescriptorPoolSize pool_size {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, sets_per_pool * m_BufferCount};
+        VkDescriptorPoolCreateInfo pool_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            nullptr,
+            0,
+            sets_per_pool,
+            1,
+            &pool_size
+        };
+        VkDescriptorPool pool;
+        if(vkCreateDescriptorPool(m_Device, &pool_info, nullptr, &pool) != VK_SUCCESS) {
+            std::clog << "[ERROR] Compute kernel descriptor pool creation failed" << std::endl;
+            return false;
+        }
+        m_DescPools.push_back(pool);
+        return true;
+    }
+
+    VkDescriptorSet ComputeKernel::Bind(const std::vector<VkBuffer>& buffers) {
+        if(buffers.size() != m_BufferCount) {
+            std::clog << "[ERROR] Compute kernel expects " << m_BufferCount << " buffers, got " << buffers.size()
+                      << std::endl;
+            return VK_NULL_HANDLE;
+        }
+
+        VkDescriptorSet set {VK_NULL_HANDLE};
+        VkDescriptorSetAllocateInfo set_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            nullptr,
+            VK_NULL_HANDLE,
+            1,
+            &m_SetLayout
+        };
+        // every set has the same layout, so only a full pool ever fails an allocation.
+        if(!m_DescPools.empty()) {
+            set_info.descriptorPool = m_DescPools.back();
+            if(vkAllocateDescriptorSets(m_Device, &set_info, &set) != VK_SUCCESS) set = VK_NULL_HANDLE;
+        }
+        if(set == VK_NULL_HANDLE) {
+            if(!AddPool()) return VK_NULL_HANDLE;
+            set_info.descriptorPool = m_DescPools.back();
+            if(vkAllocateDescriptorSets(m_Device, &set_info, &set) != VK_SUCCESS) {
+                std::clog << "[ERROR] Allocating a compute kernel descriptor set failed" << std::endl;
+                return VK_NULL_HANDLE;
+            }
+        }
+
+        std::vector<VkDescriptorBufferInfo> buffer_infos(m_BufferCount);
+        std::vector<VkWriteDescriptorSet> writes(m_BufferCount);
+        for(uint32_t i = 0; i < m_BufferCount; i++) {
+            buffer_infos[i] = {buffers[i], 0, VK_WHOLE_SIZE};
+            writes[i] = {
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                nullptr,
+                set,
+                i,
+                0,
+                1,
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                nullptr,
+                &buffer_infos[i],
+                nullptr
+            };
+        }
+        vkUpdateDescriptorSets(m_Device, m_BufferCount, writes.data(), 0, nullptr);
+        return set;
+    }
+
+    void ComputeKernel::Dispatch(VkCommandBuffer cmd, VkDescriptorSet set, const void *push_constants,
+                                 uint32_t groups_x, uint32_t groups_y, uint32_t groups_z) const {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, 1, &set, 0, nullptr);
+        if(m_PushConstantSize)
+            vkCmdPushConstants(cmd, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, m_PushConstantSize, push_constants);
+        vkCmdDispatch(cmd, groups_x, groups_y, groups_z);
+    }
+
+    void ComputeKernel::Barrier(VkCommandBuffer cmd) {
+        VkMemoryBarrier barrier {
+            VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+}
@@ -0,0 +1,129 @@
+/*
+    deletion.cpp: Implementation of the deferred destruction queue from deletion.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/deletion.hpp"
+
+#include <iostream>
+#include <vector>
+
+namespace vkli {
+    namespace {
+        template<typename T>
+        T As(uint64_t handle) { return reinterpret_cast<T>(handle); }
+    }
+
+    void DeletionQueue::RequireFeatures(DeviceFeatures& features) {
+        features.v12.timelineSemaphore = VK_TRUE;
+    }
+
+    DeletionQueue::DeletionQueue(VkDevice device, bool timeline_semaphores)
+        : m_Device{device}, m_TimelineSemaphores{timeline_semaphores} {}
+
+    DeletionQueue::~DeletionQueue() {
+        Drain();
+    }
+
+    void DeletionQueue::Push(VkObjectType type, uint64_t handle, RetirePoint retire) {
+        if(handle == 0) return;
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        m_Queues[retire.timeline].push_back({retire.value, handle, type});
+    }
+
+    size_t DeletionQueue::Collect(uint64_t completed_frame) {
+        return CollectQueue(VK_NULL_HANDLE, completed_frame);
+    }
+
+    size_t DeletionQueue::Collect(VkSemaphore timeline) {
+        if(!m_TimelineSemaphores) {
+            std::clog << "[ERROR] Collecting on a timeline semaphore needs the timelineSemaphore feature" << std::endl;
+            return 0;
+        }
+        uint64_t value;
+        if(vkGetSemaphoreCounterValue(m_Device, timeline, &value) != VK_SUCCESS) {
+            std::clog << "[ERROR] Reading the timeline semaphore value failed" << std::endl;
+            return 0;
+        }
+        return CollectQueue(timeline, value);
+    }
+
+    size_t DeletionQueue::Drain() {
+        std::unique_lock<std::mutex> lock {m_Mutex};
+        std::map<VkSemaphore, std::deque<Entry>> queues;
+        queues.swap(m_Queues);
+        lock.unlock();
+        size_t n {0};
+        for(const auto& [timeline, entries] : queues) {
+            for(const Entry& entry : entries) DestroyEntry(entry);
+            n += entries.size();
+        }
+        return n;
+    }
+
+    size_t DeletionQueue::Pending() const {
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        size_t n {0};
+        for(const auto& [timeline, entries] : m_Queues) n += entries.size();
+        return n;
+    }
+
+    size_t DeletionQueue::CollectQueue(VkSemaphore timeline, uint64_t value) {
+        std::unique_lock<std::mutex> lock {m_Mutex};
+        auto it {m_Queues.find(timeline)};
+        if(it == m_Queues.end()) return 0;
+        std::deque<Entry>& entries {it->second};
+        size_t n {0};
+        while(n < entries.size() && entries[n].value <= value) n++;
+        if(n == 0) return 0;
+        std::vector<Entry> batch(entries.begin(), entries.begin() + n);
+        entries.erase(entries.begin(), entries.begin() + n);
+        // semaphores come and go, their queues go with them once empty.
+        if(entries.empty()) m_Queues.erase(it);
+        lock.unlock();
+        for(const Entry& entry : batch) DestroyEntry(entry);
+        return n;
+    }
+
+    void DeletionQueue::DestroyEntry(const Entry& entry) const {
+        switch(entry.type) {
+            case VK_OBJECT_TYPE_BUFFER: vkDestroyBuffer(m_Device, As<VkBuffer>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_BUFFER_VIEW: vkDestroyBufferView(m_Device, As<VkBufferView>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_IMAGE: vkDestroyImage(m_Device, As<VkImage>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_IMAGE_VIEW: vkDestroyImageView(m_Device, As<VkImageView>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_DEVICE_MEMORY: vkFreeMemory(m_Device, As<VkDeviceMemory>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_SAMPLER: vkDestroySampler(m_Device, As<VkSampler>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_SHADER_MODULE: vkDestroyShaderModule(m_Device, As<VkShaderModule>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_PIPELINE: vkDestroyPipeline(m_Device, As<VkPipeline>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+                vkDestroyPipelineLayout(m_Device, As<VkPipelineLayout>(entry.handle), nullptr);
+                break;
+            case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+                vkDestroyDescriptorSetLayout(m_Device, As<VkDescriptorSetLayout>(entry.handle), nullptr);
+                break;
+            case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+                vkDestroyDescriptorPool(m_Device, As<VkDescriptorPool>(entry.handle), nullptr);
+                break;
+            case VK_OBJECT_TYPE_RENDER_PASS: vkDestroyRenderPass(m_Device, As<VkRenderPass>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_FRAMEBUFFER: vkDestroyFramebuffer(m_Device, As<VkFramebuffer>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_COMMAND_POOL: vkDestroyCommandPool(m_Device, As<VkCommandPool>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_QUERY_POOL: vkDestroyQueryPool(m_Device, As<VkQueryPool>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_FENCE: vkDestroyFence(m_Device, As<VkFence>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_SEMAPHORE: vkDestroySemaphore(m_Device, As<VkSemaphore>(entry.handle), nullptr); break;
+            case VK_OBJECT_TYPE_EVENT: vkDestroyEvent(m_Device, As<VkEvent>(entry.handle), nullptr); break;
+            default:
+                std::clog << "[ERROR] Deletion queue cannot destroy objects of type " << entry.type << std::endl;
+        }
+    }
+}
@@ -0,0 +1,739 @@
+/*
+    gpudriven.cpp: Implementation of the GPU driven culling classes from gpudriven.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/gpudriven.hpp"
+#include "vkli-internal.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+// SPIR-V generated at build time by vkli_add_shaders
+#include "cull.comp.h"
+#include "depth-reduce.comp.h"
+
+namespace vkli {
+    namespace {
+        // creates a device local buffer holding a copy of data, blocking until the copy is done.
+        void UploadToDevice(VkLoader& loader, const void *data, VkDeviceSize size, VkBufferUsageFlags usage,
+                            VkBuffer& buffer, VkDeviceMemory& memory) {
+            VkDevice dev {loader.GetDevice()};
+            VkBuffer staging;
+            VkDeviceMemory staging_memory;
+            helpers::CreateBuffer(dev, loader.GetPhysicalDevice(), size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                  staging, staging_memory);
+            try {
+                void *mapped;
+                if(vkMapMemory(dev, staging_memory, 0, size, 0, &mapped) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Mapping a staging buffer failed");
+                std::memcpy(mapped, data, size);
+                vkUnmapMemory(dev, staging_memory);
+
+                helpers::CreateBuffer(dev, loader.GetPhysicalDevice(), size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+                try {
+                    helpers::ImmediateSubmit(dev, loader.GetQueue(), loader.GetQueueFamily(), [&](VkCommandBuffer cmd) {
+                        VkBufferCopy region {0, 0, size};
+                        vkCmdCopyBuffer(cmd, staging, buffer, 1, &region);
+                    });
+                } catch(std::runtime_error&) {
+                    vkDestroyBuffer(dev, buffer, nullptr);
+                    vkFreeMemory(dev, memory, nullptr);
+                    buffer = VK_NULL_HANDLE;
+                    memory = VK_NULL_HANDLE;
+                    throw;
+                }
+            } catch(std::runtime_error&) {
+                vkDestroyBuffer(dev, staging, nullptr);
+                vkFreeMemory(dev, staging_memory, nullptr);
+                throw;
+            }
+            vkDestroyBuffer(dev, staging, nullptr);
+            vkFreeMemory(dev, staging_memory, nullptr);
+        }
+
+        VkPipeline CreateComputePipeline(VkDevice dev, VkPipelineLayout layout, const uint32_t *code, size_t size) {
+            VkShaderModule module {helpers::CreateShaderModule(dev, code, size)};
+            VkComputePipelineCreateInfo pipeline_info {
+                VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                nullptr,
+                0,
+                {
+                    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                    nullptr,
+                    0,
+                    VK_SHADER_STAGE_COMPUTE_BIT,
+                    module,
+                    "main",
+                    nullptr
+                },
+                layout,
+                VK_NULL_HANDLE,
+                -1
+            };
+            VkPipeline pipeline;
+            VkResult result {vkCreateComputePipelines(dev, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline)};
+            vkDestroyShaderModule(dev, module, nullptr);
+            if(result != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Compute pipeline creation failed");
+            return pipeline;
+        }
+
+        // column major, out = a * b
+        void MultiplyMatrices(const float a[16], const float b[16], float out[16]) {
+            for(int c = 0; c < 4; c++)
+                for(int r = 0; r < 4; r++) {
+                    float sum {0.0f};
+                    for(int k = 0; k < 4; k++) sum += a[k * 4 + r] * b[c * 4 + k];
+                    out[c * 4 + r] = sum;
+                }
+        }
+
+        // Gribb and Hartmann, for Vulkan's 0 <= z <= w clip volume. The planes point inwards.
+        void ExtractPlanes(const float m[16], float planes[6][4]) {
+            const auto row = [m](int r, int c) { return m[c * 4 + r]; };
+            for(int c = 0; c < 4; c++) {
+                planes[0][c] = row(3, c) + row(0, c); // left
+                planes[1][c] = row(3, c) - row(0, c); // right
+                planes[2][c] = row(3, c) + row(1, c); // top
+                planes[3][c] = row(3, c) - row(1, c); // bottom
+                planes[4][c] = row(2, c);             // near
+                planes[5][c] = row(3, c) - row(2, c); // far
+            }
+            for(int p = 0; p < 6; p++) {
+                float length {std::sqrt(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] +
+                                        planes[p][2] * planes[p][2])};
+                for(int c = 0; c < 4; c++) planes[p][c] /= length;
+            }
+        }
+
+        void BufferBarrier(VkCommandBuffer cmd, VkPipelineStageFlags src_stage, VkAccessFlags src_access,
+                           VkPipelineStageFlags dst_stage, VkAccessFlags dst_access) {
+            VkMemoryBarrier barrier {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, src_access, dst_access};
+            vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        }
+    }
+
+    GeometryPool::GeometryPool(VkLoader& loader)
+        : m_Loader{loader}, m_VertexBuffer{VK_NULL_HANDLE}, m_IndexBuffer{VK_NULL_HANDLE}, m_MeshBuffer{VK_NULL_HANDLE},
+          m_VertexMemory{VK_NULL_HANDLE}, m_IndexMemory{VK_NULL_HANDLE}, m_MeshMemory{VK_NULL_HANDLE}
+    {
+    }
+
+    GeometryPool::~GeometryPool() {
+        VkDevice dev {m_Loader.GetDevice()};
+        if(m_VertexBuffer) vkDestroyBuffer(dev, m_VertexBuffer, nullptr);
+        if(m_IndexBuffer) vkDestroyBuffer(dev, m_IndexBuffer, nullptr);
+        if(m_MeshBuffer) vkDestroyBuffer(dev, m_MeshBuffer, nullptr);
+        if(m_VertexMemory) vkFreeMemory(dev, m_VertexMemory, nullptr);
+        if(m_IndexMemory) vkFreeMemory(dev, m_IndexMemory, nullptr);
+        if(m_MeshMemory) vkFreeMemory(dev, m_MeshMemory, nullptr);
+    }
+
+    uint32_t GeometryPool::AddMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+        if(m_MeshBuffer) {
+            std::clog << "[ERROR] Meshes cannot be added to a geometry pool after Upload" << std::endl;
+            return UINT32_MAX;
+        }
+        if(indices.empty()) {
+            std::clog << "[ERROR] Cannot add a mesh without indices to a geometry pool" << std::endl;
+            return UINT32_MAX;
+        }
+
+        MeshInfo mesh {};
+        mesh.index_count = static_cast<uint32_t>(indices.size());
+        mesh.first_index = static_cast<uint32_t>(m_Indices.size());
+        mesh.vertex_offset = static_cast<int32_t>(m_Vertices.size());
+
+        // renumber the vertices in the order they are first used, unused ones are dropped.
+        std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+        for(uint32_t index : indices) {
+            if(index >= vertices.size()) {
+                std::clog << "[ERROR] Mesh index " << index << " is out of range" << std::endl;
+                m_Indices.resize(mesh.first_index);
+                m_Vertices.resize(mesh.vertex_offset);
+                return UINT32_MAX;
+            }
+            if(remap[index] == UINT32_MAX) {
+                remap[index] = static_cast<uint32_t>(m_Vertices.size()) - mesh.vertex_offset;
+                m_Vertices.push_back(vertices[index]);
+            }
+            m_Indices.push_back(remap[index]);
+        }
+
+        // the sphere around the centre of the bounding box is not minimal, but close enough for culling.
+        float lo[3], hi[3];
+        const Vertex& first {m_Vertices[mesh.vertex_offset]};
+        std::copy(first.position, first.position + 3, lo);
+        std::copy(first.position, first.position + 3, hi);
+        for(size_t i = mesh.vertex_offset; i < m_Vertices.size(); i++)
+            for(int c = 0; c < 3; c++) {
+                lo[c] = std::min(lo[c], m_Vertices[i].position[c]);
+                hi[c] = std::max(hi[c], m_Vertices[i].position[c]);
+            }
+        float radius_sq {0.0f};
+        for(int c = 0; c < 3; c++) mesh.sphere[c] = (lo[c] + hi[c]) * 0.5f;
+        for(size_t i = mesh.vertex_offset; i < m_Vertices.size(); i++) {
+            float d_sq {0.0f};
+            for(int c = 0; c < 3; c++) {
+                float d {m_Vertices[i].position[c] - mesh.sphere[c]};
+                d_sq += d * d;
+            }
+            radius_sq = std::max(radius_sq, d_sq);
+        }
+        mesh.sphere[3] = std::sqrt(radius_sq);
+
+        m_Meshes.push_back(mesh);
+        return static_cast<uint32_t>(m_Meshes.size() - 1);
+    }
+
+    bool GeometryPool::Upload() {
+        if(m_MeshBuffer) return true;
+        if(m_Meshes.empty()) {
+            std::clog << "[ERROR] Uploading an empty geometry pool" << std::endl;
+            return false;
+        }
+
+        try {
+            UploadToDevice(m_Loader, m_Vertices.data(), m_Vertices.size() * sizeof(Vertex),
+                           VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, m_VertexBuffer, m_VertexMemory);
+            UploadToDevice(m_Loader, m_Indices.data(), m_Indices.size() * sizeof(uint32_t),
+                           VK_BUFFER_USAGE_INDEX_BUFFER_BIT, m_IndexBuffer, m_IndexMemory);
+            UploadToDevice(m_Loader, m_Meshes.data(), m_Meshes.size() * sizeof(MeshInfo),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_MeshBuffer, m_MeshMemory);
+        } catch(std::runtime_error& e) {
+            std::clog << e.what() << std::endl;
+            VkDevice dev {m_Loader.GetDevice()};
+            if(m_VertexBuffer) vkDestroyBuffer(dev, m_VertexBuffer, nullptr);
+            if(m_IndexBuffer) vkDestroyBuffer(dev, m_IndexBuffer, nullptr);
+            if(m_VertexMemory) vkFreeMemory(dev, m_VertexMemory, nullptr);
+            if(m_IndexMemory) vkFreeMemory(dev, m_IndexMemory, nullptr);
+            m_VertexBuffer = m_IndexBuffer = VK_NULL_HANDLE;
+            m_VertexMemory = m_IndexMemory = VK_NULL_HANDLE;
+            return false;
+        }
+
+        std::clog << "[INFO] Geometry pool uploaded, " << m_Meshes.size() << " meshes, " << m_Vertices.size()
+                  << " vertices, " << m_Indices.size() << " indices" << std::endl;
+        m_Vertices = {};
+        m_Indices = {};
+        return true;
+    }
+
+    void GeometryPool::Bind(VkCommandBuffer cmd) const {
+        VkDeviceSize offset {0};
+        vkCmdBindVertexBuffers(cmd, 0, 1, &m_VertexBuffer, &offset);
+        vkCmdBindIndexBuffer(cmd, m_IndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    }
+
+    DepthPyramid::DepthPyramid(VkLoader& loader, VkImage depth, VkImageView depth_view, VkExtent2D extent,
+                               VkImageLayout depth_layout)
+        : m_Device{loader.GetDevice()}, m_Depth{depth}, m_DepthLayout{depth_layout}, m_DepthExtent{extent},
+          m_Extent{std::max(1u, extent.width / 2), std::max(1u, extent.height / 2)},
+          m_Image{VK_NULL_HANDLE}, m_Memory{VK_NULL_HANDLE}, m_View{VK_NULL_HANDLE}, m_Sampler{VK_NULL_HANDLE},
+          m_SetLayout{VK_NULL_HANDLE}, m_DescPool{VK_NULL_HANDLE}, m_PipelineLayout{VK_NULL_HANDLE},
+          m_Pipeline{VK_NULL_HANDLE}
+    {
+        if(m_Device == nullptr)
+            throw std::runtime_error("[ERROR] DepthPyramid needs a logical device, call CreateDevice first.");
+
+        uint32_t levels {1};
+        while((std::max(m_Extent.width, m_Extent.height) >> levels) > 0) levels++;
+
+        try {
+            VkImageCreateInfo image_info {
+                VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                nullptr,
+                0,
+                VK_IMAGE_TYPE_2D,
+                VK_FORMAT_R32_SFLOAT,
+                {m_Extent.width, m_Extent.height, 1},
+                levels,
+                1,
+                VK_SAMPLE_COUNT_1_BIT,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                VK_SHARING_MODE_EXCLUSIVE,
+                0,
+                nullptr,
+                VK_IMAGE_LAYOUT_UNDEFINED
+            };
+            if(vkCreateImage(m_Device, &image_info, nullptr, &m_Image) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Depth pyramid image creation failed");
+
+            VkMemoryRequirements reqs;
+            vkGetImageMemoryRequirements(m_Device, m_Image, &reqs);
+            VkMemoryAllocateInfo alloc_info {
+                VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                nullptr,
+                reqs.size,
+                helpers::FindMemoryType(loader.GetPhysicalDevice(), reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+            };
+            if(vkAllocateMemory(m_Device, &alloc_info, nullptr, &m_Memory) != VK_SUCCESS ||
+               vkBindImageMemory(m_Device, m_Image, m_Memory, 0) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Depth pyramid memory allocation failed");
+
+            VkImageViewCreateInfo view_info {
+                VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                nullptr,
+                0,
+                m_Image,
+                VK_IMAGE_VIEW_TYPE_2D,
+                VK_FORMAT_R32_SFLOAT,
+                {},
+                {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1}
+            };
+            if(vkCreateImageView(m_Device, &view_info, nullptr, &m_View) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Depth pyramid view creation failed");
+            for(uint32_t i = 0; i < levels; i++) {
+                view_info.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1};
+                VkImageView level_view;
+                if(vkCreateImageView(m_Device, &view_info, nullptr, &level_view) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Depth pyramid view creation failed");
+                m_LevelViews.push_back(level_view);
+            }
+
+            // only read with texelFetch, the filter does not matter.
+            VkSamplerCreateInfo sampler_info {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+            sampler_info.magFilter = VK_FILTER_NEAREST;
+            sampler_info.minFilter = VK_FILTER_NEAREST;
+            sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+            sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+            sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+            if(vkCreateSampler(m_Device, &sampler_info, nullptr, &m_Sampler) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Depth pyramid sampler creation failed");
+
+            const std::array<VkDescriptorSetLayoutBinding, 2> bindings {{
+                {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+                {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr}
+            }};
+            VkDescriptorSetLayoutCreateInfo layout_info {
+                VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                nullptr,
+                0,
+                static_cast<uint32_t>(bindings.size()),
+                bindings.data()
+            };
+            if(vkCreateDescriptorSetLayout(m_Device, &layout_info, nullptr, &m_SetLayout) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Depth pyramid descriptor set layout creation failed");
+
+            const std::array<VkDescriptorPoolSize, 2> pool_sizes {{
+                {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, levels},
+                {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levels}
+            }};
+            VkDescriptorPoolCreateInfo pool_info {
+                VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                nullptr,
+                0,
+                levels,
+                static_cast<uint32_t>(pool_sizes.size()),
+                pool_sizes.data()
+            };
+            if(vkCreateDescriptorPool(m_Device, &pool_info, nullptr, &m_DescPool) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Depth pyramid descriptor pool creation failed");
+
+            std::vector<VkDescriptorSetLayout> set_layouts(levels, m_SetLayout);
+            m_Sets.resize(levels);
+            VkDescriptorSetAllocateInfo set_info {
+                VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                nullptr,
+                m_DescPool,
+                levels,
+                set_layouts.data()
+            };
+            if(vkAllocateDescriptorSets(m_Device, &set_info, m_Sets.data()) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Allocating the depth pyramid descriptor sets failed");
+
+            // level i reads the depth buffer or level i - 1, and writes level i.
+            std::vector<VkDescriptorImageInfo> image_infos(2 * levels);
+            std::vector<VkWriteDescriptorSet> writes(2 * levels);
+            for(uint32_t i = 0; i < levels; i++) {
+                image_infos[2 * i] = {m_Sampler, i == 0 ? depth_view : m_LevelViews[i - 1],
+                                      i == 0 ? depth_layout : VK_IMAGE_LAYOUT_GENERAL};
+                image_infos[2 * i + 1] = {VK_NULL_HANDLE, m_LevelViews[i], VK_IMAGE_LAYOUT_GENERAL};
+                for(uint32_t b = 0; b < 2; b++)
+                    writes[2 * i + b] = {
+                        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                        nullptr,
+                        m_Sets[i],
+                        b,
+                        0,
+                        1,
+                        bindings[b].descriptorType,
+                        &image_infos[2 * i + b],
+                        nullptr,
+                        nullptr
+                    };
+            }
+            vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+            VkPushConstantRange push_range {VK_SHADER_STAGE_COMPUTE_BIT, 0, 4 * sizeof(int32_t)};
+            VkPipelineLayoutCreateInfo pipeline_layout_info {
+                VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                nullptr,
+                0,
+                1,
+                &m_SetLayout,
+                1,
+                &push_range
+            };
+            if(vkCreatePipelineLayout(m_Device, &pipeline_layout_info, nullptr, &m_PipelineLayout) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Depth pyramid pipeline layout creation failed");
+            m_Pipeline = CreateComputePipeline(m_Device, m_PipelineLayout, depth_reduce_comp, sizeof(depth_reduce_comp));
+
+            // clear to the far plane so nothing is occluded before the first Build.
+            helpers::ImmediateSubmit(m_Device, loader.GetQueue(), loader.GetQueueFamily(), [&](VkCommandBuffer cmd) {
+                VkImageMemoryBarrier barrier {
+                    VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                    nullptr,
+                    0,
+                    VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_IMAGE_LAYOUT_GENERAL,
+                    VK_QUEUE_FAMILY_IGNORED,
+                    VK_QUEUE_FAMILY_IGNORED,
+                    m_Image,
+                    {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1}
+                };
+                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                     0, nullptr, 0, nullptr, 1, &barrier);
+                VkClearColorValue far {{1.0f, 1.0f, 1.0f, 1.0f}};
+                vkCmdClearColorImage(cmd, m_Image, VK_IMAGE_LAYOUT_GENERAL, &far, 1, &barrier.subresourceRange);
+                BufferBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+            });
+        } catch(std::runtime_error&) {
+            Destroy();
+            throw;
+        }
+
+        std::clog << "[INFO] Depth pyramid created, " << m_Extent.width << "x" << m_Extent.height << " with "
+                  << levels << " levels" << std::endl;
+    }
+
+    DepthPyramid::~DepthPyramid() {
+        Destroy();
+    }
+
+    void DepthPyramid::Destroy() {
+        if(m_Pipeline) vkDestroyPipeline(m_Device, m_Pipeline, nullptr);
+        if(m_PipelineLayout) vkDestroyPipelineLayout(m_Device, m_PipelineLayout, nullptr);
+        // the sets are freed with the pool.
+        if(m_DescPool) vkDestroyDescriptorPool(m_Device, m_DescPool, nullptr);
+        if(m_SetLayout) vkDestroyDescriptorSetLayout(m_Device, m_SetLayout, nullptr);
+        if(m_Sampler) vkDestroySampler(m_Device, m_Sampler, nullptr);
+        for(VkImageView view : m_LevelViews) vkDestroyImageView(m_Device, view, nullptr);
+        if(m_View) vkDestroyImageView(m_Device, m_View, nullptr);
+        if(m_Image) vkDestroyImage(m_Device, m_Image, nullptr);
+        if(m_Memory) vkFreeMemory(m_Device, m_Memory, nullptr);
+        m_Pipeline = VK_NULL_HANDLE;
+        m_PipelineLayout = VK_NULL_HANDLE;
+        m_DescPool = VK_NULL_HANDLE;
+        m_SetLayout = VK_NULL_HANDLE;
+        m_Sampler = VK_NULL_HANDLE;
+        m_LevelViews.clear();
+        m_View = VK_NULL_HANDLE;
+        m_Image = VK_NULL_HANDLE;
+        m_Memory = VK_NULL_HANDLE;
+    }
+
+    void DepthPyramid::Build(VkCommandBuffer cmd) const {
+        const uint32_t levels {Levels()};
+
+        // the depth writes must be done, and the previous frame's culling must be done reading.
+        std::array<VkImageMemoryBarrier, 2> barriers {{
+            {
+                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                nullptr,
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                VK_ACCESS_SHADER_READ_BIT,
+                VK_IMAGE_LAYOUT_UNDEFINED, // replaced below
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                m_Depth,
+                {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1}
+            },
+            {
+                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                nullptr,
+                0,
+                VK_ACCESS_SHADER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_GENERAL,
+                VK_IMAGE_LAYOUT_GENERAL,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                m_Image,
+                {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1}
+            }
+        }};
+        // the depth image stays in the layout it was given in, only the access changes.
+        barriers[0].oldLayout = m_DepthLayout;
+        barriers[0].newLayout = m_DepthLayout;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+        VkExtent2D src {m_DepthExtent};
+        for(uint32_t i = 0; i < levels; i++) {
+            VkExtent2D dst {std::max(1u, m_Extent.width >> i), std::max(1u, m_Extent.height >> i)};
+            const int32_t sizes[4] {int32_t(src.width), int32_t(src.height), int32_t(dst.width), int32_t(dst.height)};
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, 1, &m_Sets[i], 0, nullptr);
+            vkCmdPushConstants(cmd, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), sizes);
+            vkCmdDispatch(cmd, (dst.width + 7) / 8, (dst.height + 7) / 8, 1);
+
+            VkImageMemoryBarrier level_barrier {barriers[1]};
+            level_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            level_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            level_barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1};
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &level_barrier);
+            src = dst;
+        }
+    }
+
+    void CullingPass::RequireFeatures(DeviceFeatures& features) {
+        features.core.multiDrawIndirect = VK_TRUE;
+        features.core.drawIndirectFirstInstance = VK_TRUE;
+        features.v12.drawIndirectCount = VK_TRUE;
+    }
+
+    CullingPass::CullingPass(VkLoader& loader, const GeometryPool& pool, const std::vector<Instance>& instances,
+                             const DepthPyramid& pyramid)
+        : m_Device{loader.GetDevice()}, m_Pool{pool}, m_Pyramid{pyramid},
+          m_InstanceCount{static_cast<uint32_t>(instances.size())},
+          m_InstanceBuffer{VK_NULL_HANDLE}, m_DrawBuffer{VK_NULL_HANDLE}, m_CountBuffer{VK_NULL_HANDLE},
+          m_UniformBuffer{VK_NULL_HANDLE}, m_ReadbackBuffer{VK_NULL_HANDLE},
+          m_InstanceMemory{VK_NULL_HANDLE}, m_DrawMemory{VK_NULL_HANDLE}, m_CountMemory{VK_NULL_HANDLE},
+          m_UniformMemory{VK_NULL_HANDLE}, m_ReadbackMemory{VK_NULL_HANDLE}, m_Readback{nullptr},
+          m_SetLayout{VK_NULL_HANDLE}, m_DescPool{VK_NULL_HANDLE}, m_Set{VK_NULL_HANDLE},
+          m_PipelineLayout{VK_NULL_HANDLE}, m_Pipeline{VK_NULL_HANDLE}
+    {
+        static_assert(sizeof(CullUniforms) == 208, "CullUniforms must match the std140 layout in cull.comp");
+        static_assert(sizeof(Instance) == 80 && sizeof(MeshInfo) == 32, "shader structures changed size");
+
+        if(m_Device == nullptr)
+            throw std::runtime_error("[ERROR] CullingPass needs a logical device, call CreateDevice first.");
+        if(pool.GetMeshBuffer() == VK_NULL_HANDLE)
+            throw std::runtime_error("[ERROR] CullingPass needs an uploaded geometry pool");
+        if(instances.empty())
+            throw std::runtime_error("[ERROR] CullingPass needs at least one instance");
+        for(const Instance& instance : instances)
+            if(instance.mesh >= pool.Meshes().size())
+                throw std::runtime_error("[ERROR] CullingPass instance refers to a mesh that is not in the pool");
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(loader.GetPhysicalDevice(), &props);
+        if(m_InstanceCount > props.limits.maxDrawIndirectCount)
+            throw std::runtime_error("[ERROR] CullingPass has more instances than maxDrawIndirectCount");
+
+        try {
+            VkPhysicalDevice pdev {loader.GetPhysicalDevice()};
+            UploadToDevice(loader, instances.data(), instances.size() * sizeof(Instance),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_InstanceBuffer, m_InstanceMemory);
+            helpers::CreateBuffer(m_Device, pdev, m_InstanceCount * sizeof(VkDrawIndexedIndirectCommand),
+                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_DrawBuffer, m_DrawMemory);
+            helpers::CreateBuffer(m_Device, pdev, sizeof(uint32_t),
+                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_CountBuffer, m_CountMemory);
+            helpers::CreateBuffer(m_Device, pdev, sizeof(CullUniforms),
+                                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_UniformBuffer, m_UniformMemory);
+            helpers::CreateBuffer(m_Device, pdev, sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                  m_ReadbackBuffer, m_ReadbackMemory);
+            void *mapped;
+            if(vkMapMemory(m_Device, m_ReadbackMemory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Mapping the culling readback buffer failed");
+            *static_cast<uint32_t *>(mapped) = 0;
+            m_Readback = static_cast<const uint32_t *>(mapped);
+
+            const std::array<VkDescriptorType, 6> types {
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,        // instances
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,        // meshes
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,        // draws
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,        // draw count
+                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, // depth pyramid
+                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER         // CullData
+            };
+            std::array<VkDescriptorSetLayoutBinding, 6> bindings;
+            for(uint32_t i = 0; i < bindings.size(); i++)
+                bindings[i] = {i, types[i], 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr};
+            VkDescriptorSetLayoutCreateInfo layout_info {
+                VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                nullptr,
+                0,
+                static_cast<uint32_t>(bindings.size()),
+                bindings.data()
+            };
+            if(vkCreateDescriptorSetLayout(m_Device, &layout_info, nullptr, &m_SetLayout) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Culling descriptor set layout creation failed");
+
+            const std::array<VkDescriptorPoolSize, 3> pool_sizes {{
+                {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+                {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+                {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}
+            }};
+            VkDescriptorPoolCreateInfo pool_info {
+                VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                nullptr,
+                0,
+                1,
+                static_cast<uint32_t>(pool_sizes.size()),
+                pool_sizes.data()
+            };
+            if(vkCreateDescriptorPool(m_Device, &pool_info, nullptr, &m_DescPool) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Culling descriptor pool creation failed");
+
+            VkDescriptorSetAllocateInfo set_info {
+                VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                nullptr,
+                m_DescPool,
+                1,
+                &m_SetLayout
+            };
+            if(vkAllocateDescriptorSets(m_Device, &set_info, &m_Set) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Allocating the culling descriptor set failed");
+
+            const std::array<VkDescriptorBufferInfo, 6> buffer_infos {{
+                {m_InstanceBuffer, 0, VK_WHOLE_SIZE},
+                {pool.GetMeshBuffer(), 0, VK_WHOLE_SIZE},
+                {m_DrawBuffer, 0, VK_WHOLE_SIZE},
+                {m_CountBuffer, 0, VK_WHOLE_SIZE},
+                {},
+                {m_UniformBuffer, 0, VK_WHOLE_SIZE}
+            }};
+            VkDescriptorImageInfo image_info {pyramid.GetSampler(), pyramid.GetView(), VK_IMAGE_LAYOUT_GENERAL};
+            std::array<VkWriteDescriptorSet, 6> writes;
+            for(uint32_t i = 0; i < writes.size(); i++)
+                writes[i] = {
+                    VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    nullptr,
+                    m_Set,
+                    i,
+                    0,
+                    1,
+                    types[i],
+                    types[i] == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ? &image_info : nullptr,
+                    types[i] == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ? nullptr : &buffer_infos[i],
+                    nullptr
+                };
+            vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+            VkPipelineLayoutCreateInfo pipeline_layout_info {
+                VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                nullptr,
+                0,
+                1,
+                &m_SetLayout,
+                0,
+                nullptr
+            };
+            if(vkCreatePipelineLayout(m_Device, &pipeline_layout_info, nullptr, &m_PipelineLayout) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Culling pipeline layout creation failed");
+            m_Pipeline = CreateComputePipeline(m_Device, m_PipelineLayout, cull_comp, sizeof(cull_comp));
+        } catch(std::runtime_error&) {
+            Destroy();
+            throw;
+        }
+
+        std::clog << "[INFO] Culling pass created for " << m_InstanceCount << " instances" << std::endl;
+    }
+
+    CullingPass::~CullingPass() {
+        Destroy();
+    }
+
+    void CullingPass::Destroy() {
+        if(m_Pipeline) vkDestroyPipeline(m_Device, m_Pipeline, nullptr);
+        if(m_PipelineLayout) vkDestroyPipelineLayout(m_Device, m_PipelineLayout, nullptr);
+        // the set is freed with the pool.
+        if(m_DescPool) vkDestroyDescriptorPool(m_Device, m_DescPool, nullptr);
+        if(m_SetLayout) vkDestroyDescriptorSetLayout(m_Device, m_SetLayout, nullptr);
+        for(VkBuffer buffer : {m_InstanceBuffer, m_DrawBuffer, m_CountBuffer, m_UniformBuffer, m_ReadbackBuffer})
+            if(buffer) vkDestroyBuffer(m_Device, buffer, nullptr);
+        // freeing mapped memory unmaps it.
+        for(VkDeviceMemory memory : {m_InstanceMemory, m_DrawMemory, m_CountMemory, m_UniformMemory, m_ReadbackMemory})
+            if(memory) vkFreeMemory(m_Device, memory, nullptr);
+        m_Pipeline = VK_NULL_HANDLE;
+        m_PipelineLayout = VK_NULL_HANDLE;
+        m_DescPool = VK_NULL_HANDLE;
+        m_SetLayout = VK_NULL_HANDLE;
+        m_InstanceBuffer = m_DrawBuffer = m_CountBuffer = m_UniformBuffer = m_ReadbackBuffer = VK_NULL_HANDLE;
+        m_InstanceMemory = m_DrawMemory = m_CountMemory = m_UniformMemory = m_ReadbackMemory = VK_NULL_HANDLE;
+        m_Readback = nullptr;
+    }
+
+    void CullingPass::Record(VkCommandBuffer cmd, const float view[16], const float proj[16], bool occlusion) {
+        CullUniforms uniforms {};
+        std::copy(view, view + 16, uniforms.view);
+        float view_proj[16];
+        MultiplyMatrices(proj, view, view_proj);
+        ExtractPlanes(view_proj, uniforms.planes);
+        uniforms.p00 = proj[0];
+        uniforms.p11 = proj[5];
+        // depth = (proj[10] * z + proj[14]) / z for clip w == z
+        uniforms.depth_a = proj[10];
+        uniforms.depth_b = proj[14];
+        uniforms.znear = -proj[14] / proj[10];
+        uniforms.instance_count = m_InstanceCount;
+        uniforms.occlusion = occlusion ? 1 : 0;
+        uniforms.pyramid_levels = m_Pyramid.Levels();
+        uniforms.depth_size[0] = float(m_Pyramid.GetExtent().width * 2);
+        uniforms.depth_size[1] = float(m_Pyramid.GetExtent().height * 2);
+
+        // the previous frame's culling and draws must be done with the buffers that are rewritten.
+        BufferBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT, 0);
+        vkCmdUpdateBuffer(cmd, m_UniformBuffer, 0, sizeof(uniforms), &uniforms);
+        vkCmdFillBuffer(cmd, m_CountBuffer, 0, sizeof(uint32_t), 0);
+        BufferBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, 1, &m_Set, 0, nullptr);
+        vkCmdDispatch(cmd, (m_InstanceCount + 63) / 64, 1, 1);
+
+        BufferBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+        VkBufferCopy region {0, 0, sizeof(uint32_t)};
+        vkCmdCopyBuffer(cmd, m_CountBuffer, m_ReadbackBuffer, 1, &region);
+        BufferBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    }
+
+    void CullingPass::Draw(VkCommandBuffer cmd) const {
+        m_Pool.Bind(cmd);
+        vkCmdDrawIndexedIndirectCount(cmd, m_DrawBuffer, 0, m_CountBuffer, 0, m_InstanceCount,
+                                      sizeof(VkDrawIndexedIndirectCommand));
+    }
+
+    uint32_t CullingPass::VisibleCount() const {
+        return *static_cast<const volatile uint32_t *>(m_Readback);
+    }
+}
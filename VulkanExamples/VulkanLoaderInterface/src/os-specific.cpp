@@ -22,6 +22,10 @@
 
 #if defined(OS_LINUX)
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #elif defined(OS_WINDOWS)
 #include <windows.h>
 #endif
@@ -53,5 +57,48 @@ namespace vkli {
             if(vkGetInstanceProcAddr == nullptr)
                 throw std::runtime_error("[ERROR] Vulkan loader found, but loading vkGetInstanceProcAddr failed.");
         };
+
+        const uint8_t *MapFile(const std::string& path, size_t& size) {
+            #if defined(OS_LINUX)
+                int fd {open(path.c_str(), O_RDONLY)};
+                if(fd < 0) return nullptr;
+                struct stat st;
+                if(fstat(fd, &st) != 0 || st.st_size == 0) {
+                    close(fd);
+                    return nullptr;
+                }
+                size = static_cast<size_t>(st.st_size);
+                void *addr {mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+                close(fd); // the mapping keeps the file open
+                return addr == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(addr);
+            #elif defined(OS_WINDOWS)
+                HANDLE file {CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                         FILE_ATTRIBUTE_NORMAL, nullptr)};
+                if(file == INVALID_HANDLE_VALUE) return nullptr;
+                LARGE_INTEGER file_size;
+                if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+                    CloseHandle(file);
+                    return nullptr;
+                }
+                size = static_cast<size_t>(file_size.QuadPart);
+                HANDLE mapping {CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)};
+                CloseHandle(file);
+                if(mapping == nullptr) return nullptr;
+                void *addr {MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)};
+                CloseHandle(mapping); // the view keeps the mapping alive
+                return static_cast<const uint8_t *>(addr);
+            #else
+                return nullptr;
+            #endif
+        }
+
+        void UnmapFile(const uint8_t *addr, size_t size) {
+            if(addr == nullptr) return;
+            #if defined(OS_LINUX)
+                munmap(const_cast<uint8_t *>(addr), size);
+            #elif defined(OS_WINDOWS)
+                UnmapViewOfFile(addr);
+            #endif
+        }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,157 @@
+/*
+    pixelconv-avx2.cpp: AVX2 kernels for pixelconv.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pixelconv-kernels.hpp"
+
+#if defined(VKLI_PIXELCONV_X86)
+#include <immintrin.h>
+
+namespace vkli {
+    namespace pixelconv {
+        namespace {
+            __m256i Select(__m256i mask, __m256i a, __m256i b) {
+                return _mm256_blendv_epi8(b, a, mask);
+            }
+
+            void ExpandRgb(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha) {
+                // 24 bytes are used of every 32 byte load, the last 8 must still be inside src.
+                const __m256i spread {_mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0)};
+                const __m256i shuffle {_mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1)};
+                const __m256i alpha_bits {_mm256_set1_epi32(static_cast<int32_t>(uint32_t{alpha} << 24))};
+                size_t i {0};
+                for(; i + 11 <= pixels; i += 8) {
+                    __m256i v {_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 3 * i))};
+                    v = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(v, spread), shuffle);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * i), _mm256_or_si256(v, alpha_bits));
+                }
+                scalar_kernels.expand_rgb(src + 3 * i, dst + 4 * i, pixels - i, alpha);
+            }
+
+            void Swizzle(const uint8_t *src, uint8_t *dst, size_t pixels) {
+                const __m256i shuffle {_mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                                        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)};
+                size_t i {0};
+                for(; i + 8 <= pixels; i += 8) {
+                    __m256i v {_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * i))};
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * i), _mm256_shuffle_epi8(v, shuffle));
+                }
+                scalar_kernels.swizzle(src + 4 * i, dst + 4 * i, pixels - i);
+            }
+
+            void SrgbToLinear(const uint8_t *src, float *dst, size_t pixels) {
+                const float *table {SrgbToLinearTable()};
+                // alpha lanes read the second half of the table.
+                const __m256i alpha_offset {_mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256)};
+                size_t i {0};
+                for(; i + 2 <= pixels; i += 2) {
+                    __m128i bytes {_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + 4 * i))};
+                    __m256i index {_mm256_add_epi32(_mm256_cvtepu8_epi32(bytes), alpha_offset)};
+                    _mm256_storeu_ps(dst + 4 * i, _mm256_i32gather_ps(table, index, 4));
+                }
+                scalar_kernels.srgb_to_linear(src + 4 * i, dst + 4 * i, pixels - i);
+            }
+
+            // two pixels, as one 32 bit value per channel.
+            __m256i LinearToSrgb2(const float *src, const uint8_t *table) {
+                const __m256 c {_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src), _mm256_setzero_ps()), _mm256_set1_ps(1.0f))};
+                const __m256 half {_mm256_set1_ps(0.5f)};
+                __m256i index {_mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(linear_steps)), half))};
+                __m256i alpha {_mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(255.0f)), half))};
+                // the table is padded, so reading 32 bits at the last entry is fine.
+                __m256i colour {_mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int *>(table), index, 1),
+                                                 _mm256_set1_epi32(0xff))};
+                return _mm256_blend_epi32(colour, alpha, 0x88);
+            }
+
+            void LinearToSrgb(const float *src, uint8_t *dst, size_t pixels) {
+                const uint8_t *table {LinearToSrgbTable()};
+                const __m256i order {_mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)};
+                size_t i {0};
+                for(; i + 4 <= pixels; i += 4) {
+                    __m256i lo {LinearToSrgb2(src + 4 * i, table)};
+                    __m256i hi {LinearToSrgb2(src + 4 * i + 8, table)};
+                    // pixels 0 2 | 1 3 as words, then bytes, then back in order.
+                    __m256i words {_mm256_packus_epi32(lo, hi)};
+                    __m256i bytes {_mm256_permutevar8x32_epi32(_mm256_packus_epi16(words, words), order)};
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), _mm256_castsi256_si128(bytes));
+                }
+                scalar_kernels.linear_to_srgb(src + 4 * i, dst + 4 * i, pixels - i);
+            }
+
+            __m256i FloatToHalf8(__m256i f) {
+                const __m256i sign_mask {_mm256_set1_epi32(static_cast<int32_t>(0x80000000u))};
+                const __m256i denorm_magic {_mm256_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23)};
+                const __m256i sign {_mm256_and_si256(f, sign_mask)};
+                f = _mm256_xor_si256(f, sign);
+
+                const __m256i big {_mm256_cmpgt_epi32(f, _mm256_set1_epi32(((127 + 16) << 23) - 1))};
+                const __m256i nan {_mm256_cmpgt_epi32(f, _mm256_set1_epi32(255 << 23))};
+                const __m256i infnan {_mm256_or_si256(_mm256_set1_epi32(0x7c00), _mm256_and_si256(nan, _mm256_set1_epi32(0x0200)))};
+
+                const __m256i subnormal {_mm256_cmpgt_epi32(_mm256_set1_epi32(113 << 23), f)};
+                __m256 shifted {_mm256_add_ps(_mm256_castsi256_ps(f), _mm256_castsi256_ps(denorm_magic))};
+                const __m256i denorm {_mm256_sub_epi32(_mm256_castps_si256(shifted), denorm_magic)};
+
+                const __m256i mantissa_odd {_mm256_and_si256(_mm256_srli_epi32(f, 13), _mm256_set1_epi32(1))};
+                __m256i normal {_mm256_add_epi32(f, _mm256_set1_epi32(static_cast<int32_t>((15u - 127u) << 23) + 0xfff))};
+                normal = _mm256_srli_epi32(_mm256_add_epi32(normal, mantissa_odd), 13);
+
+                __m256i h {Select(big, infnan, Select(subnormal, denorm, normal))};
+                h = _mm256_or_si256(h, _mm256_srli_epi32(sign, 16));
+                return _mm256_srai_epi32(_mm256_slli_epi32(h, 16), 16);
+            }
+
+            void FloatToHalf(const float *src, uint16_t *dst, size_t count) {
+                size_t i {0};
+                for(; i + 16 <= count; i += 16) {
+                    __m256i lo {FloatToHalf8(_mm256_castps_si256(_mm256_loadu_ps(src + i)))};
+                    __m256i hi {FloatToHalf8(_mm256_castps_si256(_mm256_loadu_ps(src + i + 8)))};
+                    // the pack works per 128 bit lane, the permute puts the quarters back in order.
+                    __m256i packed {_mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8)};
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), packed);
+                }
+                scalar_kernels.float_to_half(src + i, dst + i, count - i);
+            }
+
+            // four destination pixels from eight source pixels of each row, as 16 bit values,
+            // in the order 0 1 | 2 3.
+            __m256i Downsample4(const uint8_t *row0, const uint8_t *row1) {
+                const __m256i zero {_mm256_setzero_si256()};
+                __m256i a {_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0))};
+                __m256i b {_mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1))};
+                __m256i lo {_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero))};
+                __m256i hi {_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero))};
+                __m256i sum {_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi))};
+                return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+            }
+
+            void DownsampleRow(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, uint32_t width) {
+                uint32_t x {0};
+                for(; x + 8 <= width; x += 8) {
+                    __m256i lo {Downsample4(row0 + 8 * x, row1 + 8 * x)};
+                    __m256i hi {Downsample4(row0 + 8 * x + 32, row1 + 8 * x + 32)};
+                    __m256i packed {_mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8)};
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * x), packed);
+                }
+                scalar_kernels.downsample_row(row0 + 8 * x, row1 + 8 * x, dst + 4 * x, width - x);
+            }
+        }
+
+        const Kernels avx2_kernels {ExpandRgb, Swizzle, SrgbToLinear, LinearToSrgb, FloatToHalf, DownsampleRow};
+    }
+}
+#endif
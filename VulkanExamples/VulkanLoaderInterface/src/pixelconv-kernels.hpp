@@ -0,0 +1,98 @@
+/*
+    pixelconv-kernels.hpp: The kernel tables behind pixelconv.hpp, one per SimdLevel.
+
+    - The SIMD files convert the tails of their inputs with the scalar helpers here, which is
+      also what keeps every level bit identical.
+    - Floating point kernels use the same operations in the same order at every level. The AVX2
+      file is built with -mavx2 only, never with FMA, so nothing gets contracted.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace vkli {
+    namespace pixelconv {
+        struct Kernels {
+            void (*expand_rgb)(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha);
+            void (*swizzle)(const uint8_t *src, uint8_t *dst, size_t pixels);
+            void (*srgb_to_linear)(const uint8_t *src, float *dst, size_t pixels);
+            void (*linear_to_srgb)(const float *src, uint8_t *dst, size_t pixels);
+            void (*float_to_half)(const float *src, uint16_t *dst, size_t count);
+            // one row of a mip level from two rows of the level above, at least 2 * width wide.
+            void (*downsample_row)(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, uint32_t width);
+        };
+
+        extern const Kernels scalar_kernels;
+    #if defined(VKLI_PIXELCONV_X86)
+        extern const Kernels sse2_kernels;
+        extern const Kernels avx2_kernels;
+    #endif
+
+        // sRGB decoded colour values for 0 to 255, then 0 to 255 divided by 255 for alpha.
+        const float *SrgbToLinearTable();
+        // sRGB encoded bytes for 0 to linear_steps, padded so it can be read 32 bits at a time.
+        const uint8_t *LinearToSrgbTable();
+        constexpr float linear_steps {65535.0f};
+
+        // the same comparisons as minps / maxps, NaN gives the second operand.
+        inline float Max(float a, float b) { return a > b ? a : b; }
+        inline float Min(float a, float b) { return a < b ? a : b; }
+
+        inline uint8_t LinearToSrgbValue(float x, const uint8_t *table) {
+            return table[static_cast<int32_t>(Min(Max(x, 0.0f), 1.0f) * linear_steps + 0.5f)];
+        }
+        inline uint8_t UnitToByte(float x) {
+            return static_cast<uint8_t>(static_cast<int32_t>(Min(Max(x, 0.0f), 1.0f) * 255.0f + 0.5f));
+        }
+
+        // round to nearest even through the float adder for subnormal results, integer rounding
+        // otherwise.
+        inline uint16_t FloatToHalfValue(float value) {
+            const uint32_t f32_infinity {255u << 23};
+            const uint32_t f16_max {(127u + 16u) << 23};
+            const uint32_t denorm_magic {((127u - 15u) + (23u - 10u) + 1u) << 23};
+            uint32_t f;
+            std::memcpy(&f, &value, sizeof(f));
+            const uint32_t sign {f & 0x80000000u};
+            f ^= sign;
+
+            uint32_t h;
+            if(f >= f16_max) {
+                h = f > f32_infinity ? 0x7e00u : 0x7c00u;
+            } else if(f < (113u << 23)) {
+                float magic, shifted;
+                std::memcpy(&magic, &denorm_magic, sizeof(magic));
+                std::memcpy(&shifted, &f, sizeof(shifted));
+                shifted += magic;
+                std::memcpy(&f, &shifted, sizeof(f));
+                h = f - denorm_magic;
+            } else {
+                const uint32_t mantissa_odd {(f >> 13) & 1u};
+                f += ((15u - 127u) << 23) + 0xfffu;
+                f += mantissa_odd;
+                h = f >> 13;
+            }
+            return static_cast<uint16_t>(h | (sign >> 16));
+        }
+
+        inline void DownsamplePixel(const uint8_t *row0, const uint8_t *row1, uint8_t *dst) {
+            for(int c = 0; c < 4; c++)
+                dst[c] = static_cast<uint8_t>((row0[c] + row0[4 + c] + row1[c] + row1[4 + c] + 2) >> 2);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+/*
+    pixelconv-sse2.cpp: SSE2 kernels for pixelconv.hpp.
+
+    - SSE2 has neither byte shuffles nor gathers, RGB expansion and sRGB decoding stay scalar.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pixelconv-kernels.hpp"
+
+#if defined(VKLI_PIXELCONV_X86)
+#include <emmintrin.h>
+
+namespace vkli {
+    namespace pixelconv {
+        namespace {
+            __m128i Select(__m128i mask, __m128i a, __m128i b) {
+                return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+            }
+
+            void Swizzle(const uint8_t *src, uint8_t *dst, size_t pixels) {
+                const __m128i ga_mask {_mm_set1_epi32(static_cast<int32_t>(0xff00ff00u))};
+                const __m128i rb_mask {_mm_set1_epi32(0x00ff00ff)};
+                size_t i {0};
+                for(; i + 4 <= pixels; i += 4) {
+                    __m128i v {_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i))};
+                    __m128i rb {_mm_and_si128(v, rb_mask)};
+                    rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), _mm_or_si128(_mm_and_si128(v, ga_mask), rb));
+                }
+                scalar_kernels.swizzle(src + 4 * i, dst + 4 * i, pixels - i);
+            }
+
+            // the table lookups stay scalar, the clamping and index arithmetic is done four lanes at a time.
+            void LinearToSrgb(const float *src, uint8_t *dst, size_t pixels) {
+                const uint8_t *table {LinearToSrgbTable()};
+                const __m128 zero {_mm_setzero_ps()}, one {_mm_set1_ps(1.0f)}, half {_mm_set1_ps(0.5f)};
+                const __m128 steps {_mm_set1_ps(linear_steps)}, byte {_mm_set1_ps(255.0f)};
+                alignas(16) int32_t index[4], alpha[4];
+                size_t i {0};
+                for(; i < pixels; i++) {
+                    __m128 c {_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 4 * i), zero), one)};
+                    _mm_store_si128(reinterpret_cast<__m128i *>(index), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, steps), half)));
+                    _mm_store_si128(reinterpret_cast<__m128i *>(alpha), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, byte), half)));
+                    dst[4 * i] = table[index[0]];
+                    dst[4 * i + 1] = table[index[1]];
+                    dst[4 * i + 2] = table[index[2]];
+                    dst[4 * i + 3] = static_cast<uint8_t>(alpha[3]);
+                }
+            }
+
+            __m128i FloatToHalf4(__m128i f) {
+                const __m128i sign_mask {_mm_set1_epi32(static_cast<int32_t>(0x80000000u))};
+                const __m128i denorm_magic {_mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23)};
+                const __m128i sign {_mm_and_si128(f, sign_mask)};
+                f = _mm_xor_si128(f, sign);
+
+                // f is positive now, so the signed compares work.
+                const __m128i big {_mm_cmpgt_epi32(f, _mm_set1_epi32(((127 + 16) << 23) - 1))};
+                const __m128i nan {_mm_cmpgt_epi32(f, _mm_set1_epi32(255 << 23))};
+                const __m128i infnan {_mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(nan, _mm_set1_epi32(0x0200)))};
+
+                const __m128i subnormal {_mm_cmplt_epi32(f, _mm_set1_epi32(113 << 23))};
+                __m128 shifted {_mm_add_ps(_mm_castsi128_ps(f), _mm_castsi128_ps(denorm_magic))};
+                const __m128i denorm {_mm_sub_epi32(_mm_castps_si128(shifted), denorm_magic)};
+
+                const __m128i mantissa_odd {_mm_and_si128(_mm_srli_epi32(f, 13), _mm_set1_epi32(1))};
+                __m128i normal {_mm_add_epi32(f, _mm_set1_epi32(static_cast<int32_t>((15u - 127u) << 23) + 0xfff))};
+                normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissa_odd), 13);
+
+                __m128i h {Select(big, infnan, Select(subnormal, denorm, normal))};
+                h = _mm_or_si128(h, _mm_srli_epi32(sign, 16));
+                // sign extend, so the signed saturating pack keeps all 16 bits.
+                return _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+            }
+
+            void FloatToHalf(const float *src, uint16_t *dst, size_t count) {
+                size_t i {0};
+                for(; i + 8 <= count; i += 8) {
+                    __m128i lo {FloatToHalf4(_mm_castps_si128(_mm_loadu_ps(src + i)))};
+                    __m128i hi {FloatToHalf4(_mm_castps_si128(_mm_loadu_ps(src + i + 4)))};
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(lo, hi));
+                }
+                scalar_kernels.float_to_half(src + i, dst + i, count - i);
+            }
+
+            // two destination pixels from four source pixels of each row, as 16 bit sums.
+            __m128i Downsample2(const uint8_t *row0, const uint8_t *row1) {
+                const __m128i zero {_mm_setzero_si128()};
+                __m128i a {_mm_loadu_si128(reinterpret_cast<const __m128i *>(row0))};
+                __m128i b {_mm_loadu_si128(reinterpret_cast<const __m128i *>(row1))};
+                __m128i lo {_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero))};
+                __m128i hi {_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero))};
+                __m128i sum {_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi))};
+                return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+            }
+
+            void DownsampleRow(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, uint32_t width) {
+                uint32_t x {0};
+                for(; x + 4 <= width; x += 4) {
+                    __m128i lo {Downsample2(row0 + 8 * x, row1 + 8 * x)};
+                    __m128i hi {Downsample2(row0 + 8 * x + 16, row1 + 8 * x + 16)};
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * x), _mm_packus_epi16(lo, hi));
+                }
+                scalar_kernels.downsample_row(row0 + 8 * x, row1 + 8 * x, dst + 4 * x, width - x);
+            }
+        }
+
+        const Kernels sse2_kernels {
+            scalar_kernels.expand_rgb,
+            Swizzle,
+            scalar_kernels.srgb_to_linear,
+            LinearToSrgb,
+            FloatToHalf,
+            DownsampleRow
+        };
+    }
+}
+#endif
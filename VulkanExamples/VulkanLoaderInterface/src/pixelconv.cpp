@@ -0,0 +1,216 @@
+/*
+    pixelconv.cpp: The scalar kernels, lookup tables and runtime dispatch of pixelconv.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/pixelconv.hpp"
+#include "pixelconv-kernels.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#if defined(VKLI_PIXELCONV_X86) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace vkli {
+    namespace pixelconv {
+        namespace {
+            void ExpandRgb(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha) {
+                for(size_t i = 0; i < pixels; i++, src += 3, dst += 4) {
+                    dst[0] = src[0];
+                    dst[1] = src[1];
+                    dst[2] = src[2];
+                    dst[3] = alpha;
+                }
+            }
+
+            void Swizzle(const uint8_t *src, uint8_t *dst, size_t pixels) {
+                for(size_t i = 0; i < pixels; i++, src += 4, dst += 4) {
+                    const uint8_t r {src[0]};
+                    dst[0] = src[2];
+                    dst[1] = src[1];
+                    dst[2] = r;
+                    dst[3] = src[3];
+                }
+            }
+
+            void SrgbToLinear(const uint8_t *src, float *dst, size_t pixels) {
+                const float *table {SrgbToLinearTable()};
+                for(size_t i = 0; i < pixels; i++, src += 4, dst += 4) {
+                    dst[0] = table[src[0]];
+                    dst[1] = table[src[1]];
+                    dst[2] = table[src[2]];
+                    dst[3] = table[256 + src[3]];
+                }
+            }
+
+            void LinearToSrgb(const float *src, uint8_t *dst, size_t pixels) {
+                const uint8_t *table {LinearToSrgbTable()};
+                for(size_t i = 0; i < pixels; i++, src += 4, dst += 4) {
+                    dst[0] = LinearToSrgbValue(src[0], table);
+                    dst[1] = LinearToSrgbValue(src[1], table);
+                    dst[2] = LinearToSrgbValue(src[2], table);
+                    dst[3] = UnitToByte(src[3]);
+                }
+            }
+
+            void FloatToHalf(const float *src, uint16_t *dst, size_t count) {
+                for(size_t i = 0; i < count; i++) dst[i] = FloatToHalfValue(src[i]);
+            }
+
+            void DownsampleRow(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, uint32_t width) {
+                for(uint32_t x = 0; x < width; x++) DownsamplePixel(row0 + 8 * x, row1 + 8 * x, dst + 4 * x);
+            }
+
+            const Kernels *KernelsFor(SimdLevel level) {
+            #if defined(VKLI_PIXELCONV_X86)
+                if(level == SimdLevel::AVX2) return &avx2_kernels;
+                if(level == SimdLevel::SSE2) return &sse2_kernels;
+            #endif
+                return &scalar_kernels;
+            }
+
+            struct Active {
+                std::atomic<SimdLevel> level;
+                std::atomic<const Kernels *> kernels;
+            };
+
+            Active& GetActive() {
+                static Active active {DetectSimdLevel(), KernelsFor(DetectSimdLevel())};
+                return active;
+            }
+
+            const Kernels& Current() {
+                return *GetActive().kernels.load(std::memory_order_relaxed);
+            }
+        }
+
+        const Kernels scalar_kernels {ExpandRgb, Swizzle, SrgbToLinear, LinearToSrgb, FloatToHalf, DownsampleRow};
+
+        const float *SrgbToLinearTable() {
+            static const std::vector<float> table {[] {
+                std::vector<float> t(512);
+                for(int i = 0; i < 256; i++) {
+                    double c {i / 255.0};
+                    t[i] = static_cast<float>(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+                    t[256 + i] = static_cast<float>(c);
+                }
+                return t;
+            }()};
+            return table.data();
+        }
+
+        const uint8_t *LinearToSrgbTable() {
+            static const std::vector<uint8_t> table {[] {
+                const int steps {static_cast<int>(linear_steps)};
+                std::vector<uint8_t> t(steps + 1 + 3, 0);
+                for(int i = 0; i <= steps; i++) {
+                    double c {double(i) / steps};
+                    double s {c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055};
+                    t[i] = static_cast<uint8_t>(std::lround(std::clamp(s, 0.0, 1.0) * 255.0));
+                }
+                return t;
+            }()};
+            return table.data();
+        }
+    }
+
+    SimdLevel DetectSimdLevel() {
+    #if defined(VKLI_PIXELCONV_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        const int max_leaf {info[0]};
+        __cpuid(info, 1);
+        const bool sse2 {(info[3] & (1 << 26)) != 0};
+        // AVX2 also needs the OS to save the YMM registers.
+        const bool avx_usable {(info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6};
+        bool avx2 {false};
+        if(avx_usable && max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+        return avx2 ? SimdLevel::AVX2 : sse2 ? SimdLevel::SSE2 : SimdLevel::Scalar;
+    #elif defined(VKLI_PIXELCONV_X86)
+        // also checks that the OS saves the YMM registers.
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+        if(__builtin_cpu_supports("sse2")) return SimdLevel::SSE2;
+        return SimdLevel::Scalar;
+    #else
+        return SimdLevel::Scalar;
+    #endif
+    }
+
+    SimdLevel GetSimdLevel() {
+        return pixelconv::GetActive().level.load(std::memory_order_relaxed);
+    }
+
+    SimdLevel SetSimdLevel(SimdLevel level) {
+        level = std::min(level, DetectSimdLevel());
+        pixelconv::Active& active {pixelconv::GetActive()};
+        active.kernels.store(pixelconv::KernelsFor(level), std::memory_order_relaxed);
+        active.level.store(level, std::memory_order_relaxed);
+        return level;
+    }
+
+    const char *SimdLevelName(SimdLevel level) {
+        switch(level) {
+            case SimdLevel::AVX2: return "AVX2";
+            case SimdLevel::SSE2: return "SSE2";
+            default: return "scalar";
+        }
+    }
+
+    void ExpandRgbToRgba(const uint8_t *src, uint8_t *dst, size_t pixels, uint8_t alpha) {
+        pixelconv::Current().expand_rgb(src, dst, pixels, alpha);
+    }
+
+    void SwizzleRgbaToBgra(const uint8_t *src, uint8_t *dst, size_t pixels) {
+        pixelconv::Current().swizzle(src, dst, pixels);
+    }
+
+    void SrgbToLinear(const uint8_t *src, float *dst, size_t pixels) {
+        pixelconv::Current().srgb_to_linear(src, dst, pixels);
+    }
+
+    void LinearToSrgb(const float *src, uint8_t *dst, size_t pixels) {
+        pixelconv::Current().linear_to_srgb(src, dst, pixels);
+    }
+
+    void FloatToHalf(const float *src, uint16_t *dst, size_t count) {
+        pixelconv::Current().float_to_half(src, dst, count);
+    }
+
+    void DownsampleRgba(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst) {
+        const uint32_t dst_width {std::max(width / 2, 1u)}, dst_height {std::max(height / 2, 1u)};
+        const size_t pitch {size_t(width) * 4};
+        const pixelconv::Kernels& kernels {pixelconv::Current()};
+        for(uint32_t y = 0; y < dst_height; y++, dst += size_t(dst_width) * 4) {
+            const uint8_t *row0 {src + 2 * y * pitch};
+            const uint8_t *row1 {height > 1 ? row0 + pitch : row0};
+            if(width > 1) {
+                kernels.downsample_row(row0, row1, dst, dst_width);
+            } else {
+                // a one texel wide level averages each texel with itself.
+                const uint8_t col0[8] {row0[0], row0[1], row0[2], row0[3], row0[0], row0[1], row0[2], row0[3]};
+                const uint8_t col1[8] {row1[0], row1[1], row1[2], row1[3], row1[0], row1[1], row1[2], row1[3]};
+                pixelconv::DownsamplePixel(col0, col1, dst);
+            }
+        }
+    }
+}
@@ -0,0 +1,521 @@
+/*
+    readback.cpp: Implementation of the asynchronous frame readback ring from readback.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/readback.hpp"
+#include "vkli-internal.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <stdexcept>
+
+namespace vkli {
+    namespace {
+        uint32_t Crc32Update(uint32_t crc, const uint8_t *data, size_t n) {
+            static const auto table {[] {
+                std::array<uint32_t, 256> t;
+                for(uint32_t i = 0; i < 256; i++) {
+                    uint32_t c {i};
+                    for(int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    t[i] = c;
+                }
+                return t;
+            }()};
+            for(size_t i = 0; i < n; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            return crc;
+        }
+
+        // writes PNG chunks, keeping the running CRC of the current chunk.
+        class PngStream {
+            public:
+                PngStream(std::FILE *file) : m_File{file}, m_Crc{0}, m_Ok{true} {}
+                void BeginChunk(const char *type, uint32_t length) {
+                    PutBE(length);
+                    m_Crc = 0xffffffffu;
+                    Put(reinterpret_cast<const uint8_t *>(type), 4);
+                }
+                void Put(const uint8_t *data, size_t n) {
+                    m_Ok = m_Ok && std::fwrite(data, 1, n, m_File) == n;
+                    m_Crc = Crc32Update(m_Crc, data, n);
+                }
+                void PutBE(uint32_t value) {
+                    const uint8_t bytes[4] {uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value)};
+                    Put(bytes, 4);
+                }
+                void EndChunk() { PutBE(m_Crc ^ 0xffffffffu); }
+                bool Ok() const { return m_Ok; }
+            private:
+                std::FILE *m_File;
+                uint32_t m_Crc;
+                bool m_Ok;
+        };
+
+        // a zlib stream made of stored (uncompressed) deflate blocks, written incrementally.
+        class StoredDeflate {
+            public:
+                static constexpr uint32_t max_block {65535};
+                static uint64_t StreamSize(uint64_t raw_size) {
+                    uint64_t n_blocks {std::max<uint64_t>(1, (raw_size + max_block - 1) / max_block)};
+                    return 2 + raw_size + 5 * n_blocks + 4; // zlib header, blocks, adler32
+                }
+
+                StoredDeflate(PngStream& out, uint64_t raw_size)
+                    : m_Out{out}, m_RemainingTotal{raw_size}, m_RemainingBlock{0}, m_A{1}, m_B{0}
+                {
+                    const uint8_t header[2] {0x78, 0x01};
+                    m_Out.Put(header, 2);
+                }
+                void Put(const uint8_t *data, size_t n) {
+                    while(n > 0) {
+                        if(m_RemainingBlock == 0) {
+                            uint32_t len {static_cast<uint32_t>(std::min<uint64_t>(max_block, m_RemainingTotal))};
+                            const uint8_t header[5] {
+                                uint8_t(len == m_RemainingTotal ? 1 : 0), // BFINAL, BTYPE = stored
+                                uint8_t(len), uint8_t(len >> 8), uint8_t(~len), uint8_t(~len >> 8)
+                            };
+                            m_Out.Put(header, 5);
+                            m_RemainingBlock = len;
+                        }
+                        size_t k {std::min<size_t>(n, m_RemainingBlock)};
+                        m_Out.Put(data, k);
+                        Adler(data, k);
+                        data += k;
+                        n -= k;
+                        m_RemainingBlock -= static_cast<uint32_t>(k);
+                        m_RemainingTotal -= k;
+                    }
+                }
+                void Finish() { m_Out.PutBE((m_B << 16) | m_A); }
+            private:
+                void Adler(const uint8_t *data, size_t n) {
+                    // 5552 is the largest run that cannot overflow m_B before the modulo.
+                    while(n > 0) {
+                        size_t k {std::min<size_t>(n, 5552)};
+                        n -= k;
+                        while(k--) { m_A += *data++; m_B += m_A; }
+                        m_A %= 65521;
+                        m_B %= 65521;
+                    }
+                }
+            private:
+                PngStream& m_Out;
+                uint64_t m_RemainingTotal;
+                uint32_t m_RemainingBlock;
+                uint32_t m_A, m_B;
+        };
+
+        std::string FrameFileName(const std::string& prefix, uint64_t frame_id) {
+            std::string id {std::to_string(frame_id)};
+            if(id.size() < 6) id.insert(0, 6 - id.size(), '0');
+            return prefix + "_" + id + ".png";
+        }
+    }
+
+    RawFrameSink::RawFrameSink(const std::string& path)
+        : m_File{path == "-" ? stdout : std::fopen(path.c_str(), "wb")}
+    {
+        if(m_File == nullptr)
+            throw std::runtime_error("[ERROR] Could not open " + path + " for frame output");
+    }
+
+    RawFrameSink::~RawFrameSink() {
+        if(m_File != stdout) std::fclose(m_File);
+        else std::fflush(m_File);
+    }
+
+    bool RawFrameSink::Write(const ReadbackFrame& frame) {
+        size_t size {static_cast<size_t>(frame.row_pitch) * frame.height};
+        return std::fwrite(frame.data, 1, size, m_File) == size;
+    }
+
+    PngFrameSink::PngFrameSink(const std::string& prefix) : m_Prefix{prefix} {}
+
+    bool PngFrameSink::Write(const ReadbackFrame& frame) {
+        // PNG has no empty images.
+        if(frame.width == 0 || frame.height == 0) {
+            std::clog << "[ERROR] PngFrameSink cannot write an empty frame" << std::endl;
+            return false;
+        }
+
+        bool swizzle;
+        switch(frame.format) {
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+                swizzle = false;
+                break;
+            case VK_FORMAT_B8G8R8A8_UNORM:
+            case VK_FORMAT_B8G8R8A8_SRGB:
+                swizzle = true;
+                break;
+            default:
+                std::clog << "[ERROR] PngFrameSink only supports 8 bit RGBA and BGRA formats" << std::endl;
+                return false;
+        }
+
+        std::string name {FrameFileName(m_Prefix, frame.frame_id)};
+        std::FILE *file {std::fopen(name.c_str(), "wb")};
+        if(file == nullptr) {
+            std::clog << "[ERROR] Could not open " << name << std::endl;
+            return false;
+        }
+
+        const uint32_t row_bytes {frame.width * 4};
+        if(swizzle) m_Row.resize(row_bytes);
+
+        const uint8_t signature[8] {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        std::fwrite(signature, 1, 8, file);
+        PngStream png {file};
+
+        png.BeginChunk("IHDR", 13);
+        png.PutBE(frame.width);
+        png.PutBE(frame.height);
+        const uint8_t ihdr[5] {8, 6, 0, 0, 0}; // 8 bit depth, RGBA, deflate, no filter, no interlace
+        png.Put(ihdr, 5);
+        png.EndChunk();
+
+        // every row is prefixed by its filter type byte.
+        uint64_t raw_size {static_cast<uint64_t>(frame.height) * (1 + row_bytes)};
+        png.BeginChunk("IDAT", static_cast<uint32_t>(StoredDeflate::StreamSize(raw_size)));
+        StoredDeflate zlib {png, raw_size};
+        for(uint32_t y = 0; y < frame.height; y++) {
+            const uint8_t filter {0};
+            const uint8_t *row {frame.data + static_cast<size_t>(y) * frame.row_pitch};
+            zlib.Put(&filter, 1);
+            if(swizzle) {
+                for(uint32_t x = 0; x < row_bytes; x += 4) {
+                    m_Row[x] = row[x + 2];
+                    m_Row[x + 1] = row[x + 1];
+                    m_Row[x + 2] = row[x];
+                    m_Row[x + 3] = row[x + 3];
+                }
+                row = m_Row.data();
+            }
+            zlib.Put(row, row_bytes);
+        }
+        zlib.Finish();
+        png.EndChunk();
+
+        png.BeginChunk("IEND", 0);
+        png.EndChunk();
+
+        bool ok {png.Ok()};
+        if(std::fclose(file) != 0) ok = false;
+        if(!ok) std::clog << "[ERROR] Writing " << name << " failed" << std::endl;
+        return ok;
+    }
+
+    ReadbackRing::ReadbackRing(VkLoader& loader, VkExtent2D extent, VkFormat format,
+                               std::unique_ptr<FrameSink> sink, uint32_t n_slots)
+        : m_Device{loader.GetDevice()}, m_Queue{loader.GetQueue()}, m_Extent{extent}, m_Format{format},
+          m_Coherent{true}, m_CmdPool{VK_NULL_HANDLE}, m_Slots(std::max(n_slots, 1u)), m_NextSlot{0},
+          m_Sink{std::move(sink)}, m_Stop{false}, m_DeviceLost{false}, m_Written{0}, m_Failed{0}, m_Stalls{0}
+    {
+        if(m_Device == nullptr)
+            throw std::runtime_error("[ERROR] ReadbackRing needs a logical device, call CreateDevice first.");
+        if(extent.width == 0 || extent.height == 0)
+            throw std::runtime_error("[ERROR] ReadbackRing cannot read back an empty extent");
+
+        uint32_t texel_size {helpers::FormatSize(format)};
+        if(texel_size == 0)
+            throw std::runtime_error("[ERROR] ReadbackRing does not support the requested format");
+        m_RowPitch = extent.width * texel_size;
+        m_FrameSize = static_cast<VkDeviceSize>(m_RowPitch) * extent.height;
+
+        try {
+            VkCommandPoolCreateInfo pool_info {
+                VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                nullptr,
+                VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                loader.GetQueueFamily()
+            };
+            if(vkCreateCommandPool(m_Device, &pool_info, nullptr, &m_CmdPool) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Creating the readback command pool failed");
+
+            VkPhysicalDeviceMemoryProperties mem_props;
+            vkGetPhysicalDeviceMemoryProperties(loader.GetPhysicalDevice(), &mem_props);
+
+            for(auto& slot : m_Slots) {
+                VkBufferCreateInfo buffer_info {
+                    VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                    nullptr,
+                    0,
+                    m_FrameSize,
+                    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_SHARING_MODE_EXCLUSIVE,
+                    0,
+                    nullptr
+                };
+                if(vkCreateBuffer(m_Device, &buffer_info, nullptr, &slot.buffer) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Creating a readback buffer failed");
+
+                VkMemoryRequirements reqs;
+                vkGetBufferMemoryRequirements(m_Device, slot.buffer, &reqs);
+
+                // cached memory makes the CPU reads fast, it is not always available however.
+                uint32_t type;
+                try {
+                    type = helpers::FindMemoryType(loader.GetPhysicalDevice(), reqs.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+                } catch(std::runtime_error&) {
+                    type = helpers::FindMemoryType(loader.GetPhysicalDevice(), reqs.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                }
+                m_Coherent = mem_props.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+                VkMemoryAllocateInfo alloc_info {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO, nullptr, reqs.size, type};
+                if(vkAllocateMemory(m_Device, &alloc_info, nullptr, &slot.memory) != VK_SUCCESS ||
+                   vkBindBufferMemory(m_Device, slot.buffer, slot.memory, 0) != VK_SUCCESS ||
+                   vkMapMemory(m_Device, slot.memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void **>(&slot.mapped)) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Allocating readback memory failed");
+
+                VkCommandBufferAllocateInfo cmd_info {
+                    VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                    nullptr,
+                    m_CmdPool,
+                    VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                    1
+                };
+                VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
+                if(vkAllocateCommandBuffers(m_Device, &cmd_info, &slot.cmd) != VK_SUCCESS ||
+                   vkCreateFence(m_Device, &fence_info, nullptr, &slot.fence) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Creating readback command buffers failed");
+            }
+        } catch(std::runtime_error&) {
+            Destroy();
+            throw;
+        }
+
+        m_IoThread = std::thread{&ReadbackRing::IoThread, this};
+        std::clog << "[INFO] Readback ring created with " << m_Slots.size() << " slots of "
+                  << m_FrameSize << " bytes" << (m_Coherent ? "" : " (host cached)") << std::endl;
+    }
+
+    ReadbackRing::~ReadbackRing() {
+        Flush();
+        {
+            std::lock_guard<std::mutex> lock {m_Mutex};
+            m_Stop = true;
+        }
+        m_IoCv.notify_one();
+        m_IoThread.join();
+        Destroy();
+    }
+
+    void ReadbackRing::Destroy() {
+        for(auto& slot : m_Slots) {
+            if(slot.fence) vkDestroyFence(m_Device, slot.fence, nullptr);
+            if(slot.buffer) vkDestroyBuffer(m_Device, slot.buffer, nullptr);
+            // freeing the memory implicitly unmaps it.
+            if(slot.memory) vkFreeMemory(m_Device, slot.memory, nullptr);
+        }
+        // the command buffers are freed with the pool.
+        if(m_CmdPool) vkDestroyCommandPool(m_Device, m_CmdPool, nullptr);
+    }
+
+    bool ReadbackRing::Enqueue(VkImage image, uint64_t frame_id, VkSemaphore wait) {
+        std::unique_lock<std::mutex> lock {m_Mutex};
+        if(!Harvest(lock, false)) return false;
+
+        // slots are used round robin, so the next slot is always the oldest one.
+        const uint32_t index {m_NextSlot};
+        Slot& slot {m_Slots[index]};
+        if(slot.state != SLOT_FREE) {
+            m_Stalls++;
+            if(slot.state == SLOT_GPU && !Harvest(lock, true)) return false;
+            m_FreeCv.wait(lock, [&slot] { return slot.state == SLOT_FREE; });
+        }
+
+        // the slot is reserved for this call, so recording and submitting can happen unlocked.
+        slot.state = SLOT_RECORDING;
+        m_NextSlot = (m_NextSlot + 1) % m_Slots.size();
+        lock.unlock();
+        const bool ok {Submit(slot, image, frame_id, wait)};
+        lock.lock();
+
+        if(!ok) {
+            slot.state = SLOT_FREE;
+            m_FreeCv.notify_all();
+            return false;
+        }
+        slot.frame_id = frame_id;
+        slot.state = SLOT_GPU;
+        m_InFlight.push_back(index);
+        return true;
+    }
+
+    bool ReadbackRing::Submit(Slot& slot, VkImage image, uint64_t frame_id, VkSemaphore wait) {
+        if(vkResetFences(m_Device, 1, &slot.fence) != VK_SUCCESS ||
+           vkResetCommandBuffer(slot.cmd, 0) != VK_SUCCESS)
+            return false;
+
+        VkCommandBufferBeginInfo begin_info {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            nullptr,
+            VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            nullptr
+        };
+        if(vkBeginCommandBuffer(slot.cmd, &begin_info) != VK_SUCCESS)
+            return false;
+
+        VkBufferImageCopy region {
+            0, // buffer offset
+            0, // row length, 0 = tightly packed
+            0, // image height, 0 = tightly packed
+            {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            {0, 0, 0},
+            {m_Extent.width, m_Extent.height, 1}
+        };
+        vkCmdCopyImageToBuffer(slot.cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+        // make the transfer writes visible to the host once the fence signals.
+        VkBufferMemoryBarrier barrier {
+            VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_ACCESS_HOST_READ_BIT,
+            VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED,
+            slot.buffer,
+            0,
+            VK_WHOLE_SIZE
+        };
+        vkCmdPipelineBarrier(slot.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             0, nullptr, 1, &barrier, 0, nullptr);
+
+        if(vkEndCommandBuffer(slot.cmd) != VK_SUCCESS)
+            return false;
+
+        VkPipelineStageFlags wait_stage {VK_PIPELINE_STAGE_TRANSFER_BIT};
+        VkSubmitInfo submit_info {
+            VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            nullptr,
+            wait ? 1u : 0u,
+            wait ? &wait : nullptr,
+            wait ? &wait_stage : nullptr,
+            1,
+            &slot.cmd,
+            0,
+            nullptr
+        };
+        if(vkQueueSubmit(m_Queue, 1, &submit_info, slot.fence) != VK_SUCCESS) {
+            std::clog << "[ERROR] Submitting readback of frame " << frame_id << " failed" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool ReadbackRing::Poll() {
+        std::unique_lock<std::mutex> lock {m_Mutex};
+        return Harvest(lock, false);
+    }
+
+    bool ReadbackRing::Flush() {
+        std::unique_lock<std::mutex> lock {m_Mutex};
+        while(!m_InFlight.empty() && Harvest(lock, true)) {}
+        m_FreeCv.wait(lock, [this] {
+            return std::all_of(m_Slots.begin(), m_Slots.end(), [](const Slot& s) { return s.state == SLOT_FREE; });
+        });
+        return m_Failed == 0;
+    }
+
+    uint64_t ReadbackRing::FramesWritten() const {
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        return m_Written;
+    }
+
+    uint64_t ReadbackRing::FramesFailed() const {
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        return m_Failed;
+    }
+
+    bool ReadbackRing::Harvest(std::unique_lock<std::mutex>& lock, bool block) {
+        if(m_DeviceLost) return false;
+        // frames are handed over in submission order, so stop at the first unfinished copy. If
+        // block is set, wait for the oldest copy. Only the calling thread touches SLOT_GPU slots, so
+        // the lock is dropped while waiting to let the I/O thread keep freeing slots.
+        while(!m_InFlight.empty()) {
+            uint32_t index {m_InFlight.front()};
+            VkResult result;
+            if(block) {
+                VkFence fence {m_Slots[index].fence};
+                lock.unlock();
+                result = vkWaitForFences(m_Device, 1, &fence, VK_TRUE, UINT64_MAX);
+                lock.lock();
+                block = false;
+            } else {
+                result = vkGetFenceStatus(m_Device, m_Slots[index].fence);
+                if(result == VK_NOT_READY) break;
+            }
+            if(result != VK_SUCCESS) {
+                FailInFlightLocked(result);
+                return false;
+            }
+            m_InFlight.pop_front();
+            HandToIoLocked(index);
+        }
+        return true;
+    }
+
+    void ReadbackRing::FailInFlightLocked(VkResult result) {
+        // the device is lost (or out of memory), none of the pending copies will ever finish and
+        // their buffers hold nothing worth writing.
+        std::clog << "[ERROR] Waiting for a readback copy failed (" << result << "), dropping "
+                  << m_InFlight.size() << " frames" << std::endl;
+        m_DeviceLost = true;
+        for(uint32_t index : m_InFlight) m_Slots[index].state = SLOT_FREE;
+        m_Failed += m_InFlight.size();
+        m_InFlight.clear();
+        m_FreeCv.notify_all();
+    }
+
+    void ReadbackRing::HandToIoLocked(uint32_t index) {
+        Slot& slot {m_Slots[index]};
+        if(!m_Coherent) {
+            VkMappedMemoryRange range {VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, slot.memory, 0, VK_WHOLE_SIZE};
+            vkInvalidateMappedMemoryRanges(m_Device, 1, &range);
+        }
+        slot.state = SLOT_IO;
+        m_IoQueue.push_back(index);
+        m_IoCv.notify_one();
+    }
+
+    void ReadbackRing::IoThread() {
+        std::unique_lock<std::mutex> lock {m_Mutex};
+        while(true) {
+            m_IoCv.wait(lock, [this] { return m_Stop || !m_IoQueue.empty(); });
+            if(m_IoQueue.empty()) break; // stopping, and everything has been written
+
+            uint32_t index {m_IoQueue.front()};
+            m_IoQueue.pop_front();
+            const Slot& slot {m_Slots[index]};
+            ReadbackFrame frame {slot.frame_id, slot.mapped, m_Extent.width, m_Extent.height, m_RowPitch, m_Format};
+
+            // the slot belongs to this thread until it is marked free, write without the lock held.
+            lock.unlock();
+            bool ok {m_Sink->Write(frame)};
+            lock.lock();
+
+            if(ok) {
+                m_Written++;
+            } else {
+                std::clog << "[ERROR] Writing frame " << frame.frame_id << " failed" << std::endl;
+                m_Failed++;
+            }
+            m_Slots[index].state = SLOT_FREE;
+            m_FreeCv.notify_all();
+        }
+    }
+}
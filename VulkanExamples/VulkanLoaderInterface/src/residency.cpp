@@ -0,0 +1,332 @@
+/*
+    residency.cpp: Implementation of the residency policy and manager from residency.hpp.
+
+    - ResidencyPolicy makes no Vulkan calls, ResidencyManager feeds it from the device.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/residency.hpp"
+#include "vkli/deletion.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <tuple>
+
+namespace vkli {
+    namespace {
+        const uint32_t no_heap {UINT32_MAX};
+
+        VkDeviceSize Scale(VkDeviceSize size, float fraction) {
+            return static_cast<VkDeviceSize>(double(size) * fraction);
+        }
+
+        float PriorityHint(ResidencyPriority priority) {
+            switch(priority) {
+                case ResidencyPriority::Low: return 0.25f;
+                case ResidencyPriority::Normal: return 0.5f;
+                case ResidencyPriority::High: return 0.75f;
+                default: return 1.0f;
+            }
+        }
+    }
+
+    ResidencyPolicy::ResidencyPolicy(const ResidencyPolicyConfig& config) : m_Config{config}, m_NextId{1} {}
+
+    uint64_t ResidencyPolicy::Track(uint32_t heap, uint32_t home, VkDeviceSize size, ResidencyPriority priority,
+                                    bool demotable, uint64_t frame) {
+        uint64_t id {m_NextId++};
+        m_Resources[id] = {heap, home, size, priority, demotable, frame};
+        return id;
+    }
+
+    void ResidencyPolicy::Move(uint64_t resource, uint32_t heap) {
+        auto it {m_Resources.find(resource)};
+        if(it != m_Resources.end()) it->second.heap = heap;
+    }
+
+    void ResidencyPolicy::Untrack(uint64_t resource) {
+        m_Resources.erase(resource);
+    }
+
+    void ResidencyPolicy::Use(uint64_t resource, uint64_t frame) {
+        auto it {m_Resources.find(resource)};
+        if(it != m_Resources.end()) it->second.last_used = std::max(it->second.last_used, frame);
+    }
+
+    void ResidencyPolicy::SetPriority(uint64_t resource, ResidencyPriority priority) {
+        auto it {m_Resources.find(resource)};
+        if(it != m_Resources.end()) it->second.priority = priority;
+    }
+
+    bool ResidencyPolicy::Fits(const HeapSnapshot& heap, VkDeviceSize size) const {
+        return heap.usage + size <= Scale(heap.budget, m_Config.high_water);
+    }
+
+    uint32_t ResidencyPolicy::DemotionHeap(const std::vector<HeapSnapshot>& heaps, uint32_t from,
+                                           VkDeviceSize size) const {
+        for(uint32_t i = 0; i < heaps.size(); i++) {
+            if(i != from && heaps[i].host_visible && !heaps[i].device_local && Fits(heaps[i], size))
+                return i;
+        }
+        return no_heap;
+    }
+
+    std::vector<ResidencyAction> ResidencyPolicy::Plan(const std::vector<HeapSnapshot>& heaps, uint64_t frame) const {
+        std::vector<HeapSnapshot> projected {heaps};
+        std::vector<ResidencyAction> actions;
+        typedef std::pair<uint64_t, const Resource *> Entry;
+
+        // victims, heap by heap. Sorting on the id as well keeps the plan deterministic.
+        for(uint32_t h = 0; h < projected.size(); h++) {
+            HeapSnapshot& heap {projected[h]};
+            if(heap.usage <= Scale(heap.budget, m_Config.high_water)) continue;
+            std::vector<Entry> candidates;
+            for(const auto& [id, resource] : m_Resources) {
+                if(resource.heap == h && resource.priority != ResidencyPriority::Critical &&
+                   resource.last_used + m_Config.frames_in_flight <= frame)
+                    candidates.emplace_back(id, &resource);
+            }
+            std::sort(candidates.begin(), candidates.end(), [](const Entry& a, const Entry& b) {
+                return std::tie(a.second->priority, a.second->last_used, a.first) <
+                       std::tie(b.second->priority, b.second->last_used, b.first);
+            });
+
+            const VkDeviceSize target {Scale(heap.budget, m_Config.low_water)};
+            for(const auto& [id, resource] : candidates) {
+                if(heap.usage <= target) break;
+                uint32_t to {resource->demotable && heap.device_local ? DemotionHeap(projected, h, resource->size)
+                                                                      : no_heap};
+                if(to != no_heap) {
+                    actions.push_back({ResidencyAction::Demote, id, to});
+                    projected[to].usage += resource->size;
+                } else {
+                    actions.push_back({ResidencyAction::Evict, id, h});
+                }
+                heap.usage -= std::min(heap.usage, resource->size);
+            }
+        }
+
+        // demoted resources in use go home while their heap stays under high_water.
+        std::vector<Entry> demoted;
+        for(const auto& [id, resource] : m_Resources) {
+            if(resource.heap != resource.home && resource.home < projected.size() &&
+               resource.last_used + m_Config.frames_in_flight > frame &&
+               std::none_of(actions.begin(), actions.end(), [&](const ResidencyAction& a) { return a.resource == id; }))
+                demoted.emplace_back(id, &resource);
+        }
+        std::sort(demoted.begin(), demoted.end(), [](const Entry& a, const Entry& b) {
+            return std::tie(b.second->priority, b.second->last_used, a.first) <
+                   std::tie(a.second->priority, a.second->last_used, b.first);
+        });
+        for(const auto& [id, resource] : demoted) {
+            HeapSnapshot& home {projected[resource->home]};
+            if(!Fits(home, resource->size)) continue;
+            actions.push_back({ResidencyAction::Promote, id, resource->home});
+            home.usage += resource->size;
+            if(resource->heap < projected.size())
+                projected[resource->heap].usage -= std::min(projected[resource->heap].usage, resource->size);
+        }
+        return actions;
+    }
+
+    ResidencyManager::ResidencyManager(VkLoader& loader, const ResidencyConfig& config) :
+        m_Loader{loader},
+        m_Device{loader.GetDevice()},
+        m_PhysDevice{loader.GetPhysicalDevice()},
+        m_Config{config},
+        m_Policy{config.policy},
+        m_Stats{} {
+        if(m_Device == nullptr)
+            throw std::runtime_error("[ERROR] ResidencyManager needs a logical device");
+        vkGetPhysicalDeviceMemoryProperties(m_PhysDevice, &m_MemProps);
+        m_HeapUsage.assign(m_MemProps.memoryHeapCount, 0);
+        m_Retiring.assign(m_MemProps.memoryHeapCount, 0);
+    }
+
+    ResidencyManager::~ResidencyManager() {
+        if(m_Policy.Tracked() != 0)
+            std::clog << "[ERROR] ResidencyManager destroyed with " << m_Policy.Tracked()
+                      << " allocations left" << std::endl;
+    }
+
+    std::vector<HeapSnapshot> ResidencyManager::Heaps() const {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+        if(m_Config.memory_budget) {
+            VkPhysicalDeviceMemoryProperties2 props {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2, &budget};
+            vkGetPhysicalDeviceMemoryProperties2(m_PhysDevice, &props);
+        }
+
+        std::vector<HeapSnapshot> heaps(m_MemProps.memoryHeapCount);
+        for(uint32_t i = 0; i < m_MemProps.memoryHeapCount; i++) {
+            const VkMemoryHeap& heap {m_MemProps.memoryHeaps[i]};
+            if(m_Config.memory_budget) {
+                heaps[i].budget = budget.heapBudget[i];
+                heaps[i].usage = budget.heapUsage[i];
+            } else {
+                heaps[i].budget = Scale(heap.size, m_Config.own_budget);
+                heaps[i].usage = m_HeapUsage[i];
+            }
+            heaps[i].usage -= std::min(heaps[i].usage, m_Retiring[i]);
+            if(m_Config.budget_limit != 0) heaps[i].budget = std::min(heaps[i].budget, m_Config.budget_limit);
+            heaps[i].device_local = (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+            heaps[i].host_visible = false;
+        }
+        for(uint32_t i = 0; i < m_MemProps.memoryTypeCount; i++) {
+            if(m_MemProps.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+                heaps[m_MemProps.memoryTypes[i].heapIndex].host_visible = true;
+        }
+        return heaps;
+    }
+
+    uint32_t ResidencyManager::FindType(uint32_t type_bits, MemoryTarget target) const {
+        // host memory prefers a heap that is not device local, so it does not compete with device memory.
+        uint32_t fallback {UINT32_MAX};
+        for(uint32_t i = 0; i < m_MemProps.memoryTypeCount; i++) {
+            if(!(type_bits & (1u << i))) continue;
+            const VkMemoryType& type {m_MemProps.memoryTypes[i]};
+            bool device_heap {(m_MemProps.memoryHeaps[type.heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0};
+            if(target == MemoryTarget::Device) {
+                if(type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) return i;
+            } else if(type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+                if(!device_heap) return i;
+                if(fallback == UINT32_MAX) fallback = i;
+            }
+        }
+        return fallback;
+    }
+
+    bool ResidencyManager::TryAllocate(const VkMemoryRequirements& reqs, uint32_t type, ResidencyPriority priority,
+                                       ResidencyAllocation& allocation) {
+        if(type == UINT32_MAX) return false;
+        VkMemoryPriorityAllocateInfoEXT priority_info {
+            VK_STRUCTURE_TYPE_MEMORY_PRIORITY_ALLOCATE_INFO_EXT,
+            nullptr,
+            PriorityHint(priority)
+        };
+        VkMemoryAllocateInfo alloc_info {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            m_Config.memory_priority ? &priority_info : nullptr,
+            reqs.size,
+            type
+        };
+        VkDeviceMemory memory;
+        if(vkAllocateMemory(m_Device, &alloc_info, nullptr, &memory) != VK_SUCCESS) return false;
+
+        const VkMemoryType& memory_type {m_MemProps.memoryTypes[type]};
+        allocation.memory = memory;
+        allocation.size = reqs.size;
+        allocation.memory_type = type;
+        allocation.heap = memory_type.heapIndex;
+        allocation.device_local = (memory_type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+        allocation.priority = priority;
+        m_HeapUsage[memory_type.heapIndex] += reqs.size;
+        return true;
+    }
+
+    ResidencyAllocation ResidencyManager::Allocate(const VkMemoryRequirements& reqs, ResidencyPriority priority,
+                                                   bool demotable, uint64_t frame, MemoryTarget target) {
+        ResidencyAllocation allocation;
+        const uint32_t device_type {FindType(reqs.memoryTypeBits, MemoryTarget::Device)};
+        const uint32_t host_type {FindType(reqs.memoryTypeBits, MemoryTarget::Host)};
+        const uint32_t home {device_type != UINT32_MAX ? m_MemProps.memoryTypes[device_type].heapIndex : no_heap};
+
+        if(target == MemoryTarget::Host) {
+            TryAllocate(reqs, host_type, priority, allocation);
+        } else {
+            // over the budget, a demotable resource goes to host memory straight away, anything
+            // else still tries device memory and leaves it to the next Update to make room.
+            std::vector<HeapSnapshot> heaps {Heaps()};
+            bool fits {home != no_heap && m_Policy.Fits(heaps[home], reqs.size)};
+            if(fits || !demotable) TryAllocate(reqs, device_type, priority, allocation);
+            if(allocation.memory == VK_NULL_HANDLE && demotable && TryAllocate(reqs, host_type, priority, allocation))
+                m_Stats.fallbacks++;
+        }
+
+        if(allocation.memory == VK_NULL_HANDLE) {
+            std::clog << "[ERROR] Allocating " << reqs.size << " bytes of resident memory failed" << std::endl;
+            m_Stats.failed++;
+            return allocation;
+        }
+        allocation.resource = m_Policy.Track(allocation.heap, home != no_heap ? home : allocation.heap,
+                                             allocation.size, priority, demotable, frame);
+        m_Stats.allocated++;
+        return allocation;
+    }
+
+    ResidencyAllocation ResidencyManager::Move(ResidencyAllocation& from, const VkMemoryRequirements& reqs,
+                                               MemoryTarget target) {
+        ResidencyAllocation allocation;
+        if(from.resource == 0) {
+            std::clog << "[ERROR] Moving an allocation that has no resource" << std::endl;
+            return allocation;
+        }
+        if(!TryAllocate(reqs, FindType(reqs.memoryTypeBits, target), from.priority, allocation)) {
+            std::clog << "[ERROR] Moving " << reqs.size << " bytes of resident memory failed" << std::endl;
+            return allocation;
+        }
+        allocation.resource = from.resource;
+        from.resource = 0;
+        m_Retiring[from.heap] += from.size;
+        m_Policy.Move(allocation.resource, allocation.heap);
+        return allocation;
+    }
+
+    void ResidencyManager::Release(ResidencyAllocation& allocation) {
+        if(allocation.resource == 0) return;
+        m_Policy.Untrack(allocation.resource);
+        allocation.resource = 0;
+        m_Retiring[allocation.heap] += allocation.size;
+    }
+
+    void ResidencyManager::Forget(const ResidencyAllocation& allocation) {
+        if(allocation.resource != 0) m_Policy.Untrack(allocation.resource);
+        else m_Retiring[allocation.heap] -= std::min(m_Retiring[allocation.heap], allocation.size);
+        m_HeapUsage[allocation.heap] -= std::min(m_HeapUsage[allocation.heap], allocation.size);
+    }
+
+    void ResidencyManager::Free(ResidencyAllocation& allocation) {
+        if(allocation.memory != VK_NULL_HANDLE) {
+            Forget(allocation);
+            vkFreeMemory(m_Device, allocation.memory, nullptr);
+        }
+        allocation = {};
+    }
+
+    void ResidencyManager::Free(ResidencyAllocation& allocation, uint64_t retire_frame) {
+        if(allocation.memory != VK_NULL_HANDLE) {
+            Forget(allocation);
+            m_Loader.GetDeletionQueue().Push(VK_OBJECT_TYPE_DEVICE_MEMORY, reinterpret_cast<uint64_t>(allocation.memory),
+                                             retire_frame);
+        }
+        allocation = {};
+    }
+
+    void ResidencyManager::SetPriority(ResidencyAllocation& allocation, ResidencyPriority priority) {
+        allocation.priority = priority;
+        m_Policy.SetPriority(allocation.resource, priority);
+    }
+
+    std::vector<ResidencyAction> ResidencyManager::Update(uint64_t frame) {
+        std::vector<ResidencyAction> actions {m_Policy.Plan(Heaps(), frame)};
+        for(const ResidencyAction& action : actions) {
+            switch(action.kind) {
+                case ResidencyAction::Evict: m_Stats.evictions++; break;
+                case ResidencyAction::Demote: m_Stats.demotions++; break;
+                case ResidencyAction::Promote: m_Stats.promotions++; break;
+            }
+        }
+        return actions;
+    }
+}
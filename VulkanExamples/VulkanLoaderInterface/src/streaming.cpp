@@ -0,0 +1,886 @@
+/*
+    streaming.cpp: Implementation of the texture streamer from streaming.hpp.
+
+    - KTX2 and DDS parsing, image creation, and the staging batch pipeline.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/streaming.hpp"
+#include "vkli/pixelconv.hpp"
+#include "vkli-internal.hpp"
+#include "worker-pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+
+namespace vkli {
+    namespace {
+        struct BlockInfo {
+            uint32_t w, h, bytes;
+        };
+
+        BlockInfo GetBlockInfo(VkFormat format) {
+            switch(format) {
+                case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+                case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+                case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+                case VK_FORMAT_BC4_UNORM_BLOCK:
+                case VK_FORMAT_BC4_SNORM_BLOCK:
+                case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+                case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+                case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+                case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+                case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+                case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+                    return {4, 4, 8};
+                case VK_FORMAT_BC2_UNORM_BLOCK:
+                case VK_FORMAT_BC2_SRGB_BLOCK:
+                case VK_FORMAT_BC3_UNORM_BLOCK:
+                case VK_FORMAT_BC3_SRGB_BLOCK:
+                case VK_FORMAT_BC5_UNORM_BLOCK:
+                case VK_FORMAT_BC5_SNORM_BLOCK:
+                case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+                case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+                case VK_FORMAT_BC7_UNORM_BLOCK:
+                case VK_FORMAT_BC7_SRGB_BLOCK:
+                case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+                case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+                case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+                case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+                case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+                case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+                    return {4, 4, 16};
+                default:
+                    return {1, 1, helpers::FormatSize(format)};
+            }
+        }
+
+        VkFormat DxgiToVk(uint32_t dxgi) {
+            switch(dxgi) {
+                case 2:  return VK_FORMAT_R32G32B32A32_SFLOAT;
+                case 10: return VK_FORMAT_R16G16B16A16_SFLOAT;
+                case 11: return VK_FORMAT_R16G16B16A16_UNORM;
+                case 16: return VK_FORMAT_R32G32_SFLOAT;
+                case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+                case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+                case 34: return VK_FORMAT_R16G16_SFLOAT;
+                case 41: return VK_FORMAT_R32_SFLOAT;
+                case 49: return VK_FORMAT_R8G8_UNORM;
+                case 54: return VK_FORMAT_R16_SFLOAT;
+                case 56: return VK_FORMAT_R16_UNORM;
+                case 61: return VK_FORMAT_R8_UNORM;
+                case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+                case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+                case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+                case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+                case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+                case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+                case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+                case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+                case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+                case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+                case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+                case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+                case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+                case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+                case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+                case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+                default: return VK_FORMAT_UNDEFINED;
+            }
+        }
+
+        constexpr uint32_t FourCC(const char (&code)[5]) {
+            return uint32_t(uint8_t(code[0])) | uint32_t(uint8_t(code[1])) << 8 |
+                   uint32_t(uint8_t(code[2])) << 16 | uint32_t(uint8_t(code[3])) << 24;
+        }
+
+        VkFormat FourCCToVk(uint32_t fourcc) {
+            switch(fourcc) {
+                case FourCC("DXT1"): return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+                case FourCC("DXT2"):
+                case FourCC("DXT3"): return VK_FORMAT_BC2_UNORM_BLOCK;
+                case FourCC("DXT4"):
+                case FourCC("DXT5"): return VK_FORMAT_BC3_UNORM_BLOCK;
+                case FourCC("ATI1"):
+                case FourCC("BC4U"): return VK_FORMAT_BC4_UNORM_BLOCK;
+                case FourCC("BC4S"): return VK_FORMAT_BC4_SNORM_BLOCK;
+                case FourCC("ATI2"):
+                case FourCC("BC5U"): return VK_FORMAT_BC5_UNORM_BLOCK;
+                case FourCC("BC5S"): return VK_FORMAT_BC5_SNORM_BLOCK;
+                // legacy D3DFORMAT values stored in the FourCC field
+                case 36:  return VK_FORMAT_R16G16B16A16_UNORM;
+                case 113: return VK_FORMAT_R16G16B16A16_SFLOAT;
+                case 116: return VK_FORMAT_R32G32B32A32_SFLOAT;
+                default:  return VK_FORMAT_UNDEFINED;
+            }
+        }
+
+        // the 4 byte format a 3 byte format is expanded to when the device cannot sample it.
+        VkFormat ExpandedFormat(VkFormat format) {
+            switch(format) {
+                case VK_FORMAT_R8G8B8_UNORM: return VK_FORMAT_R8G8B8A8_UNORM;
+                case VK_FORMAT_R8G8B8_SRGB:  return VK_FORMAT_R8G8B8A8_SRGB;
+                case VK_FORMAT_B8G8R8_UNORM: return VK_FORMAT_B8G8R8A8_UNORM;
+                case VK_FORMAT_B8G8R8_SRGB:  return VK_FORMAT_B8G8R8A8_SRGB;
+                default: return VK_FORMAT_UNDEFINED;
+            }
+        }
+
+        // the files are little endian, and may not be aligned in the mapping.
+        template<typename T>
+        T Read(const uint8_t *p) {
+            T value;
+            std::memcpy(&value, p, sizeof(T));
+            return value;
+        }
+
+        VkExtent3D LevelExtent(VkExtent3D base, uint32_t level) {
+            return {std::max(1u, base.width >> level), std::max(1u, base.height >> level),
+                    std::max(1u, base.depth >> level)};
+        }
+
+        uint64_t LevelLayerSize(VkExtent3D extent, BlockInfo block) {
+            return uint64_t((extent.width + block.w - 1) / block.w) * ((extent.height + block.h - 1) / block.h) *
+                   extent.depth * block.bytes;
+        }
+
+        const uint8_t ktx2_identifier[12] {0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+    }
+
+    bool TextureStreamer::ParseKtx2(Texture& tex, std::string& error) {
+        const uint8_t *p {tex.file};
+        if(tex.file_size < 80) {
+            error = "is truncated";
+            return false;
+        }
+
+        uint32_t vk_format {Read<uint32_t>(p + 12)};
+        uint32_t width {Read<uint32_t>(p + 20)}, height {Read<uint32_t>(p + 24)}, depth {Read<uint32_t>(p + 28)};
+        uint32_t layer_count {Read<uint32_t>(p + 32)}, face_count {Read<uint32_t>(p + 36)};
+        uint32_t level_count {std::max(1u, Read<uint32_t>(p + 40))};
+        uint32_t supercompression {Read<uint32_t>(p + 44)};
+
+        if(supercompression != 0) {
+            error = "is supercompressed, which is not supported";
+            return false;
+        }
+        if(vk_format == VK_FORMAT_UNDEFINED) {
+            error = "needs transcoding (vkFormat is VK_FORMAT_UNDEFINED), which is not supported";
+            return false;
+        }
+        if(face_count != 1 && face_count != 6) {
+            error = "has an invalid face count";
+            return false;
+        }
+        // a height or depth of 0 marks a 1D or 2D texture, but there is no texture without a width.
+        if(width == 0) {
+            error = "has an invalid size";
+            return false;
+        }
+
+        tex.format = static_cast<VkFormat>(vk_format);
+        BlockInfo block {GetBlockInfo(tex.format)};
+        if(block.bytes == 0) {
+            error = "has an unsupported format";
+            return false;
+        }
+        tex.block_w = block.w;
+        tex.block_h = block.h;
+        tex.block_bytes = block.bytes;
+        tex.file_block_bytes = block.bytes;
+        tex.extent = {width, std::max(1u, height), std::max(1u, depth)};
+        tex.cube = face_count == 6;
+        tex.layers = std::max(1u, layer_count) * face_count;
+
+        if(tex.file_size < 80 + uint64_t(level_count) * 24) {
+            error = "is truncated";
+            return false;
+        }
+
+        // the level index starts with the base level. A level holds every layer, then every face of a layer.
+        tex.levels.resize(level_count);
+        for(uint32_t l = 0; l < level_count; l++) {
+            uint64_t offset {Read<uint64_t>(p + 80 + l * 24)};
+            uint64_t length {Read<uint64_t>(p + 88 + l * 24)};
+            Level& level {tex.levels[l]};
+            level.extent = LevelExtent(tex.extent, l);
+            level.layer_size = LevelLayerSize(level.extent, block);
+            if(level.layer_size * tex.layers != length || offset + length > tex.file_size) {
+                error = "has a truncated or malformed level " + std::to_string(l);
+                return false;
+            }
+            for(uint32_t i = 0; i < tex.layers; i++) level.layer_offsets.push_back(offset + i * level.layer_size);
+        }
+        return true;
+    }
+
+    bool TextureStreamer::ParseDds(Texture& tex, std::string& error) {
+        const uint8_t *p {tex.file};
+        if(tex.file_size < 128) {
+            error = "is truncated";
+            return false;
+        }
+
+        uint32_t flags {Read<uint32_t>(p + 8)};
+        uint32_t height {Read<uint32_t>(p + 12)}, width {Read<uint32_t>(p + 16)}, depth {Read<uint32_t>(p + 24)};
+        uint32_t mip_count {Read<uint32_t>(p + 28)};
+        uint32_t pf_flags {Read<uint32_t>(p + 80)}, fourcc {Read<uint32_t>(p + 84)}, bit_count {Read<uint32_t>(p + 88)};
+        uint32_t r_mask {Read<uint32_t>(p + 92)}, a_mask {Read<uint32_t>(p + 104)};
+        uint32_t caps2 {Read<uint32_t>(p + 112)};
+        if(width == 0 || height == 0) {
+            error = "has an invalid size";
+            return false;
+        }
+
+        uint64_t data {128};
+        uint32_t array_size {1};
+        bool cube {(caps2 & 0x200) != 0};     // DDSCAPS2_CUBEMAP
+        bool volume {(caps2 & 0x200000) != 0}; // DDSCAPS2_VOLUME
+        tex.format = VK_FORMAT_UNDEFINED;
+
+        if(pf_flags & 0x4) { // DDPF_FOURCC
+            if(fourcc == FourCC("DX10")) {
+                if(tex.file_size < 148) {
+                    error = "is truncated";
+                    return false;
+                }
+                tex.format = DxgiToVk(Read<uint32_t>(p + 128));
+                volume = Read<uint32_t>(p + 132) == 4; // D3D10_RESOURCE_DIMENSION_TEXTURE3D
+                cube = (Read<uint32_t>(p + 136) & 0x4) != 0; // D3D10_RESOURCE_MISC_TEXTURECUBE
+                array_size = std::max(1u, Read<uint32_t>(p + 140));
+                data = 148;
+            } else {
+                tex.format = FourCCToVk(fourcc);
+            }
+        } else if((pf_flags & 0x40) && (pf_flags & 0x1) && bit_count == 32 && a_mask == 0xff000000) { // DDPF_RGB | DDPF_ALPHAPIXELS
+            if(r_mask == 0x000000ff) tex.format = VK_FORMAT_R8G8B8A8_UNORM;
+            else if(r_mask == 0x00ff0000) tex.format = VK_FORMAT_B8G8R8A8_UNORM;
+        } else if((pf_flags & 0x40) && bit_count == 24) { // DDPF_RGB, D3DFMT_R8G8B8 is BGR in memory
+            if(r_mask == 0x000000ff) tex.format = VK_FORMAT_R8G8B8_UNORM;
+            else if(r_mask == 0x00ff0000) tex.format = VK_FORMAT_B8G8R8_UNORM;
+        }
+
+        BlockInfo block {GetBlockInfo(tex.format)};
+        if(tex.format == VK_FORMAT_UNDEFINED || block.bytes == 0) {
+            error = "has an unsupported pixel format";
+            return false;
+        }
+        tex.block_w = block.w;
+        tex.block_h = block.h;
+        tex.block_bytes = block.bytes;
+        tex.file_block_bytes = block.bytes;
+        tex.extent = {width, std::max(1u, height), volume ? std::max(1u, depth) : 1u};
+        tex.cube = cube;
+        tex.layers = array_size * (cube ? 6 : 1);
+
+        uint32_t level_count {(flags & 0x20000) ? std::max(1u, mip_count) : 1u}; // DDSD_MIPMAPCOUNT
+        tex.levels.resize(level_count);
+
+        // unlike KTX2, every layer holds its whole mip chain before the next layer starts.
+        uint64_t chain_size {0};
+        std::vector<uint64_t> level_starts;
+        for(uint32_t l = 0; l < level_count; l++) {
+            Level& level {tex.levels[l]};
+            level.extent = LevelExtent(tex.extent, l);
+            level.layer_size = LevelLayerSize(level.extent, block);
+            level_starts.push_back(chain_size);
+            chain_size += level.layer_size;
+        }
+        if(data + chain_size * tex.layers > tex.file_size) {
+            error = "is truncated";
+            return false;
+        }
+        for(uint32_t l = 0; l < level_count; l++) {
+            for(uint32_t i = 0; i < tex.layers; i++)
+                tex.levels[l].layer_offsets.push_back(data + i * chain_size + level_starts[l]);
+        }
+        return true;
+    }
+
+    TextureStreamer::TextureStreamer(VkLoader& loader, const StreamerConfig& config)
+        : m_Device{loader.GetDevice()}, m_PhysDevice{loader.GetPhysicalDevice()}, m_Queue{loader.GetTransferQueue()},
+          m_QueueFamily{loader.GetTransferQueueFamily()}, m_GraphicsFamily{loader.GetQueueFamily()}, m_Config{config},
+          m_CmdPool{VK_NULL_HANDLE}
+    {
+        if(m_Device == nullptr)
+            throw std::runtime_error("[ERROR] TextureStreamer needs a logical device, call CreateDevice first.");
+        m_Config.batches = std::max(1u, m_Config.batches);
+
+        // copies are split into rows, which a queue with a coarse transfer granularity cannot do.
+        if(m_QueueFamily != m_GraphicsFamily) {
+            uint32_t n_queue;
+            vkGetPhysicalDeviceQueueFamilyProperties(m_PhysDevice, &n_queue, nullptr);
+            std::vector<VkQueueFamilyProperties> queues(n_queue);
+            vkGetPhysicalDeviceQueueFamilyProperties(m_PhysDevice, &n_queue, queues.data());
+            VkExtent3D granularity {queues[m_QueueFamily].minImageTransferGranularity};
+            if(granularity.width != 1 || granularity.height != 1 || granularity.depth != 1) {
+                m_Queue = loader.GetQueue();
+                m_QueueFamily = m_GraphicsFamily;
+            }
+        }
+
+        try {
+            VkCommandPoolCreateInfo pool_info {
+                VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                nullptr,
+                VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                m_QueueFamily
+            };
+            if(vkCreateCommandPool(m_Device, &pool_info, nullptr, &m_CmdPool) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Creating the streaming command pool failed");
+
+            for(uint32_t i = 0; i < m_Config.batches; i++) {
+                m_Batches.push_back(std::make_unique<Batch>());
+                Batch& batch {*m_Batches.back()};
+
+                VkBufferCreateInfo buffer_info {
+                    VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                    nullptr,
+                    0,
+                    m_Config.batch_size,
+                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                    VK_SHARING_MODE_EXCLUSIVE,
+                    0,
+                    nullptr
+                };
+                if(vkCreateBuffer(m_Device, &buffer_info, nullptr, &batch.buffer) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Creating a staging buffer failed");
+
+                VkMemoryRequirements reqs;
+                vkGetBufferMemoryRequirements(m_Device, batch.buffer, &reqs);
+                VkMemoryAllocateInfo alloc_info {
+                    VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                    nullptr,
+                    reqs.size,
+                    helpers::FindMemoryType(m_PhysDevice, reqs.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+                };
+                if(vkAllocateMemory(m_Device, &alloc_info, nullptr, &batch.memory) != VK_SUCCESS ||
+                   vkBindBufferMemory(m_Device, batch.buffer, batch.memory, 0) != VK_SUCCESS ||
+                   vkMapMemory(m_Device, batch.memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void **>(&batch.mapped)) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Allocating staging memory failed");
+
+                VkCommandBufferAllocateInfo cmd_info {
+                    VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                    nullptr,
+                    m_CmdPool,
+                    VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                    1
+                };
+                VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
+                if(vkAllocateCommandBuffers(m_Device, &cmd_info, &batch.cmd) != VK_SUCCESS ||
+                   vkCreateFence(m_Device, &fence_info, nullptr, &batch.fence) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Creating streaming command buffers failed");
+            }
+        } catch(std::runtime_error&) {
+            Destroy();
+            throw;
+        }
+
+        m_Pool = std::make_unique<WorkerPool>(m_Config.worker_threads);
+        std::clog << "[INFO] Texture streamer using " << m_Pool->Size() << " workers and "
+                  << (m_QueueFamily == m_GraphicsFamily ? "the graphics queue" : "a dedicated transfer queue") << std::endl;
+    }
+
+    TextureStreamer::~TextureStreamer() {
+        // no worker may touch a texture or a batch past this point.
+        m_Pool.reset();
+        for(auto& batch : m_Batches) {
+            if(batch->state == BATCH_SUBMITTED) vkWaitForFences(m_Device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+        }
+        Destroy();
+    }
+
+    void TextureStreamer::Destroy() {
+        for(auto& tex : m_Textures) ReleaseTexture(tex);
+        for(auto& batch : m_Batches) {
+            if(batch->fence) vkDestroyFence(m_Device, batch->fence, nullptr);
+            if(batch->buffer) vkDestroyBuffer(m_Device, batch->buffer, nullptr);
+            if(batch->memory) vkFreeMemory(m_Device, batch->memory, nullptr);
+        }
+        if(m_CmdPool) vkDestroyCommandPool(m_Device, m_CmdPool, nullptr);
+    }
+
+    void TextureStreamer::ReleaseTexture(Texture& tex) {
+        if(tex.view) vkDestroyImageView(m_Device, tex.view, nullptr);
+        if(tex.image) vkDestroyImage(m_Device, tex.image, nullptr);
+        if(tex.memory) vkFreeMemory(m_Device, tex.memory, nullptr);
+        os::UnmapFile(tex.file, tex.file_size);
+        tex.view = VK_NULL_HANDLE;
+        tex.image = VK_NULL_HANDLE;
+        tex.memory = VK_NULL_HANDLE;
+        tex.file = nullptr;
+    }
+
+    TextureId TextureStreamer::Load(const std::string& path, float priority) {
+        TextureId id;
+        {
+            std::lock_guard<std::mutex> lock {m_Mutex};
+            id = static_cast<TextureId>(m_Textures.size());
+            m_Textures.emplace_back();
+            m_Textures.back().path = path;
+            m_Textures.back().priority = priority;
+        }
+        m_Pool->Submit([this, id] { Prepare(id); });
+        return id;
+    }
+
+    void TextureStreamer::SetPriority(TextureId id, float priority) {
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        if(id < m_Textures.size()) m_Textures[id].priority = priority;
+    }
+
+    StreamedTexture TextureStreamer::Get(TextureId id) const {
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        if(id >= m_Textures.size())
+            return {TEXTURE_FAILED, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_FORMAT_UNDEFINED, {0, 0, 0}, 0, 0, 0};
+
+        // a worker may still be filling in a loading texture.
+        const Texture& tex {m_Textures[id]};
+        if(tex.state == TEXTURE_LOADING || tex.state == TEXTURE_FAILED)
+            return {tex.state, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_FORMAT_UNDEFINED, {0, 0, 0}, 0, 0, 0};
+        return {tex.state, tex.image, tex.view, tex.format, tex.extent, static_cast<uint32_t>(tex.levels.size()),
+                tex.layers, tex.resident_level};
+    }
+
+    bool TextureStreamer::Idle() const {
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        return std::none_of(m_Textures.begin(), m_Textures.end(), [](const Texture& tex) {
+            return tex.state == TEXTURE_LOADING || tex.state == TEXTURE_STREAMING;
+        });
+    }
+
+    void TextureStreamer::Prepare(TextureId id) {
+        // runs on a worker. References into m_Textures stay valid while Load appends to it.
+        Texture *tex;
+        {
+            std::lock_guard<std::mutex> lock {m_Mutex};
+            tex = &m_Textures[id];
+        }
+
+        std::string error;
+        bool ok;
+        tex->file = os::MapFile(tex->path, tex->file_size);
+        if(tex->file == nullptr) {
+            error = "could not be opened";
+            ok = false;
+        } else if(tex->file_size >= sizeof(ktx2_identifier) &&
+                  std::memcmp(tex->file, ktx2_identifier, sizeof(ktx2_identifier)) == 0) {
+            ok = ParseKtx2(*tex, error);
+        } else if(tex->file_size >= 4 && std::memcmp(tex->file, "DDS ", 4) == 0) {
+            ok = ParseDds(*tex, error);
+        } else {
+            error = "is not a KTX2 or DDS file";
+            ok = false;
+        }
+
+        if(ok) ok = SelectFormat(*tex, error);
+        // every upload must be able to make progress, so one unit has to fit in a batch.
+        if(ok && UnitSize(*tex, 0) > m_Config.batch_size) {
+            error = "has rows larger than a staging batch";
+            ok = false;
+        }
+        if(ok) ok = CreateImage(*tex, error);
+
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        if(!ok) {
+            std::clog << "[ERROR] Texture " << tex->path << " " << error << std::endl;
+            ReleaseTexture(*tex);
+            tex->state = TEXTURE_FAILED;
+            return;
+        }
+        tex->next_level = static_cast<uint32_t>(tex->levels.size());
+        tex->resident_level = tex->next_level;
+        tex->state = TEXTURE_STREAMING;
+    }
+
+    bool TextureStreamer::SelectFormat(Texture& tex, std::string& error) const {
+        const VkFormatFeatureFlags needed {VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT};
+        auto supported = [&](VkFormat format) {
+            VkFormatProperties format_props;
+            vkGetPhysicalDeviceFormatProperties(m_PhysDevice, format, &format_props);
+            return (format_props.optimalTilingFeatures & needed) == needed;
+        };
+        if(supported(tex.format)) return true;
+
+        // few devices can sample 3 byte texels, those get an alpha channel while they are staged.
+        const VkFormat expanded {ExpandedFormat(tex.format)};
+        if(expanded == VK_FORMAT_UNDEFINED || !supported(expanded)) {
+            error = "has a format the device cannot sample";
+            return false;
+        }
+        tex.format = expanded;
+        tex.block_bytes = 4;
+        return true;
+    }
+
+    bool TextureStreamer::CreateImage(Texture& tex, std::string& error) {
+        const VkImageType type {tex.extent.depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D};
+        const VkImageUsageFlags usage {VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT};
+        const VkImageCreateFlags flags {tex.cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0u};
+        const uint32_t n_levels {static_cast<uint32_t>(tex.levels.size())};
+
+        VkImageFormatProperties image_props;
+        if(vkGetPhysicalDeviceImageFormatProperties(m_PhysDevice, tex.format, type, VK_IMAGE_TILING_OPTIMAL,
+                                                    usage, flags, &image_props) != VK_SUCCESS ||
+           tex.extent.width > image_props.maxExtent.width || tex.extent.height > image_props.maxExtent.height ||
+           tex.extent.depth > image_props.maxExtent.depth || n_levels > image_props.maxMipLevels ||
+           tex.layers > image_props.maxArrayLayers) {
+            error = "is larger than the device supports";
+            return false;
+        }
+
+        // uploads happen on the transfer queue, sampling on the graphics queue.
+        const uint32_t families[2] {m_GraphicsFamily, m_QueueFamily};
+        const bool concurrent {m_GraphicsFamily != m_QueueFamily};
+
+        VkImageCreateInfo image_info {
+            VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            nullptr,
+            flags,
+            type,
+            tex.format,
+            tex.extent,
+            n_levels,
+            tex.layers,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_TILING_OPTIMAL,
+            usage,
+            concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+            concurrent ? 2u : 0u,
+            concurrent ? families : nullptr,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        };
+        if(vkCreateImage(m_Device, &image_info, nullptr, &tex.image) != VK_SUCCESS) {
+            error = "image creation failed";
+            return false;
+        }
+
+        VkMemoryRequirements reqs;
+        vkGetImageMemoryRequirements(m_Device, tex.image, &reqs);
+        try {
+            VkMemoryAllocateInfo alloc_info {
+                VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                nullptr,
+                reqs.size,
+                helpers::FindMemoryType(m_PhysDevice, reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+            };
+            if(vkAllocateMemory(m_Device, &alloc_info, nullptr, &tex.memory) != VK_SUCCESS ||
+               vkBindImageMemory(m_Device, tex.image, tex.memory, 0) != VK_SUCCESS) {
+                error = "memory allocation failed";
+                return false;
+            }
+        } catch(std::runtime_error& e) {
+            error = e.what();
+            return false;
+        }
+
+        VkImageViewType view_type;
+        if(type == VK_IMAGE_TYPE_3D) view_type = VK_IMAGE_VIEW_TYPE_3D;
+        else if(tex.cube) view_type = tex.layers > 6 ? VK_IMAGE_VIEW_TYPE_CUBE_ARRAY : VK_IMAGE_VIEW_TYPE_CUBE;
+        else view_type = tex.layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+
+        VkImageViewCreateInfo view_info {
+            VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            nullptr,
+            0,
+            tex.image,
+            view_type,
+            tex.format,
+            {}, // identity swizzle
+            {VK_IMAGE_ASPECT_COLOR_BIT, 0, n_levels, 0, tex.layers}
+        };
+        if(vkCreateImageView(m_Device, &view_info, nullptr, &tex.view) != VK_SUCCESS) {
+            error = "image view creation failed";
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t TextureStreamer::UnitSize(const Texture& tex, uint32_t level) const {
+        const VkExtent3D& extent {tex.levels[level].extent};
+        uint64_t row {uint64_t((extent.width + tex.block_w - 1) / tex.block_w) * tex.block_bytes};
+        return tex.extent.depth > 1 ? row * ((extent.height + tex.block_h - 1) / tex.block_h) : row;
+    }
+
+    uint64_t TextureStreamer::StagingLayerSize(const Texture& tex, uint32_t level) const {
+        return tex.levels[level].layer_size / tex.file_block_bytes * tex.block_bytes;
+    }
+
+    uint32_t TextureStreamer::UnitCount(const Texture& tex, uint32_t level) const {
+        const VkExtent3D& extent {tex.levels[level].extent};
+        return tex.extent.depth > 1 ? extent.depth : (extent.height + tex.block_h - 1) / tex.block_h;
+    }
+
+    void TextureStreamer::Update() {
+        Retire();
+
+        // batches must be submitted in the order they were filled, the upload cursors assume it.
+        while(!m_Filling.empty() && m_Filling.front()->pending_copies.load(std::memory_order_acquire) == 0) {
+            Batch *batch {m_Filling.front()};
+            m_Filling.pop_front();
+            if(SubmitBatch(*batch)) {
+                m_Submitted.push_back(batch);
+            } else {
+                std::clog << "[ERROR] Submitting a texture upload batch failed" << std::endl;
+                std::lock_guard<std::mutex> lock {m_Mutex};
+                for(const auto& copy : batch->copies) m_Textures[copy.id].state = TEXTURE_FAILED;
+                batch->state = BATCH_FREE;
+            }
+        }
+
+        for(auto& batch : m_Batches) {
+            if(batch->state == BATCH_FREE) {
+                if(FillBatch(*batch)) {
+                    batch->state = BATCH_FILLING;
+                    m_Filling.push_back(batch.get());
+                }
+                break;
+            }
+        }
+    }
+
+    void TextureStreamer::Retire() {
+        // in submission order, so a texture's levels become resident coarsest first. A later batch
+        // whose fence has signalled waits for the earlier ones.
+        while(!m_Submitted.empty() && vkGetFenceStatus(m_Device, m_Submitted.front()->fence) == VK_SUCCESS) {
+            Batch *batch {m_Submitted.front()};
+            m_Submitted.pop_front();
+
+            std::lock_guard<std::mutex> lock {m_Mutex};
+            for(const auto& [id, level] : batch->completes) {
+                Texture& tex {m_Textures[id]};
+                // the resident level only ever moves towards 0.
+                if(level >= tex.resident_level) continue;
+                tex.resident_level = level;
+                if(level == 0 && tex.state == TEXTURE_STREAMING) {
+                    // every copy out of the mapping has finished.
+                    tex.state = TEXTURE_RESIDENT;
+                    os::UnmapFile(tex.file, tex.file_size);
+                    tex.file = nullptr;
+                }
+            }
+            batch->state = BATCH_FREE;
+        }
+    }
+
+    bool TextureStreamer::FillBatch(Batch& batch) {
+        batch.used = 0;
+        batch.copies.clear();
+        batch.completes.clear();
+        const VkDeviceSize capacity {m_Config.batch_size};
+
+        while(true) {
+            // the highest priority texture with levels left, preferring smaller levels on a tie.
+            Texture *tex {nullptr};
+            TextureId id {0};
+            {
+                std::lock_guard<std::mutex> lock {m_Mutex};
+                for(TextureId i = 0; i < m_Textures.size(); i++) {
+                    Texture& t {m_Textures[i]};
+                    if(t.state != TEXTURE_STREAMING || t.next_level == 0) continue;
+                    if(!tex || t.priority > tex->priority || (t.priority == tex->priority && t.next_level > tex->next_level)) {
+                        tex = &t;
+                        id = i;
+                    }
+                }
+            }
+            if(!tex) break;
+
+            const uint32_t n_levels {static_cast<uint32_t>(tex->levels.size())};
+            const VkDeviceSize align {std::lcm<VkDeviceSize>(16, tex->block_bytes)};
+            auto align_up = [align](VkDeviceSize offset) { return (offset + align - 1) / align * align; };
+
+            // nothing uploaded yet: the mip tail goes first, as one unit.
+            if(tex->next_level == n_levels && tex->next_layer == 0 && tex->next_unit == 0) {
+                uint32_t tail {n_levels};
+                while(tail > 0 && StagingLayerSize(*tex, tail - 1) * tex->layers <= m_Config.tail_size) tail--;
+
+                VkDeviceSize end {batch.used};
+                for(uint32_t l = tail; l < n_levels; l++)
+                    end = align_up(end) + StagingLayerSize(*tex, l) * tex->layers;
+
+                if(tail < n_levels && end <= capacity) {
+                    for(uint32_t l = tail; l < n_levels; l++) {
+                        for(uint32_t layer = 0; layer < tex->layers; layer++) {
+                            VkDeviceSize offset {align_up(batch.used)};
+                            batch.copies.push_back({id, l, layer, 0, UnitCount(*tex, l), offset});
+                            batch.used = offset + StagingLayerSize(*tex, l);
+                        }
+                    }
+                    tex->next_level = tail;
+                    batch.completes.push_back({id, tail});
+                    continue;
+                }
+                // a tail that does not even fit an empty batch is streamed level by level instead.
+                if(tail < n_levels && batch.used > 0) break;
+            }
+
+            const uint32_t level {tex->next_level - 1};
+            const uint64_t unit_size {UnitSize(*tex, level)};
+            const uint32_t units {UnitCount(*tex, level)};
+            const VkDeviceSize offset {align_up(batch.used)};
+            const uint64_t fit {offset < capacity ? (capacity - offset) / unit_size : 0};
+            if(fit == 0) break; // Prepare made sure a unit fits in an empty batch
+
+            const uint32_t count {static_cast<uint32_t>(std::min<uint64_t>(fit, units - tex->next_unit))};
+            batch.copies.push_back({id, level, tex->next_layer, tex->next_unit, count, offset});
+            batch.used = offset + count * unit_size;
+
+            tex->next_unit += count;
+            if(tex->next_unit == units) {
+                tex->next_unit = 0;
+                if(++tex->next_layer == tex->layers) {
+                    tex->next_layer = 0;
+                    tex->next_level = level;
+                    batch.completes.push_back({id, level});
+                }
+            }
+        }
+
+        if(batch.copies.empty()) return false;
+
+        // copy out of the mappings on the workers, the page faults of a cold file happen there too.
+        batch.pending_copies.store(static_cast<uint32_t>(batch.copies.size()), std::memory_order_relaxed);
+        for(const auto& copy : batch.copies) {
+            const Texture *tex;
+            {
+                std::lock_guard<std::mutex> lock {m_Mutex};
+                tex = &m_Textures[copy.id];
+            }
+            const uint64_t unit_size {UnitSize(*tex, copy.level)};
+            const uint64_t file_unit_size {unit_size / tex->block_bytes * tex->file_block_bytes};
+            const uint8_t *src {tex->file + tex->levels[copy.level].layer_offsets[copy.layer] + copy.unit_begin * file_unit_size};
+            uint8_t *dst {batch.mapped + copy.staging_offset};
+            const size_t bytes {static_cast<size_t>(copy.unit_count * unit_size)};
+            const bool expand {tex->file_block_bytes != tex->block_bytes};
+            Batch *target {&batch};
+            m_Pool->Submit([src, dst, bytes, expand, target] {
+                if(expand) ExpandRgbToRgba(src, dst, bytes / 4);
+                else std::memcpy(dst, src, bytes);
+                target->pending_copies.fetch_sub(1, std::memory_order_release);
+            });
+        }
+        return true;
+    }
+
+    bool TextureStreamer::SubmitBatch(Batch& batch) {
+        if(vkResetFences(m_Device, 1, &batch.fence) != VK_SUCCESS ||
+           vkResetCommandBuffer(batch.cmd, 0) != VK_SUCCESS)
+            return false;
+
+        VkCommandBufferBeginInfo begin_info {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            nullptr,
+            VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            nullptr
+        };
+        if(vkBeginCommandBuffer(batch.cmd, &begin_info) != VK_SUCCESS)
+            return false;
+
+        // every (texture, level) written by the batch goes to TRANSFER_DST and back to SHADER_READ_ONLY.
+        // The first batch of a texture moves the whole image out of UNDEFINED instead.
+        std::vector<VkImageMemoryBarrier> to_dst, to_read;
+        std::vector<std::pair<TextureId, uint32_t>> seen;
+        std::lock_guard<std::mutex> lock {m_Mutex};
+        for(const auto& copy : batch.copies) {
+            Texture& tex {m_Textures[copy.id]};
+            const uint32_t n_levels {static_cast<uint32_t>(tex.levels.size())};
+            VkImageMemoryBarrier barrier {
+                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                nullptr,
+                0,
+                VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                tex.image,
+                {VK_IMAGE_ASPECT_COLOR_BIT, copy.level, 1, 0, tex.layers}
+            };
+            if(!tex.initialised) {
+                barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                barrier.subresourceRange.baseMipLevel = 0;
+                barrier.subresourceRange.levelCount = n_levels;
+                tex.initialised = true;
+                seen.push_back({copy.id, UINT32_MAX}); // whole image
+            } else if(std::find(seen.begin(), seen.end(), std::make_pair(copy.id, copy.level)) != seen.end() ||
+                      std::find(seen.begin(), seen.end(), std::make_pair(copy.id, UINT32_MAX)) != seen.end()) {
+                continue;
+            } else {
+                seen.push_back({copy.id, copy.level});
+            }
+            to_dst.push_back(barrier);
+
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            to_read.push_back(barrier);
+        }
+
+        vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, static_cast<uint32_t>(to_dst.size()), to_dst.data());
+
+        for(const auto& copy : batch.copies) {
+            const Texture& tex {m_Textures[copy.id]};
+            const VkExtent3D& extent {tex.levels[copy.level].extent};
+            VkBufferImageCopy region {
+                copy.staging_offset,
+                0, // row length, 0 = tightly packed
+                0, // image height, 0 = tightly packed
+                {VK_IMAGE_ASPECT_COLOR_BIT, copy.level, copy.layer, 1},
+                {0, 0, 0},
+                extent
+            };
+            if(tex.extent.depth > 1) {
+                region.imageOffset.z = static_cast<int32_t>(copy.unit_begin);
+                region.imageExtent.depth = copy.unit_count;
+            } else {
+                uint32_t y {copy.unit_begin * tex.block_h};
+                region.imageOffset.y = static_cast<int32_t>(y);
+                region.imageExtent.height = std::min(copy.unit_count * tex.block_h, extent.height - y);
+            }
+            vkCmdCopyBufferToImage(batch.cmd, batch.buffer, tex.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        }
+
+        // the graphics queue only samples a level after the fence shows it is resident.
+        vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr, 0, nullptr, static_cast<uint32_t>(to_read.size()), to_read.data());
+
+        if(vkEndCommandBuffer(batch.cmd) != VK_SUCCESS)
+            return false;
+
+        VkSubmitInfo submit_info {
+            VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            nullptr,
+            0,
+            nullptr,
+            nullptr,
+            1,
+            &batch.cmd,
+            0,
+            nullptr
+        };
+        if(vkQueueSubmit(m_Queue, 1, &submit_info, batch.fence) != VK_SUCCESS)
+            return false;
+
+        batch.state = BATCH_SUBMITTED;
+        return true;
+    }
+}
@@ -0,0 +1,559 @@
+/*
+    virtualtexture.cpp: Implementation of the sparse virtual texture from virtualtexture.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/virtualtexture.hpp"
+#include "vkli-internal.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+namespace vkli {
+    namespace {
+        // pages are allocated in chunks, so a big pool does not need one huge allocation.
+        const uint32_t pages_per_chunk {256};
+
+        const VkImageUsageFlags image_usage {VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+
+        VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        void BindAndWait(VkDevice dev, VkQueue queue, const VkBindSparseInfo& bind_info) {
+            VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
+            VkFence fence;
+            if(vkCreateFence(dev, &fence_info, nullptr, &fence) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Fence creation failed");
+            bool ok {vkQueueBindSparse(queue, 1, &bind_info, fence) == VK_SUCCESS &&
+                     vkWaitForFences(dev, 1, &fence, VK_TRUE, UINT64_MAX) == VK_SUCCESS};
+            vkDestroyFence(dev, fence, nullptr);
+            if(!ok)
+                throw std::runtime_error("[ERROR] Binding the virtual texture's mip tail failed");
+        }
+    }
+
+    void VirtualTexture::RequireFeatures(DeviceFeatures& features) {
+        features.core.sparseBinding = VK_TRUE;
+        features.core.sparseResidencyImage2D = VK_TRUE;
+        features.core.shaderResourceResidency = VK_TRUE;
+        features.queue_flags |= VK_QUEUE_SPARSE_BINDING_BIT;
+    }
+
+    VirtualTexture::VirtualTexture(VkLoader& loader, PageProvider& provider, const VirtualTextureConfig& config)
+        : m_Device{loader.GetDevice()}, m_PhysDevice{loader.GetPhysicalDevice()}, m_Queue{loader.GetQueue()},
+          m_QueueFamily{loader.GetQueueFamily()}, m_Provider{provider}, m_Config{config}, m_Info{}, m_Stats{},
+          m_TexelSize{helpers::FormatSize(config.format)}, m_TileBytes{0}, m_MemoryType{0}, m_ShaderStages{0},
+          m_Image{VK_NULL_HANDLE}, m_View{VK_NULL_HANDLE}, m_Sampler{VK_NULL_HANDLE}, m_TailMemory{VK_NULL_HANDLE},
+          m_TileCount{0}, m_Slot{0}, m_Frame{0}
+    {
+        if(m_Device == nullptr)
+            throw std::runtime_error("[ERROR] VirtualTexture needs a logical device, call CreateDevice first.");
+        if(m_TexelSize == 0)
+            throw std::runtime_error("[ERROR] VirtualTexture needs an uncompressed colour format");
+        if(config.extent.width == 0 || config.extent.height == 0 || config.pool_pages == 0 ||
+           config.max_uploads_per_frame == 0 || config.frames_in_flight == 0)
+            throw std::runtime_error("[ERROR] VirtualTexture configuration has a zero size or count");
+
+        uint32_t n_families;
+        vkGetPhysicalDeviceQueueFamilyProperties(m_PhysDevice, &n_families, nullptr);
+        std::vector<VkQueueFamilyProperties> families(n_families);
+        vkGetPhysicalDeviceQueueFamilyProperties(m_PhysDevice, &n_families, families.data());
+        VkQueueFlags queue_flags {families[m_QueueFamily].queueFlags};
+        if(!(queue_flags & VK_QUEUE_SPARSE_BINDING_BIT))
+            throw std::runtime_error("[ERROR] VirtualTexture needs a queue with sparse binding, see RequireFeatures");
+        m_ShaderStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        if(queue_flags & VK_QUEUE_GRAPHICS_BIT) m_ShaderStages |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+        uint32_t n_props {0};
+        vkGetPhysicalDeviceSparseImageFormatProperties(m_PhysDevice, config.format, VK_IMAGE_TYPE_2D, VK_SAMPLE_COUNT_1_BIT,
+                                                       image_usage, VK_IMAGE_TILING_OPTIMAL, &n_props, nullptr);
+        if(n_props == 0)
+            throw std::runtime_error("[ERROR] VirtualTexture format cannot be used for sparse resident images");
+
+        uint32_t full_chain {static_cast<uint32_t>(std::bit_width(std::max(config.extent.width, config.extent.height)))};
+        m_Info.width = config.extent.width;
+        m_Info.height = config.extent.height;
+        m_Info.levels = config.levels ? std::min(config.levels, full_chain) : full_chain;
+
+        try {
+            VkImageCreateInfo image_info {
+                VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                nullptr,
+                VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT,
+                VK_IMAGE_TYPE_2D,
+                config.format,
+                {config.extent.width, config.extent.height, 1},
+                m_Info.levels,
+                1,
+                VK_SAMPLE_COUNT_1_BIT,
+                VK_IMAGE_TILING_OPTIMAL,
+                image_usage,
+                VK_SHARING_MODE_EXCLUSIVE,
+                0,
+                nullptr,
+                VK_IMAGE_LAYOUT_UNDEFINED
+            };
+            if(vkCreateImage(m_Device, &image_info, nullptr, &m_Image) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Virtual texture image creation failed, it may exceed the sparse address space");
+
+            VkMemoryRequirements reqs;
+            vkGetImageMemoryRequirements(m_Device, m_Image, &reqs);
+            m_MemoryType = helpers::FindMemoryType(m_PhysDevice, reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            m_Stats.page_size = reqs.alignment;
+            m_Stats.virtual_size = reqs.size;
+
+            uint32_t n_sparse_reqs;
+            vkGetImageSparseMemoryRequirements(m_Device, m_Image, &n_sparse_reqs, nullptr);
+            std::vector<VkSparseImageMemoryRequirements> sparse_reqs(n_sparse_reqs);
+            vkGetImageSparseMemoryRequirements(m_Device, m_Image, &n_sparse_reqs, sparse_reqs.data());
+            auto colour {std::find_if(sparse_reqs.begin(), sparse_reqs.end(), [](const VkSparseImageMemoryRequirements& r) {
+                return (r.formatProperties.aspectMask & VK_IMAGE_ASPECT_COLOR_BIT) != 0;
+            })};
+            if(colour == sparse_reqs.end())
+                throw std::runtime_error("[ERROR] Virtual texture image has no sparse colour aspect");
+
+            // the tile grid of every level below the mip tail, and where its feedback bits start.
+            const VkExtent3D granularity {colour->formatProperties.imageGranularity};
+            m_Info.tile_width = granularity.width;
+            m_Info.tile_height = granularity.height;
+            m_Info.sparse_levels = std::min(colour->imageMipTailFirstLod, m_Info.levels);
+            if(m_Info.sparse_levels > 16)
+                throw std::runtime_error("[ERROR] Virtual texture has more than 16 levels below its mip tail");
+            m_TileBytes = VkDeviceSize{granularity.width} * granularity.height * m_TexelSize;
+            if(m_TileBytes > m_Stats.page_size)
+                throw std::runtime_error("[ERROR] Virtual texture tiles are larger than a sparse page");
+            for(uint32_t level = 0; level < m_Info.sparse_levels; level++) {
+                uint32_t width {std::max(m_Info.width >> level, 1u)}, height {std::max(m_Info.height >> level, 1u)};
+                m_Info.level_tiles[level][0] = m_TileCount;
+                m_Info.level_tiles[level][1] = (width + granularity.width - 1) / granularity.width;
+                m_Info.level_tiles[level][2] = (height + granularity.height - 1) / granularity.height;
+                m_TileCount += m_Info.level_tiles[level][1] * m_Info.level_tiles[level][2];
+            }
+            m_TilePages.assign(m_TileCount, none);
+
+            CreatePool();
+
+            m_Frames.resize(config.frames_in_flight);
+            VkDeviceSize feedback_size {std::max<VkDeviceSize>((m_TileCount + 31) / 32, 1) * sizeof(uint32_t)};
+            VkSemaphoreCreateInfo semaphore_info {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr, 0};
+            for(Frame& frame : m_Frames) {
+                void *mapped;
+                helpers::CreateBuffer(m_Device, m_PhysDevice, feedback_size,
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                      frame.feedback, frame.feedback_memory);
+                if(vkMapMemory(m_Device, frame.feedback_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Mapping a virtual texture feedback buffer failed");
+                std::memset(mapped, 0, feedback_size);
+                frame.feedback_bits = static_cast<const uint32_t *>(mapped);
+
+                helpers::CreateBuffer(m_Device, m_PhysDevice, config.max_uploads_per_frame * m_TileBytes,
+                                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                      frame.staging, frame.staging_memory);
+                if(vkMapMemory(m_Device, frame.staging_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Mapping a virtual texture staging buffer failed");
+                frame.staging_data = static_cast<uint8_t *>(mapped);
+
+                if(vkCreateSemaphore(m_Device, &semaphore_info, nullptr, &frame.bound) != VK_SUCCESS ||
+                   vkCreateSemaphore(m_Device, &semaphore_info, nullptr, &frame.released) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Virtual texture semaphore creation failed");
+            }
+
+            VkImageViewCreateInfo view_info {
+                VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                nullptr,
+                0,
+                m_Image,
+                VK_IMAGE_VIEW_TYPE_2D,
+                config.format,
+                {},
+                {VK_IMAGE_ASPECT_COLOR_BIT, 0, m_Info.levels, 0, 1}
+            };
+            if(vkCreateImageView(m_Device, &view_info, nullptr, &m_View) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Virtual texture view creation failed");
+
+            VkSamplerCreateInfo sampler_info {
+                VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+                nullptr,
+                0,
+                VK_FILTER_LINEAR,
+                VK_FILTER_LINEAR,
+                VK_SAMPLER_MIPMAP_MODE_LINEAR,
+                VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                0.0f,
+                VK_FALSE,
+                1.0f,
+                VK_FALSE,
+                VK_COMPARE_OP_ALWAYS,
+                0.0f,
+                static_cast<float>(m_Info.levels),
+                VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+                VK_FALSE
+            };
+            if(vkCreateSampler(m_Device, &sampler_info, nullptr, &m_Sampler) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Virtual texture sampler creation failed");
+
+            InitialiseTail(sparse_reqs);
+        } catch(std::runtime_error&) {
+            Destroy();
+            throw;
+        }
+        m_Stats.resident_pages = 0;
+        std::clog << "[INFO] Virtual texture of " << m_Info.width << "x" << m_Info.height << " created, "
+                  << m_TileCount << " tiles, " << config.pool_pages << " pages of " << m_Stats.page_size
+                  << " bytes" << std::endl;
+    }
+
+    VirtualTexture::~VirtualTexture() {
+        // binds and copies may still be in flight on the queue.
+        vkQueueWaitIdle(m_Queue);
+        Destroy();
+    }
+
+    void VirtualTexture::Destroy() {
+        for(Frame& frame : m_Frames) {
+            if(frame.bound) vkDestroySemaphore(m_Device, frame.bound, nullptr);
+            if(frame.released) vkDestroySemaphore(m_Device, frame.released, nullptr);
+            if(frame.staging) vkDestroyBuffer(m_Device, frame.staging, nullptr);
+            if(frame.staging_memory) vkFreeMemory(m_Device, frame.staging_memory, nullptr);
+            if(frame.feedback) vkDestroyBuffer(m_Device, frame.feedback, nullptr);
+            if(frame.feedback_memory) vkFreeMemory(m_Device, frame.feedback_memory, nullptr);
+        }
+        m_Frames.clear();
+        m_Released.clear();
+        if(m_Sampler) vkDestroySampler(m_Device, m_Sampler, nullptr);
+        if(m_View) vkDestroyImageView(m_Device, m_View, nullptr);
+        if(m_Image) vkDestroyImage(m_Device, m_Image, nullptr);
+        if(m_TailMemory) vkFreeMemory(m_Device, m_TailMemory, nullptr);
+        for(VkDeviceMemory chunk : m_Chunks) vkFreeMemory(m_Device, chunk, nullptr);
+        m_Chunks.clear();
+        m_Sampler = VK_NULL_HANDLE;
+        m_View = VK_NULL_HANDLE;
+        m_Image = VK_NULL_HANDLE;
+        m_TailMemory = VK_NULL_HANDLE;
+    }
+
+    void VirtualTexture::CreatePool() {
+        for(uint32_t first = 0; first < m_Config.pool_pages; first += pages_per_chunk) {
+            uint32_t pages {std::min(pages_per_chunk, m_Config.pool_pages - first)};
+            VkMemoryAllocateInfo alloc_info {
+                VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                nullptr,
+                pages * m_Stats.page_size,
+                m_MemoryType
+            };
+            VkDeviceMemory chunk;
+            if(vkAllocateMemory(m_Device, &alloc_info, nullptr, &chunk) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Allocating the virtual texture page pool failed");
+            m_Chunks.push_back(chunk);
+        }
+        m_Pages.assign(m_Config.pool_pages, Page{none, 0, m_Lru.end()});
+        // handed out from the back, page 0 first.
+        for(uint32_t page = m_Config.pool_pages; page-- > 0;) m_FreePages.push_back(page);
+    }
+
+    void VirtualTexture::InitialiseTail(const std::vector<VkSparseImageMemoryRequirements>& sparse_reqs) {
+        // the mip tail (a single one, there is only one layer) and any metadata are always bound.
+        std::vector<VkSparseMemoryBind> binds;
+        VkDeviceSize tail_size {0};
+        for(const auto& req : sparse_reqs) {
+            bool metadata {(req.formatProperties.aspectMask & VK_IMAGE_ASPECT_METADATA_BIT) != 0};
+            if(!metadata && req.imageMipTailFirstLod >= m_Info.levels)
+                continue;
+            binds.push_back({req.imageMipTailOffset, req.imageMipTailSize, VK_NULL_HANDLE, tail_size,
+                             metadata ? VkSparseMemoryBindFlags{VK_SPARSE_MEMORY_BIND_METADATA_BIT} : 0});
+            tail_size += AlignUp(req.imageMipTailSize, m_Stats.page_size);
+        }
+        if(!binds.empty()) {
+            VkMemoryAllocateInfo alloc_info {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO, nullptr, tail_size, m_MemoryType};
+            if(vkAllocateMemory(m_Device, &alloc_info, nullptr, &m_TailMemory) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Allocating the virtual texture's mip tail failed");
+            for(auto& bind : binds) bind.memory = m_TailMemory;
+            VkSparseImageOpaqueMemoryBindInfo opaque {m_Image, static_cast<uint32_t>(binds.size()), binds.data()};
+            VkBindSparseInfo bind_info {VK_STRUCTURE_TYPE_BIND_SPARSE_INFO};
+            bind_info.imageOpaqueBindCount = 1;
+            bind_info.pImageOpaqueBinds = &opaque;
+            BindAndWait(m_Device, m_Queue, bind_info);
+        }
+
+        // the levels of the tail come from the provider straight away.
+        std::vector<VkBufferImageCopy> copies;
+        VkDeviceSize staging_size {0};
+        for(uint32_t level = m_Info.sparse_levels; level < m_Info.levels; level++) {
+            VkExtent3D extent {std::max(m_Info.width >> level, 1u), std::max(m_Info.height >> level, 1u), 1};
+            copies.push_back({staging_size, 0, 0, {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1}, {0, 0, 0}, extent});
+            // copies must start at a whole texel.
+            staging_size += AlignUp(VkDeviceSize{extent.width} * extent.height * m_TexelSize, 4 * m_TexelSize);
+        }
+        VkBuffer staging {VK_NULL_HANDLE};
+        VkDeviceMemory staging_memory {VK_NULL_HANDLE};
+        try {
+            if(!copies.empty()) {
+                helpers::CreateBuffer(m_Device, m_PhysDevice, staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                      staging, staging_memory);
+                void *mapped;
+                if(vkMapMemory(m_Device, staging_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Mapping the mip tail staging buffer failed");
+                for(const auto& copy : copies) {
+                    if(!m_Provider.Fill(copy.imageSubresource.mipLevel, {0, 0},
+                                        {copy.imageExtent.width, copy.imageExtent.height},
+                                        static_cast<uint8_t *>(mapped) + copy.bufferOffset))
+                        throw std::runtime_error("[ERROR] The page provider failed to fill the mip tail");
+                }
+            }
+
+            helpers::ImmediateSubmit(m_Device, m_Queue, m_QueueFamily, [&](VkCommandBuffer cmd) {
+                VkImageMemoryBarrier to_general {
+                    VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                    nullptr,
+                    0,
+                    VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED,
+                    VK_IMAGE_LAYOUT_GENERAL,
+                    VK_QUEUE_FAMILY_IGNORED,
+                    VK_QUEUE_FAMILY_IGNORED,
+                    m_Image,
+                    {VK_IMAGE_ASPECT_COLOR_BIT, 0, m_Info.levels, 0, 1}
+                };
+                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                     0, nullptr, 0, nullptr, 1, &to_general);
+                if(!copies.empty())
+                    vkCmdCopyBufferToImage(cmd, staging, m_Image, VK_IMAGE_LAYOUT_GENERAL,
+                                           static_cast<uint32_t>(copies.size()), copies.data());
+                VkMemoryBarrier to_shaders {
+                    VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    nullptr,
+                    VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_ACCESS_SHADER_READ_BIT
+                };
+                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, m_ShaderStages, 0,
+                                     1, &to_shaders, 0, nullptr, 0, nullptr);
+            });
+        } catch(std::runtime_error&) {
+            if(staging) vkDestroyBuffer(m_Device, staging, nullptr);
+            if(staging_memory) vkFreeMemory(m_Device, staging_memory, nullptr);
+            throw;
+        }
+        if(staging) vkDestroyBuffer(m_Device, staging, nullptr);
+        if(staging_memory) vkFreeMemory(m_Device, staging_memory, nullptr);
+    }
+
+    void VirtualTexture::TileRegion(uint32_t tile, uint32_t& level, VkOffset3D& offset, VkExtent3D& extent) const {
+        level = 0;
+        while(level + 1 < m_Info.sparse_levels && tile >= m_Info.level_tiles[level + 1][0]) level++;
+        uint32_t index {tile - m_Info.level_tiles[level][0]};
+        uint32_t x {index % m_Info.level_tiles[level][1] * m_Info.tile_width};
+        uint32_t y {index / m_Info.level_tiles[level][1] * m_Info.tile_height};
+        offset = {static_cast<int32_t>(x), static_cast<int32_t>(y), 0};
+        // tiles at the right and bottom edges end with the level.
+        extent = {
+            std::min(m_Info.tile_width, std::max(m_Info.width >> level, 1u) - x),
+            std::min(m_Info.tile_height, std::max(m_Info.height >> level, 1u) - y),
+            1
+        };
+    }
+
+    uint32_t VirtualTexture::ParentTile(uint32_t tile) const {
+        uint32_t level;
+        VkOffset3D offset;
+        VkExtent3D extent;
+        TileRegion(tile, level, offset, extent);
+        if(level + 1 >= m_Info.sparse_levels)
+            return none;
+        const uint32_t *parent {m_Info.level_tiles[level + 1]};
+        uint32_t x {std::min(static_cast<uint32_t>(offset.x) / 2 / m_Info.tile_width, parent[1] - 1)};
+        uint32_t y {std::min(static_cast<uint32_t>(offset.y) / 2 / m_Info.tile_height, parent[2] - 1)};
+        return parent[0] + y * parent[1] + x;
+    }
+
+    VkSparseImageMemoryBind VirtualTexture::TileBind(uint32_t tile, uint32_t page) const {
+        uint32_t level;
+        VkOffset3D offset;
+        VkExtent3D extent;
+        TileRegion(tile, level, offset, extent);
+        VkSparseImageMemoryBind bind {{VK_IMAGE_ASPECT_COLOR_BIT, level, 0}, offset, extent, VK_NULL_HANDLE, 0, 0};
+        if(page != none) {
+            bind.memory = m_Chunks[page / pages_per_chunk];
+            bind.memoryOffset = (page % pages_per_chunk) * m_Stats.page_size;
+        }
+        return bind;
+    }
+
+    void VirtualTexture::Touch(uint32_t page) {
+        Page& p {m_Pages[page]};
+        p.last_used = m_Frame;
+        if(p.lru == m_Lru.end()) p.lru = m_Lru.insert(m_Lru.end(), page);
+        else m_Lru.splice(m_Lru.end(), m_Lru, p.lru);
+    }
+
+    uint32_t VirtualTexture::AcquirePage(uint32_t& evicted) {
+        evicted = none;
+        if(!m_FreePages.empty()) {
+            uint32_t page {m_FreePages.back()};
+            m_FreePages.pop_back();
+            return page;
+        }
+        // the least recently used page is the only candidate, if it is too recent every page is.
+        if(m_Lru.empty() || m_Pages[m_Lru.front()].last_used + m_Config.frames_in_flight >= m_Frame)
+            return none;
+        uint32_t page {m_Lru.front()};
+        Page& p {m_Pages[page]};
+        m_Lru.pop_front();
+        p.lru = m_Lru.end();
+        evicted = p.tile;
+        m_TilePages[evicted] = none;
+        p.tile = none;
+        return page;
+    }
+
+    VkSemaphore VirtualTexture::Update(uint32_t slot) {
+        if(slot >= m_Frames.size()) {
+            std::clog << "[ERROR] Virtual texture slot " << slot << " is not below frames_in_flight" << std::endl;
+            return VK_NULL_HANDLE;
+        }
+        m_Slot = slot;
+        m_Frame++;
+        m_Copies.clear();
+        Frame& frame {m_Frames[slot]};
+
+        // every requested tile, and the tiles above it so coarser fallbacks become resident too.
+        std::vector<uint32_t> wanted;
+        const uint32_t words {(m_TileCount + 31) / 32};
+        for(uint32_t word = 0; word < words; word++) {
+            for(uint32_t bits {frame.feedback_bits[word]}; bits; bits &= bits - 1) {
+                uint32_t tile {word * 32 + static_cast<uint32_t>(std::countr_zero(bits))};
+                if(tile < m_TileCount) wanted.push_back(tile);
+            }
+        }
+        for(size_t i = 0; i < wanted.size(); i++) {
+            uint32_t parent {ParentTile(wanted[i])};
+            if(parent != none) wanted.push_back(parent);
+        }
+        // coarser levels have higher tile numbers, so they come first.
+        std::sort(wanted.begin(), wanted.end(), std::greater<uint32_t>());
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+
+        m_Stats.requested = static_cast<uint32_t>(wanted.size());
+        m_Stats.uploaded = 0;
+        m_Stats.evicted = 0;
+        m_Stats.missing = 0;
+
+        // touch everything still wanted first, so none of it is evicted for the missing tiles.
+        for(uint32_t tile : wanted)
+            if(m_TilePages[tile] != none) Touch(m_TilePages[tile]);
+
+        std::vector<VkSparseImageMemoryBind> binds;
+        std::vector<uint32_t> new_tiles;
+        for(uint32_t tile : wanted) {
+            if(m_TilePages[tile] != none)
+                continue;
+            uint32_t evicted;
+            uint32_t page {m_Stats.uploaded < m_Config.max_uploads_per_frame ? AcquirePage(evicted) : none};
+            if(page == none) {
+                m_Stats.missing++;
+                continue;
+            }
+            if(evicted != none) {
+                binds.push_back(TileBind(evicted, none));
+                m_Stats.evicted++;
+            }
+
+            uint32_t level;
+            VkOffset3D offset;
+            VkExtent3D extent;
+            TileRegion(tile, level, offset, extent);
+            VkDeviceSize staging_offset {m_Stats.uploaded * m_TileBytes};
+            if(!m_Provider.Fill(level, {offset.x, offset.y}, {extent.width, extent.height},
+                                frame.staging_data + staging_offset)) {
+                m_FreePages.push_back(page);
+                m_Stats.missing++;
+                continue;
+            }
+            binds.push_back(TileBind(tile, page));
+            m_Copies.push_back({staging_offset, 0, 0, {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1}, offset, extent});
+            m_TilePages[tile] = page;
+            m_Pages[page].tile = tile;
+            Touch(page);
+            new_tiles.push_back(tile);
+            m_Stats.uploaded++;
+        }
+        m_Stats.resident_pages = static_cast<uint32_t>(m_Lru.size());
+
+        // frames still in flight may sample any resident tile, requested or not, so the bind waits
+        // until they have finished. It runs even with nothing to bind, every frame's release has
+        // to be waited on before its submit can signal it again.
+        VkSparseImageMemoryBindInfo image_binds {m_Image, static_cast<uint32_t>(binds.size()), binds.data()};
+        VkBindSparseInfo bind_info {VK_STRUCTURE_TYPE_BIND_SPARSE_INFO};
+        bind_info.waitSemaphoreCount = static_cast<uint32_t>(m_Released.size());
+        bind_info.pWaitSemaphores = m_Released.data();
+        bind_info.imageBindCount = binds.empty() ? 0 : 1;
+        bind_info.pImageBinds = &image_binds;
+        bind_info.signalSemaphoreCount = 1;
+        bind_info.pSignalSemaphores = &frame.bound;
+        if(vkQueueBindSparse(m_Queue, 1, &bind_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+            std::clog << "[ERROR] Binding virtual texture pages failed" << std::endl;
+            // the new tiles are not resident after all. Evicted tiles stay evicted, whether or not
+            // they were unbound, nothing samples them without requesting them again.
+            for(uint32_t tile : new_tiles) {
+                uint32_t page {m_TilePages[tile]};
+                m_Lru.erase(m_Pages[page].lru);
+                m_Pages[page] = {none, 0, m_Lru.end()};
+                m_TilePages[tile] = none;
+                m_FreePages.push_back(page);
+            }
+            m_Copies.clear();
+            m_Stats.missing += m_Stats.uploaded;
+            m_Stats.uploaded = 0;
+            m_Stats.resident_pages = static_cast<uint32_t>(m_Lru.size());
+            // nothing was waited on, the next bind waits for this frame's release as well.
+            m_Released.push_back(frame.released);
+            return VK_NULL_HANDLE;
+        }
+        m_Released.assign(1, frame.released);
+        return frame.bound;
+    }
+
+    void VirtualTexture::RecordBegin(VkCommandBuffer cmd) const {
+        const Frame& frame {m_Frames[m_Slot]};
+        // the bind waited for earlier frames, but anything recorded before RecordBegin may still
+        // sample the memory the new tiles go to.
+        VkMemoryBarrier before {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, 0, VK_ACCESS_TRANSFER_WRITE_BIT};
+        vkCmdPipelineBarrier(cmd, m_ShaderStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &before, 0, nullptr, 0, nullptr);
+        if(!m_Copies.empty())
+            vkCmdCopyBufferToImage(cmd, frame.staging, m_Image, VK_IMAGE_LAYOUT_GENERAL,
+                                   static_cast<uint32_t>(m_Copies.size()), m_Copies.data());
+        vkCmdFillBuffer(cmd, frame.feedback, 0, VK_WHOLE_SIZE, 0);
+        VkMemoryBarrier after {
+            VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            nullptr,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, m_ShaderStages, 0, 1, &after, 0, nullptr, 0, nullptr);
+    }
+
+    void VirtualTexture::RecordEnd(VkCommandBuffer cmd) const {
+        VkMemoryBarrier to_host {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT};
+        vkCmdPipelineBarrier(cmd, m_ShaderStages, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &to_host, 0, nullptr, 0, nullptr);
+    }
+}
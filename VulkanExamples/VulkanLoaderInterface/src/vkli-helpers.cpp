@@ -20,9 +20,26 @@
 #include "vkli-internal.hpp"
 
 #include <stdexcept>
+#include <cstddef> // offsetof
 #include <cstring> // memcpy
+#include <future>
 
 namespace vkli {
+    namespace {
+        // Vulkan feature structs are plain arrays of VkBool32 after their (optional) sType/pNext header.
+        template<typename T>
+        bool BoolsSubset(const T& requested, const T& supported, size_t first) {
+            const auto *req = reinterpret_cast<const VkBool32 *>(reinterpret_cast<const char *>(&requested) + first);
+            const auto *sup = reinterpret_cast<const VkBool32 *>(reinterpret_cast<const char *>(&supported) + first);
+            for(size_t i = 0; i < (sizeof(T) - first) / sizeof(VkBool32); i++) {
+                if(req[i] && !sup[i]) return false;
+            }
+            return true;
+        }
+
+        constexpr size_t v12_first_bool {offsetof(VkPhysicalDeviceVulkan12Features, samplerMirrorClampToEdge)};
+    }
+
     namespace helpers {
         void LoadGlobalLevelFunctions() {
             #define LOAD_GLOBAL_FUNC(fun) \
@@ -67,7 +84,9 @@ namespace vkli {
             if(vkEnumeratePhysicalDevices(inst, &n_dev, info.devices.data()) != VK_SUCCESS)
                 throw std::runtime_error("[ERROR] Detecting physical devices failed");
 
-            for(int i = 0; i < n_dev; i++) {
+            // the queries of different devices are independent, with several devices (e.g. a GPU and a
+            // software ICD) they run in parallel.
+            const auto query_device = [&info](uint32_t i) {
                 vkGetPhysicalDeviceProperties(info.devices[i], &info.dev_props[i]);
                 vkGetPhysicalDeviceFeatures(info.devices[i], &info.dev_feat[i]);
 
@@ -84,6 +103,14 @@ namespace vkli {
                 info.dev_exts[i].resize(n_ext);
                 if(vkEnumerateDeviceExtensionProperties(info.devices[i], nullptr, &n_ext, info.dev_exts[i].data()) != VK_SUCCESS)
                     throw std::runtime_error("[ERROR] Detecting physical device extensions failed");
+            };
+            if(n_dev == 1) {
+                query_device(0);
+            } else {
+                std::vector<std::future<void>> queries;
+                for(uint32_t i = 0; i < n_dev; i++) queries.push_back(std::async(std::launch::async, query_device, i));
+                // get rethrows the first error, the remaining futures still wait for their queries.
+                for(auto& query : queries) query.get();
             }
         }
 
@@ -103,6 +130,185 @@ namespace vkli {
             return true; 
         }
 
+        bool RequestsAnyFeature(const VkPhysicalDeviceVulkan12Features& features) {
+            VkPhysicalDeviceVulkan12Features none {};
+            return !BoolsSubset(features, none, v12_first_bool);
+        }
+
+        bool SupportsFeatures(VkPhysicalDevice dev, const VkPhysicalDeviceProperties& props, 
+                              const DeviceFeatures& features) {
+            bool need_v12 {RequestsAnyFeature(features.v12)};
+            // vkGetPhysicalDeviceFeatures2 and the 1.2 feature struct need a device of that version.
+            if(need_v12 && props.apiVersion < VK_API_VERSION_1_2) return false;
+
+            VkPhysicalDeviceVulkan12Features v12 {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+            VkPhysicalDeviceFeatures2 features2 {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+            if(need_v12) {
+                features2.pNext = &v12;
+                vkGetPhysicalDeviceFeatures2(dev, &features2);
+            } else {
+                vkGetPhysicalDeviceFeatures(dev, &features2.features);
+            }
+
+            return BoolsSubset(features.core, features2.features, 0) &&
+                   (!need_v12 || BoolsSubset(features.v12, v12, v12_first_bool));
+        }
+
+        bool EnablesTimelineSemaphores(const VkDeviceCreateInfo& create_info) {
+            for(auto next {static_cast<const VkBaseInStructure *>(create_info.pNext)}; next; next = next->pNext) {
+                if(next->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES &&
+                   reinterpret_cast<const VkPhysicalDeviceVulkan12Features *>(next)->timelineSemaphore)
+                    return true;
+                if(next->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES &&
+                   reinterpret_cast<const VkPhysicalDeviceTimelineSemaphoreFeatures *>(next)->timelineSemaphore)
+                    return true;
+            }
+            return false;
+        }
+
+        uint32_t FindMemoryType(VkPhysicalDevice dev, uint32_t type_bits, VkMemoryPropertyFlags props) {
+            VkPhysicalDeviceMemoryProperties mem_props;
+            vkGetPhysicalDeviceMemoryProperties(dev, &mem_props);
+            for(uint32_t i = 0; i < mem_props.memoryTypeCount; i++) {
+                if((type_bits & (1u << i)) && (mem_props.memoryTypes[i].propertyFlags & props) == props)
+                    return i;
+            }
+            throw std::runtime_error("[ERROR] No suitable memory type found");
+        }
+
+        void CreateBuffer(VkDevice dev, VkPhysicalDevice pdev, VkDeviceSize size, VkBufferUsageFlags usage,
+                          VkMemoryPropertyFlags props, VkBuffer& buffer, VkDeviceMemory& memory) {
+            VkBufferCreateInfo buffer_info {
+                VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                nullptr,
+                0,
+                size,
+                usage,
+                VK_SHARING_MODE_EXCLUSIVE,
+                0,
+                nullptr
+            };
+            if(vkCreateBuffer(dev, &buffer_info, nullptr, &buffer) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Buffer creation failed");
+
+            VkMemoryRequirements reqs;
+            vkGetBufferMemoryRequirements(dev, buffer, &reqs);
+            try {
+                VkMemoryAllocateInfo alloc_info {
+                    VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                    nullptr,
+                    reqs.size,
+                    FindMemoryType(pdev, reqs.memoryTypeBits, props)
+                };
+                if(vkAllocateMemory(dev, &alloc_info, nullptr, &memory) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Buffer memory allocation failed");
+            } catch(std::runtime_error&) {
+                vkDestroyBuffer(dev, buffer, nullptr);
+                buffer = VK_NULL_HANDLE;
+                throw;
+            }
+            if(vkBindBufferMemory(dev, buffer, memory, 0) != VK_SUCCESS) {
+                vkDestroyBuffer(dev, buffer, nullptr);
+                vkFreeMemory(dev, memory, nullptr);
+                buffer = VK_NULL_HANDLE;
+                memory = VK_NULL_HANDLE;
+                throw std::runtime_error("[ERROR] Binding buffer memory failed");
+            }
+        }
+
+        void ImmediateSubmit(VkDevice dev, VkQueue queue, uint32_t queue_family,
+                             const std::function<void(VkCommandBuffer)>& record) {
+            VkCommandPoolCreateInfo pool_info {
+                VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                nullptr,
+                VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                queue_family
+            };
+            VkCommandPool pool;
+            if(vkCreateCommandPool(dev, &pool_info, nullptr, &pool) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Creating a transient command pool failed");
+
+            VkCommandBufferAllocateInfo cmd_info {
+                VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                nullptr,
+                pool,
+                VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                1
+            };
+            VkCommandBufferBeginInfo begin_info {
+                VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                nullptr,
+                VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                nullptr
+            };
+            VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
+            VkCommandBuffer cmd;
+            VkFence fence {VK_NULL_HANDLE};
+            bool ok {vkAllocateCommandBuffers(dev, &cmd_info, &cmd) == VK_SUCCESS &&
+                     vkBeginCommandBuffer(cmd, &begin_info) == VK_SUCCESS};
+            if(ok) {
+                record(cmd);
+                VkSubmitInfo submit_info {VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr, 0, nullptr, nullptr, 1, &cmd, 0, nullptr};
+                ok = vkEndCommandBuffer(cmd) == VK_SUCCESS &&
+                     vkCreateFence(dev, &fence_info, nullptr, &fence) == VK_SUCCESS &&
+                     vkQueueSubmit(queue, 1, &submit_info, fence) == VK_SUCCESS &&
+                     vkWaitForFences(dev, 1, &fence, VK_TRUE, UINT64_MAX) == VK_SUCCESS;
+            }
+            if(fence) vkDestroyFence(dev, fence, nullptr);
+            vkDestroyCommandPool(dev, pool, nullptr);
+            if(!ok) throw std::runtime_error("[ERROR] Immediate command submission failed");
+        }
+
+        VkShaderModule CreateShaderModule(VkDevice dev, const uint32_t *code, size_t size) {
+            VkShaderModuleCreateInfo module_info {
+                VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+                nullptr,
+                0,
+                size, // bytes
+                code
+            };
+            VkShaderModule module;
+            if(vkCreateShaderModule(dev, &module_info, nullptr, &module) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Shader module creation failed");
+            return module;
+        }
+
+        uint32_t FormatSize(VkFormat format) {
+            switch(format) {
+                case VK_FORMAT_R8_UNORM:
+                case VK_FORMAT_R8_SRGB:
+                    return 1;
+                case VK_FORMAT_R8G8_UNORM:
+                case VK_FORMAT_R16_UNORM:
+                case VK_FORMAT_R16_SFLOAT:
+                    return 2;
+                case VK_FORMAT_R8G8B8_UNORM:
+                case VK_FORMAT_R8G8B8_SRGB:
+                case VK_FORMAT_B8G8R8_UNORM:
+                case VK_FORMAT_B8G8R8_SRGB:
+                    return 3;
+                case VK_FORMAT_R8G8B8A8_UNORM:
+                case VK_FORMAT_R8G8B8A8_SRGB:
+                case VK_FORMAT_B8G8R8A8_UNORM:
+                case VK_FORMAT_B8G8R8A8_SRGB:
+                case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+                case VK_FORMAT_R16G16_SFLOAT:
+                case VK_FORMAT_R32_SFLOAT:
+                case VK_FORMAT_R32_UINT:
+                    return 4;
+                case VK_FORMAT_R16G16B16A16_UNORM:
+                case VK_FORMAT_R16G16B16A16_SFLOAT:
+                case VK_FORMAT_R32G32_SFLOAT:
+                    return 8;
+                case VK_FORMAT_R32G32B32_SFLOAT:
+                    return 12;
+                case VK_FORMAT_R32G32B32A32_SFLOAT:
+                    return 16;
+                default:
+                    return 0;
+            }
+        }
+
         bool LoadSwapchainDFPs(DeviceFPs& dfps) {
             #define LOAD_DFP(dfps, fun) reinterpret_cast<PFN_##fun>(vkGetDeviceProcAddr(dfps.dev, #fun))
             dfps.vkCreateSwapchainKHR = LOAD_DFP(dfps, vkCreateSwapchainKHR);
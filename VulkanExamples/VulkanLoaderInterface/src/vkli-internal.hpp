@@ -17,8 +17,12 @@
 #pragma once
 
 #include "vkli/vkli.hpp"
+#include "vkli/helpers.hpp"
 #include "GLFW/glfw3.h"
 
+#include <cstdint>
+#include <functional>
+#include <string>
 #include <vector>
 #include <memory>
 #include <iostream>
@@ -27,6 +31,9 @@
 namespace vkli {
     namespace os {
         void LoadEntrypoint();
+        // read only memory map of a whole file, returns nullptr on failure or for empty files.
+        const uint8_t *MapFile(const std::string& path, size_t& size);
+        void UnmapFile(const uint8_t *addr, size_t size);
     }
 
     namespace helpers {
@@ -36,5 +43,18 @@ namespace vkli {
         void GetDevices(VkInstance& inst, InstanceInfo& info);
         bool GetSwapchainInfo(VkPhysicalDevice& dev, VkSurfaceKHR& surface,SwapchainInfo& info);
         bool LoadSwapchainDFPs(DeviceFPs& dfps);
+        bool RequestsAnyFeature(const VkPhysicalDeviceVulkan12Features& features);
+        bool SupportsFeatures(VkPhysicalDevice dev, const VkPhysicalDeviceProperties& props, 
+                              const DeviceFeatures& features);
+        // whether the pNext chain of create_info enables the timelineSemaphore feature.
+        bool EnablesTimelineSemaphores(const VkDeviceCreateInfo& create_info);
+        // these two throw std::runtime_error on failure, and leave nothing behind when they do.
+        void CreateBuffer(VkDevice dev, VkPhysicalDevice pdev, VkDeviceSize size, VkBufferUsageFlags usage,
+                          VkMemoryPropertyFlags props, VkBuffer& buffer, VkDeviceMemory& memory);
+        // records with record, submits to queue and waits for the work to finish.
+        void ImmediateSubmit(VkDevice dev, VkQueue queue, uint32_t queue_family,
+                             const std::function<void(VkCommandBuffer)>& record);
+        // bytes per texel of uncompressed formats, 0 for formats vkli does not handle.
+        uint32_t FormatSize(VkFormat format);
     }
 }
\ No newline at end of file
@@ -18,7 +18,9 @@
 
 #include "vkli-internal.hpp"
 #include "vkli/vkli.hpp"
+#include "vkli/deletion.hpp"
 
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
@@ -30,7 +32,8 @@
 #include "vkli/vkapi.hpp"
 
 namespace vkli {
-    VkLoader::VkLoader() : m_Surface{nullptr}, m_Instance{nullptr} {
+    VkLoader::VkLoader() : m_Surface{nullptr}, m_Instance{nullptr}, m_Device{nullptr}, m_Queue{nullptr}, m_TransferQueue{nullptr},
+                           m_Window{nullptr}, m_TerminateGlfw{true} {
         glfwInit();
         os::LoadEntrypoint();
         helpers::LoadGlobalLevelFunctions();
@@ -38,12 +41,66 @@ namespace vkli {
         std::clog << "[INFO] Vulkan Loader initialisation successful" << std::endl;
     }
 
+    VkLoader::VkLoader(DeferredInit) : m_Surface{nullptr}, m_Instance{nullptr}, m_Device{nullptr}, m_Queue{nullptr},
+                                       m_TransferQueue{nullptr}, m_Window{nullptr}, m_TerminateGlfw{false} {
+        os::LoadEntrypoint();
+        helpers::LoadGlobalLevelFunctions();
+    }
+
+    std::future<std::unique_ptr<VkLoader>> VkLoader::CreateAsync(LoaderConfig config) {
+        if(glfwInit() != GLFW_TRUE)
+            throw std::runtime_error("[ERROR] Async initialisation, GLFW initialisation failed");
+        try {
+            return std::async(std::launch::async, [config = std::move(config)]() mutable {
+                auto start {std::chrono::steady_clock::now()};
+                std::unique_ptr<VkLoader> loader;
+                try {
+                    loader.reset(new VkLoader(DeferredInit{}));
+                } catch(std::runtime_error& e) {
+                    throw std::runtime_error(std::string{"[ERROR] Async initialisation, finding the loader: "} + e.what());
+                }
+
+                // the layer and extension lists are already given, so enumerating them for m_ldrinfo
+                // can run next to instance creation, which spends most of its time loading the drivers.
+                auto loader_info {std::async(std::launch::async, [&loader] { loader->InitLoaderInfo(); })};
+                bool instance_ok {loader->CreateInstance(config.layers, config.instance_extensions, config.app_info)};
+                try {
+                    loader_info.get();
+                } catch(std::runtime_error& e) {
+                    throw std::runtime_error(std::string{"[ERROR] Async initialisation, enumerating layers and extensions: "} + e.what());
+                }
+                if(!instance_ok)
+                    throw std::runtime_error("[ERROR] Async initialisation, instance creation failed");
+                if(!loader->CreateDevice(config.device_extensions, &config.features))
+                    throw std::runtime_error("[ERROR] Async initialisation, device creation failed");
+
+                // from here on the loader belongs to the caller, on the main thread.
+                loader->m_TerminateGlfw = true;
+                std::clog << "[INFO] Async initialisation done in " << std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+                return loader;
+            });
+        } catch(...) {
+            glfwTerminate();
+            throw;
+        }
+    }
+
+    void TerminateGlfw() {
+        glfwTerminate();
+    }
+
     VkLoader::~VkLoader() {
         // temporary
-        if(m_Device) vkDestroyDevice(m_Device, nullptr);
+        if(m_Device) {
+            // the GPU may still be using objects in the deletion queue.
+            vkDeviceWaitIdle(m_Device);
+            m_DeletionQueue.reset();
+            vkDestroyDevice(m_Device, nullptr);
+        }
         if(m_Surface) vkDestroySurfaceKHR(m_Instance, *m_Surface, nullptr);
         if(m_Instance) vkDestroyInstance(m_Instance, nullptr);
-        glfwTerminate();
+        if(m_TerminateGlfw) glfwTerminate();
     }
 
     bool VkLoader::CreateInstance(VkInstanceCreateInfo& create_info) {
@@ -149,15 +206,17 @@ namespace vkli {
         if(vkCreateDevice(pdev, &create_info, nullptr, &m_Device) != VK_SUCCESS) {
             return false;
         }
+        m_DeletionQueue = std::make_unique<DeletionQueue>(m_Device, helpers::EnablesTimelineSemaphores(create_info));
         std::clog << "[INFO] Logical device creation successful" << std::endl;
         return true;
     }
 
-    bool VkLoader::CreateDevice(std::vector<std::string>& extensions) {
-        // check whether given extensions are supported on any physical devices:
+    bool VkLoader::CreateDevice(std::vector<std::string>& extensions, const DeviceFeatures *features) {
+        // check whether given extensions and features are supported on any physical devices:
 
-        std::vector<int> capable_device_indeces, capable_qf_indices;
+        std::vector<int> capable_device_indeces;
         std::string failed_extension;
+        bool failed_features = false;
         for(int i = 0; i < m_instinfo.n_dev; i++) {
             bool all_supported = true;
             for(const auto& ext : extensions) {
@@ -174,25 +233,54 @@ namespace vkli {
                     break;
                 }
             }
+            if(all_supported && features && !helpers::SupportsFeatures(m_instinfo.devices[i], 
+                                                                       m_instinfo.dev_props[i], *features)) {
+                all_supported = false;
+                failed_features = true;
+            }
             if(all_supported) {
                 capable_device_indeces.push_back(i);
             }
         }
          
         if(capable_device_indeces.empty()) {
-            std::clog << "[ERROR] No physical device supports the device extension " << failed_extension << std::endl;
+            if(failed_features)
+                std::clog << "[ERROR] No physical device supports the requested device features" << std::endl;
+            else
+                std::clog << "[ERROR] No physical device supports the device extension " << failed_extension << std::endl;
             return false;
         }
 
-        // check queue families. 
+        // check queue families, the queue family index must belong to the device that is used.
+        // Without graphics, a family that lacks it is preferred (usually an async compute engine),
+        // a graphics family that supports the rest will still do.
+        const VkQueueFlags queue_flags {features ? features->queue_flags : VkQueueFlags{VK_QUEUE_GRAPHICS_BIT}};
+        int device_index = -1, qf_index = -1;
         for(int i : capable_device_indeces) {
+            int fallback_index = -1;
             for(int index = 0; index < m_instinfo.dev_queue[i].size(); index++) {
-                if(m_instinfo.dev_queue[i][index].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                    capable_qf_indices.push_back(index);
+                VkQueueFlags flags {m_instinfo.dev_queue[i][index].queueFlags};
+                if((flags & queue_flags) != queue_flags)
+                    continue;
+                if(!(queue_flags & VK_QUEUE_GRAPHICS_BIT) && (flags & VK_QUEUE_GRAPHICS_BIT)) {
+                    if(fallback_index < 0) fallback_index = index;
+                    continue;
                 }
+                qf_index = index;
+                break;
+            }
+            if(qf_index < 0) qf_index = fallback_index;
+            if(qf_index >= 0) {
+                device_index = i;
+                break;
             }
         }
 
+        if(device_index < 0) {
+            std::clog << "[ERROR] No capable physical device has a queue family with the requested queue flags" << std::endl;
+            return false;
+        }
+
         // create the logical device.
         std::vector<const char *> c_extensions;
         for(const auto& ext : extensions) {
@@ -201,32 +289,67 @@ namespace vkli {
 
         std::vector<float> q_priorities{1.0f};  
 
-        // !!!!! FOR NOW JUST USE THE FIRST CAPABLE DEVICE, ONLY USE ONE QUEUE !!!!!
-        VkDeviceQueueCreateInfo queue_info {
+        // a transfer only family is usually backed by a DMA engine, streaming uploads go there if it exists.
+        int transfer_qf_index = qf_index;
+        for(int index = 0; index < m_instinfo.dev_queue[device_index].size(); index++) {
+            VkQueueFlags flags {m_instinfo.dev_queue[device_index][index].queueFlags};
+            if((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                transfer_qf_index = index;
+                break;
+            }
+        }
+
+        // !!!!! FOR NOW JUST USE THE FIRST CAPABLE DEVICE, ONE QUEUE PER FAMILY !!!!!
+        std::vector<VkDeviceQueueCreateInfo> queue_infos {{
             VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             nullptr,
             0,
-            static_cast<uint32_t>(capable_qf_indices[0]), // index of q family 
+            static_cast<uint32_t>(qf_index), // index of q family 
             static_cast<uint32_t>(q_priorities.size()),   // number of qs to create in q family
             q_priorities.data()
-        };
+        }};
+        if(transfer_qf_index != qf_index) {
+            queue_infos.push_back(queue_infos[0]);
+            queue_infos[1].queueFamilyIndex = static_cast<uint32_t>(transfer_qf_index);
+        }
+
+        // features are passed through VkPhysicalDeviceFeatures2 so the 1.2 and extension features
+        // can be chained on.
+        VkPhysicalDeviceVulkan12Features v12_features {};
+        VkPhysicalDeviceFeatures2 features2 {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+        if(features) {
+            features2.features = features->core;
+            features2.pNext = features->next;
+            if(helpers::RequestsAnyFeature(features->v12)) {
+                v12_features = features->v12;
+                v12_features.pNext = features->next;
+                features2.pNext = &v12_features;
+            }
+        }
 
         VkDeviceCreateInfo create_info {
             VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-            nullptr,
+            features ? &features2 : nullptr,
             0,
-            1, // queue families
-            &queue_info, // queue families
+            static_cast<uint32_t>(queue_infos.size()), // queue families
+            queue_infos.data(), // queue families
             0, // layers (deprecated)
             nullptr, // layers (deprecated)
             static_cast<uint32_t>(c_extensions.size()),
             c_extensions.data(),
-            nullptr // features
+            nullptr // features, given in pNext instead
         };
     
         // !!!!! FOR NOW JUST USE THE FIRST CAPABLE DEVICE !!!!!
-        m_PhysDevice = m_instinfo.devices[capable_device_indeces[0]];
-        return CreateDevice(create_info, m_PhysDevice);
+        m_PhysDevice = m_instinfo.devices[device_index];
+        if(!CreateDevice(create_info, m_PhysDevice))
+            return false;
+
+        m_QueueFamily = static_cast<uint32_t>(qf_index);
+        vkGetDeviceQueue(m_Device, m_QueueFamily, 0, &m_Queue);
+        m_TransferQueueFamily = static_cast<uint32_t>(transfer_qf_index);
+        vkGetDeviceQueue(m_Device, m_TransferQueueFamily, 0, &m_TransferQueue);
+        return true;
     }
 
     void VkLoader::FillFromPriorityLists(std::vector<std::string>& output, 
@@ -252,9 +375,15 @@ namespace vkli {
     }
 
     bool VkLoader::CreateSurface() {
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        GLFWwindow *window {glfwCreateWindow(1000, 1000, "window", nullptr, nullptr)};
+        return window && CreateSurface(window);
+    }
+
+    bool VkLoader::CreateSurface(GLFWwindow *window) {
         // TEMPORARY FIX
         VkSurfaceKHR *surface = new VkSurfaceKHR;
-        m_Window = glfwCreateWindow(1000, 1000, "window", nullptr, nullptr);
+        m_Window = window;
         if(glfwCreateWindowSurface(m_Instance, m_Window, nullptr, surface) != VK_SUCCESS)
             return false; 
         m_Surface = surface;
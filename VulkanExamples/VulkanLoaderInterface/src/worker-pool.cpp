@@ -0,0 +1,59 @@
+/*
+    worker-pool.cpp: Implementation of the worker thread pool from worker-pool.hpp.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "worker-pool.hpp"
+
+#include <algorithm>
+
+namespace vkli {
+    WorkerPool::WorkerPool(unsigned n_threads) : m_Stop{false} {
+        if(n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+        for(unsigned i = 0; i < n_threads; i++) {
+            m_Threads.emplace_back(&WorkerPool::Run, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock {m_Mutex};
+            m_Stop = true;
+        }
+        m_Cv.notify_all();
+        for(auto& thread : m_Threads) thread.join();
+    }
+
+    void WorkerPool::Submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock {m_Mutex};
+            m_Jobs.push_back(std::move(job));
+        }
+        m_Cv.notify_one();
+    }
+
+    void WorkerPool::Run() {
+        std::unique_lock<std::mutex> lock {m_Mutex};
+        while(true) {
+            m_Cv.wait(lock, [this] { return m_Stop || !m_Jobs.empty(); });
+            if(m_Jobs.empty()) return; // stopping, and the queue is drained
+
+            std::function<void()> job {std::move(m_Jobs.front())};
+            m_Jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+}
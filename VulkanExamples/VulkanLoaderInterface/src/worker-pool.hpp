@@ -0,0 +1,48 @@
+/*
+    worker-pool.hpp: A fixed size pool of worker threads for vkli's background jobs.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vkli {
+    class WorkerPool {
+        public:
+            // n_threads == 0 uses one thread per hardware thread.
+            WorkerPool(unsigned n_threads = 0);
+            // finishes every submitted job before returning.
+            ~WorkerPool();
+            WorkerPool(const WorkerPool&) = delete;
+            WorkerPool& operator=(const WorkerPool&) = delete;
+
+            // jobs run in submission order, but may finish in any order.
+            void Submit(std::function<void()> job);
+            unsigned Size() const { return static_cast<unsigned>(m_Threads.size()); }
+        private:
+            void Run();
+        private:
+            std::mutex m_Mutex;
+            std::condition_variable m_Cv;
+            std::deque<std::function<void()>> m_Jobs;
+            bool m_Stop;
+            std::vector<std::thread> m_Threads;
+    };
+}
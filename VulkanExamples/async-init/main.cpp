@@ -0,0 +1,161 @@
+/*
+    async-init: Measures the time from program start to having a logical device, a window and the
+    application's assets, first with VkLoader's blocking calls one after the other, then with
+    VkLoader::CreateAsync overlapping them.
+
+    usage: async-init [runs] [asset files...]
+
+    Without asset files a fixed amount of CPU work stands in for asset loading. A window is only
+    created if a display is available.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/vkli.hpp"
+#include "GLFW/glfw3.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    double Ms(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    // reads and checksums every file, or hashes 64MB of generated data if there are none.
+    uint64_t LoadAssets(const std::vector<std::string>& files) {
+        uint64_t hash {14695981039346656037ull};
+        const auto mix = [&hash](uint8_t byte) { hash = (hash ^ byte) * 1099511628211ull; };
+        if(files.empty()) {
+            for(uint32_t i = 0; i < (64u << 20); i++) mix(static_cast<uint8_t>(i * 2654435761u >> 24));
+            return hash;
+        }
+        for(const auto& file : files) {
+            std::ifstream in {file, std::ios::binary};
+            if(!in) throw std::runtime_error("[ERROR] Cannot read asset " + file);
+            std::vector<char> data {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+            for(char c : data) mix(static_cast<uint8_t>(c));
+        }
+        return hash;
+    }
+
+    GLFWwindow *CreateWindow() {
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        return glfwCreateWindow(1280, 720, "async-init", nullptr, nullptr);
+    }
+
+    struct Timing {
+        double device_ms;   // until the logical device exists
+        double total_ms;    // until the device, the window and the assets are all ready
+    };
+
+    Timing RunSerial(vkli::LoaderConfig& config, const std::vector<std::string>& files, bool& have_window) {
+        auto start {Clock::now()};
+        vkli::VkLoader loader;
+        if(!loader.CreateInstance(config.layers, config.instance_extensions, config.app_info) ||
+           !loader.CreateDevice(config.device_extensions, &config.features))
+            throw std::runtime_error("[ERROR] Serial initialisation failed");
+        auto device_ready {Clock::now()};
+
+        GLFWwindow *window {CreateWindow()};
+        have_window = window != nullptr;
+        volatile uint64_t assets {LoadAssets(files)};
+        (void)assets;
+        auto end {Clock::now()};
+
+        if(window) glfwDestroyWindow(window);
+        return {Ms(start, device_ready), Ms(start, end)};
+    }
+
+    Timing RunAsync(const vkli::LoaderConfig& config, const std::vector<std::string>& files, bool& have_window) {
+        auto start {Clock::now()};
+        std::shared_future<std::unique_ptr<vkli::VkLoader>> pending {vkli::VkLoader::CreateAsync(config).share()};
+        // notes when the device is ready, which may be long before the main thread asks for it.
+        std::future<Clock::time_point> device_ready {std::async(std::launch::async, [pending]() {
+            pending.wait();
+            return Clock::now();
+        })};
+
+        GLFWwindow *window {CreateWindow()};
+        have_window = window != nullptr;
+        volatile uint64_t assets {LoadAssets(files)};
+        (void)assets;
+
+        // rethrows if initialisation failed, the loader itself lives until pending goes out of scope.
+        try {
+            pending.get();
+        } catch(std::runtime_error&) {
+            if(window) glfwDestroyWindow(window);
+            // no loader owns GLFW now, so it is shut down here, on the main thread.
+            vkli::TerminateGlfw();
+            throw;
+        }
+        auto end {Clock::now()};
+
+        if(window) glfwDestroyWindow(window);
+        return {Ms(start, device_ready.get()), Ms(start, end)};
+    }
+}
+
+int main(int argc, char **argv) {
+    int runs {argc > 1 ? std::atoi(argv[1]) : 5};
+    if(runs <= 0) {
+        std::fprintf(stderr, "usage: %s [runs] [asset files...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::vector<std::string> files(argv + std::min(argc, 2), argv + argc);
+
+    // headless, a window only needs a surface once something is presented.
+    vkli::LoaderConfig config;
+
+    std::vector<Timing> serial, async;
+    bool have_window {false};
+    try {
+        // alternate, so driver files being cached after the first run favours neither path.
+        for(int i = 0; i < runs; i++) {
+            serial.push_back(RunSerial(config, files, have_window));
+            async.push_back(RunAsync(config, files, have_window));
+        }
+    } catch(std::runtime_error& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    const auto best = [](const std::vector<Timing>& timings) {
+        Timing result {timings[0]};
+        for(const auto& t : timings) {
+            result.device_ms = std::min(result.device_ms, t.device_ms);
+            result.total_ms = std::min(result.total_ms, t.total_ms);
+        }
+        return result;
+    };
+    Timing s {best(serial)}, a {best(async)};
+    std::printf("\nbest of %d runs, %s, %s\n", runs, have_window ? "with a window" : "no display, no window",
+                files.empty() ? "synthetic assets" : "asset files");
+    std::printf("%-8s %16s %16s\n", "path", "device ms", "everything ms");
+    std::printf("%-8s %16.2f %16.2f\n", "serial", s.device_ms, s.total_ms);
+    std::printf("%-8s %16.2f %16.2f\n", "async", a.device_ms, a.total_ms);
+    std::printf("async saves %.2f ms (%.0f%%)\n", s.total_ms - a.total_ms, 100.0 * (s.total_ms - a.total_ms) / s.total_ms);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,362 @@
+/*
+    compute-bench: GPGPU kernels on a compute only device: saxpy, a parallel reduction, an
+    exclusive prefix sum and a byte histogram. Every kernel is checked against the CPU once, then
+    timed, and the best time is reported as bandwidth and elements per second.
+
+    usage: compute-bench [elements] [iterations]
+
+    Needs no window, surface or graphics queue, so it also runs on a software ICD such as lavapipe
+    (VK_ICD_FILENAMES=.../lvp_icd.x86_64.json). Exits with a failure if any result is wrong.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/vkli.hpp"
+#include "vkli/compute.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "saxpy.comp.h"
+#include "reduce.comp.h"
+#include "scan.comp.h"
+#include "scan-add.comp.h"
+#include "histogram.comp.h"
+
+namespace {
+    // elements per workgroup: 256 invocations with four elements each.
+    const uint32_t group_elements {1024};
+    // the grid stride kernels (reduce, histogram) never need more workgroups than this.
+    const uint32_t max_strided_groups {512};
+
+    struct Result {
+        const char *name;
+        double bytes;    // moved to and from memory by one run
+        double elements; // processed by one run
+        double best_ms;
+        bool correct;
+    };
+
+    // submits one command buffer at a time and times it, with timestamps if the queue has them.
+    class Runner {
+        public:
+            Runner(vkli::VkLoader& loader) : m_Device{loader.GetDevice()}, m_Queue{loader.GetQueue()},
+                                             m_Queries{VK_NULL_HANDLE} {
+                VkPhysicalDeviceProperties props;
+                vkGetPhysicalDeviceProperties(loader.GetPhysicalDevice(), &props);
+                m_TickMs = props.limits.timestampPeriod * 1e-6;
+
+                uint32_t n_families;
+                vkGetPhysicalDeviceQueueFamilyProperties(loader.GetPhysicalDevice(), &n_families, nullptr);
+                std::vector<VkQueueFamilyProperties> families(n_families);
+                vkGetPhysicalDeviceQueueFamilyProperties(loader.GetPhysicalDevice(), &n_families, families.data());
+                const VkQueueFamilyProperties& family {families[loader.GetQueueFamily()]};
+                m_TimestampBits = family.timestampValidBits;
+                std::printf("device: %s, queue family %u (%s)\n", props.deviceName, loader.GetQueueFamily(),
+                            family.queueFlags & VK_QUEUE_GRAPHICS_BIT ? "graphics and compute" : "compute only");
+
+                VkCommandPoolCreateInfo pool_info {
+                    VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                    nullptr,
+                    VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                    loader.GetQueueFamily()
+                };
+                if(vkCreateCommandPool(m_Device, &pool_info, nullptr, &m_Pool) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Command pool creation failed");
+                VkCommandBufferAllocateInfo alloc_info {
+                    VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                    nullptr,
+                    m_Pool,
+                    VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                    1
+                };
+                VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
+                if(vkAllocateCommandBuffers(m_Device, &alloc_info, &m_Cmd) != VK_SUCCESS ||
+                   vkCreateFence(m_Device, &fence_info, nullptr, &m_Fence) != VK_SUCCESS) {
+                    vkDestroyCommandPool(m_Device, m_Pool, nullptr);
+                    throw std::runtime_error("[ERROR] Command buffer or fence creation failed");
+                }
+                if(m_TimestampBits) {
+                    VkQueryPoolCreateInfo query_info {
+                        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                        nullptr,
+                        0,
+                        VK_QUERY_TYPE_TIMESTAMP,
+                        2,
+                        0
+                    };
+                    if(vkCreateQueryPool(m_Device, &query_info, nullptr, &m_Queries) != VK_SUCCESS)
+                        m_TimestampBits = 0;
+                }
+                if(!m_TimestampBits)
+                    std::printf("the queue has no timestamps, timing on the CPU around each submit\n");
+            }
+
+            ~Runner() {
+                if(m_Queries) vkDestroyQueryPool(m_Device, m_Queries, nullptr);
+                vkDestroyFence(m_Device, m_Fence, nullptr);
+                vkDestroyCommandPool(m_Device, m_Pool, nullptr);
+            }
+
+            // records, submits and waits, returns how long the work took in milliseconds.
+            double Run(const std::function<void(VkCommandBuffer)>& record) {
+                VkCommandBufferBeginInfo begin_info {
+                    VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                    nullptr,
+                    VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                    nullptr
+                };
+                if(vkResetCommandBuffer(m_Cmd, 0) != VK_SUCCESS || vkBeginCommandBuffer(m_Cmd, &begin_info) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Beginning a command buffer failed");
+                if(m_Queries) {
+                    vkCmdResetQueryPool(m_Cmd, m_Queries, 0, 2);
+                    vkCmdWriteTimestamp(m_Cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_Queries, 0);
+                }
+                record(m_Cmd);
+                if(m_Queries)
+                    vkCmdWriteTimestamp(m_Cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_Queries, 1);
+                if(vkEndCommandBuffer(m_Cmd) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Recording a command buffer failed");
+
+                VkSubmitInfo submit_info {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+                submit_info.commandBufferCount = 1;
+                submit_info.pCommandBuffers = &m_Cmd;
+                auto start {std::chrono::steady_clock::now()};
+                if(vkQueueSubmit(m_Queue, 1, &submit_info, m_Fence) != VK_SUCCESS ||
+                   vkWaitForFences(m_Device, 1, &m_Fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Submitting a command buffer failed");
+                double cpu_ms {std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()};
+                vkResetFences(m_Device, 1, &m_Fence);
+                if(!m_Queries)
+                    return cpu_ms;
+
+                uint64_t ticks[2];
+                if(vkGetQueryPoolResults(m_Device, m_Queries, 0, 2, sizeof(ticks), ticks, sizeof(uint64_t),
+                                         VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS)
+                    return cpu_ms;
+                uint64_t mask {m_TimestampBits >= 64 ? ~0ull : (1ull << m_TimestampBits) - 1};
+                return ((ticks[1] - ticks[0]) & mask) * m_TickMs;
+            }
+
+            double Best(uint32_t iterations, const std::function<void(VkCommandBuffer)>& record) {
+                double best {Run(record)};
+                for(uint32_t i = 1; i < iterations; i++) best = std::min(best, Run(record));
+                return best;
+            }
+        private:
+            VkDevice m_Device;
+            VkQueue m_Queue;
+            VkCommandPool m_Pool;
+            VkCommandBuffer m_Cmd;
+            VkFence m_Fence;
+            VkQueryPool m_Queries;
+            uint32_t m_TimestampBits;
+            double m_TickMs;
+    };
+
+    Result Saxpy(vkli::VkLoader& loader, Runner& runner, uint32_t n, uint32_t iterations, std::mt19937& rng) {
+        std::uniform_real_distribution<float> dist {-100.0f, 100.0f};
+        std::vector<float> x(n), y(n), out(n);
+        for(uint32_t i = 0; i < n; i++) { x[i] = dist(rng); y[i] = dist(rng); }
+        struct { float a; uint32_t count; } params {2.5f, n / 4};
+
+        vkli::ComputeBuffer x_buffer {loader, n * sizeof(float)}, y_buffer {loader, n * sizeof(float)};
+        vkli::ComputeKernel kernel {loader, saxpy_comp, sizeof(saxpy_comp), 2, sizeof(params)};
+        VkDescriptorSet set {kernel.Bind({x_buffer.Get(), y_buffer.Get()})};
+        if(set == VK_NULL_HANDLE || !x_buffer.Write(x.data(), n * sizeof(float)) || !y_buffer.Write(y.data(), n * sizeof(float)))
+            throw std::runtime_error("[ERROR] saxpy setup failed");
+        const auto record = [&](VkCommandBuffer cmd) { kernel.Dispatch(cmd, set, &params, n / group_elements); };
+
+        runner.Run(record);
+        bool correct {y_buffer.Read(out.data(), n * sizeof(float))};
+        // the device may or may not fuse the multiply and add.
+        for(uint32_t i = 0; correct && i < n; i++) {
+            float expected {params.a * x[i] + y[i]};
+            correct = std::fabs(out[i] - expected) <= 1e-5f * std::max(1.0f, std::fabs(expected));
+        }
+        return {"saxpy", 3.0 * sizeof(float) * n, double(n), runner.Best(iterations, record), correct};
+    }
+
+    Result Reduce(vkli::VkLoader& loader, Runner& runner, uint32_t n, uint32_t iterations, std::mt19937& rng) {
+        std::vector<uint32_t> values(n);
+        uint32_t expected {0};
+        for(auto& v : values) { v = rng(); expected += v; }
+        uint32_t params {n / 4};
+
+        vkli::ComputeBuffer values_buffer {loader, n * sizeof(uint32_t)}, result_buffer {loader, sizeof(uint32_t)};
+        vkli::ComputeKernel kernel {loader, reduce_comp, sizeof(reduce_comp), 2, sizeof(params)};
+        VkDescriptorSet set {kernel.Bind({values_buffer.Get(), result_buffer.Get()})};
+        if(set == VK_NULL_HANDLE || !values_buffer.Write(values.data(), n * sizeof(uint32_t)))
+            throw std::runtime_error("[ERROR] reduction setup failed");
+        const uint32_t groups {std::min(n / group_elements, max_strided_groups)};
+        const auto record = [&](VkCommandBuffer cmd) {
+            vkCmdFillBuffer(cmd, result_buffer.Get(), 0, sizeof(uint32_t), 0);
+            vkli::ComputeKernel::Barrier(cmd);
+            kernel.Dispatch(cmd, set, &params, groups);
+        };
+
+        runner.Run(record);
+        uint32_t sum;
+        bool correct {result_buffer.Read(&sum, sizeof(sum)) && sum == expected};
+        return {"reduction", double(sizeof(uint32_t)) * n, double(n), runner.Best(iterations, record), correct};
+    }
+
+    Result Scan(vkli::VkLoader& loader, Runner& runner, uint32_t n, uint32_t iterations, std::mt19937& rng) {
+        std::vector<uint32_t> values(n), out(n);
+        for(auto& v : values) v = rng() & 0xff;
+
+        // level 0 is the data, level i + 1 holds the block totals of level i, padded to whole blocks.
+        // The last level only receives the grand total.
+        std::vector<std::unique_ptr<vkli::ComputeBuffer>> levels;
+        std::vector<uint32_t> level_groups;
+        levels.push_back(std::make_unique<vkli::ComputeBuffer>(loader, n * sizeof(uint32_t)));
+        for(uint32_t elements = n;;) {
+            uint32_t groups {elements / group_elements};
+            level_groups.push_back(groups);
+            elements = (groups + group_elements - 1) / group_elements * group_elements;
+            levels.push_back(std::make_unique<vkli::ComputeBuffer>(loader, elements * sizeof(uint32_t)));
+            if(groups == 1) break;
+        }
+
+        vkli::ComputeKernel scan {loader, scan_comp, sizeof(scan_comp), 2};
+        vkli::ComputeKernel add {loader, scan_add_comp, sizeof(scan_add_comp), 2};
+        std::vector<VkDescriptorSet> scan_sets, add_sets;
+        for(size_t i = 0; i < level_groups.size(); i++) {
+            scan_sets.push_back(scan.Bind({levels[i]->Get(), levels[i + 1]->Get()}));
+            add_sets.push_back(add.Bind({levels[i]->Get(), levels[i + 1]->Get()}));
+            if(scan_sets.back() == VK_NULL_HANDLE || add_sets.back() == VK_NULL_HANDLE)
+                throw std::runtime_error("[ERROR] prefix sum setup failed");
+        }
+        if(!levels[0]->Write(values.data(), n * sizeof(uint32_t)))
+            throw std::runtime_error("[ERROR] prefix sum setup failed");
+
+        const auto record = [&](VkCommandBuffer cmd) {
+            for(size_t i = 0; i < level_groups.size(); i++) {
+                scan.Dispatch(cmd, scan_sets[i], nullptr, level_groups[i]);
+                vkli::ComputeKernel::Barrier(cmd);
+            }
+            for(size_t i = level_groups.size() - 1; i-- > 0;) {
+                add.Dispatch(cmd, add_sets[i], nullptr, level_groups[i]);
+                vkli::ComputeKernel::Barrier(cmd);
+            }
+        };
+
+        runner.Run(record);
+        bool correct {levels[0]->Read(out.data(), n * sizeof(uint32_t))};
+        uint32_t expected {0};
+        for(uint32_t i = 0; correct && i < n; i++) {
+            correct = out[i] == expected;
+            expected += values[i];
+        }
+        // the timed runs scan their own output again, which takes just as long.
+        return {"prefix sum", 2.0 * sizeof(uint32_t) * n, double(n), runner.Best(iterations, record), correct};
+    }
+
+    Result Histogram(vkli::VkLoader& loader, Runner& runner, uint32_t n, uint32_t iterations, std::mt19937& rng) {
+        std::vector<uint32_t> values(n);
+        std::array<uint32_t, 256> expected {}, bins;
+        // a skewed distribution, like image data, so some bins see much more contention than others.
+        std::binomial_distribution<uint32_t> dist {255, 0.3};
+        for(auto& v : values) {
+            v = 0;
+            for(int shift = 0; shift < 32; shift += 8) {
+                uint32_t byte {dist(rng)};
+                expected[byte]++;
+                v |= byte << shift;
+            }
+        }
+        uint32_t params {n / 4};
+
+        vkli::ComputeBuffer values_buffer {loader, n * sizeof(uint32_t)}, bins_buffer {loader, sizeof(bins)};
+        vkli::ComputeKernel kernel {loader, histogram_comp, sizeof(histogram_comp), 2, sizeof(params)};
+        VkDescriptorSet set {kernel.Bind({values_buffer.Get(), bins_buffer.Get()})};
+        if(set == VK_NULL_HANDLE || !values_buffer.Write(values.data(), n * sizeof(uint32_t)))
+            throw std::runtime_error("[ERROR] histogram setup failed");
+        const uint32_t groups {std::min(n / group_elements, max_strided_groups)};
+        const auto record = [&](VkCommandBuffer cmd) {
+            vkCmdFillBuffer(cmd, bins_buffer.Get(), 0, sizeof(bins), 0);
+            vkli::ComputeKernel::Barrier(cmd);
+            kernel.Dispatch(cmd, set, &params, groups);
+        };
+
+        runner.Run(record);
+        bool correct {bins_buffer.Read(bins.data(), sizeof(bins)) && bins == expected};
+        return {"histogram (bytes)", double(sizeof(uint32_t)) * n, 4.0 * n, runner.Best(iterations, record), correct};
+    }
+
+    int Run(uint32_t n, uint32_t iterations) {
+        vkli::VkLoader loader;
+        std::vector<std::string> layers, instance_extensions, device_extensions;
+        if(!loader.CreateInstance(layers, instance_extensions))
+            return EXIT_FAILURE;
+
+        vkli::DeviceFeatures features;
+        features.queue_flags = VK_QUEUE_COMPUTE_BIT;
+        if(!loader.CreateDevice(device_extensions, &features))
+            return EXIT_FAILURE;
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(loader.GetPhysicalDevice(), &props);
+        if(n / group_elements > props.limits.maxComputeWorkGroupCount[0]) {
+            std::fprintf(stderr, "[ERROR] %u elements need more workgroups than the device allows\n", n);
+            return EXIT_FAILURE;
+        }
+
+        Runner runner {loader};
+        std::printf("%u elements, best of %u runs\n", n, iterations);
+        std::mt19937 rng {1234};
+        std::vector<Result> results;
+        results.push_back(Saxpy(loader, runner, n, iterations, rng));
+        results.push_back(Reduce(loader, runner, n, iterations, rng));
+        results.push_back(Scan(loader, runner, n, iterations, rng));
+        results.push_back(Histogram(loader, runner, n, iterations, rng));
+
+        bool all_correct {true};
+        std::printf("\n%-18s %10s %10s %12s %8s\n", "kernel", "ms", "GB/s", "Gelem/s", "result");
+        for(const Result& r : results) {
+            std::printf("%-18s %10.3f %10.2f %12.3f %8s\n", r.name, r.best_ms, r.bytes / (r.best_ms * 1e6),
+                        r.elements / (r.best_ms * 1e6), r.correct ? "ok" : "WRONG");
+            all_correct = all_correct && r.correct;
+        }
+        return all_correct ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t n {argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 1u << 22};
+    uint32_t iterations {argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 10};
+    // every kernel works on whole workgroups of elements.
+    n = (n + group_elements - 1) / group_elements * group_elements;
+    if(n == 0 || n > (1u << 28) || iterations == 0) {
+        std::fprintf(stderr, "usage: %s [elements, at most 2^28] [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        return Run(n, iterations);
+    } catch(std::runtime_error& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,645 @@
+/*
+    gpu-driven-bench: Compares GPU driven culling and indirect drawing against one CPU recorded
+    draw per visible instance, rendering headless into an offscreen target.
+
+    usage: gpu-driven-bench [instances] [frames]
+
+    Runs on any Vulkan 1.2 device with multiDrawIndirect, drawIndirectFirstInstance and
+    drawIndirectCount, including lavapipe (VK_ICD_FILENAMES=.../lvp_icd.x86_64.json).
+    Fails if the GPU frustum culled visible counts do not match the CPU path.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/vkli.hpp"
+#include "vkli/gpudriven.hpp"
+#include "vkli/helpers.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mesh.vert.h"
+#include "mesh.frag.h"
+
+namespace {
+    const VkExtent2D extent {1280, 720};
+    const VkFormat colour_format {VK_FORMAT_R8G8B8A8_UNORM};
+    const VkFormat depth_format {VK_FORMAT_D32_SFLOAT};
+
+    enum Mode {MODE_CPU, MODE_GPU_FRUSTUM, MODE_GPU_OCCLUSION, MODE_COUNT};
+    const char *mode_names[MODE_COUNT] {"cpu cull + direct draws", "gpu frustum cull", "gpu frustum + occlusion"};
+
+    struct Vec3 { float x, y, z; };
+    Vec3 Sub(Vec3 a, Vec3 b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+    float Dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    Vec3 Cross(Vec3 a, Vec3 b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+    Vec3 Normalise(Vec3 a) { float l {std::sqrt(Dot(a, a))}; return {a.x / l, a.y / l, a.z / l}; }
+
+    // +z forward, +y down, see gpudriven.hpp.
+    void LookAt(Vec3 eye, Vec3 target, float out[16]) {
+        Vec3 z {Normalise(Sub(target, eye))};
+        Vec3 x {Normalise(Cross(z, {0.0f, -1.0f, 0.0f}))};
+        Vec3 y {Cross(z, x)};
+        const Vec3 axes[3] {x, y, z};
+        for(int r = 0; r < 3; r++) {
+            out[0 + r] = axes[r].x;
+            out[4 + r] = axes[r].y;
+            out[8 + r] = axes[r].z;
+            out[12 + r] = -Dot(axes[r], eye);
+        }
+        out[3] = out[7] = out[11] = 0.0f;
+        out[15] = 1.0f;
+    }
+
+    void Perspective(float fov_y, float aspect, float znear, float zfar, float out[16]) {
+        float f {1.0f / std::tan(fov_y / 2.0f)};
+        std::fill(out, out + 16, 0.0f);
+        out[0] = f / aspect;
+        out[5] = f;
+        out[10] = zfar / (zfar - znear);
+        out[11] = 1.0f;
+        out[14] = -znear * zfar / (zfar - znear);
+    }
+
+    void Multiply(const float a[16], const float b[16], float out[16]) {
+        for(int c = 0; c < 4; c++)
+            for(int r = 0; r < 4; r++) {
+                out[c * 4 + r] = 0.0f;
+                for(int k = 0; k < 4; k++) out[c * 4 + r] += a[k * 4 + r] * b[c * 4 + k];
+            }
+    }
+
+    void AddCube(vkli::GeometryPool& pool) {
+        std::vector<vkli::Vertex> vertices;
+        std::vector<uint32_t> indices;
+        for(int axis = 0; axis < 3; axis++)
+            for(float sign : {-1.0f, 1.0f}) {
+                uint32_t base {static_cast<uint32_t>(vertices.size())};
+                for(int corner = 0; corner < 4; corner++) {
+                    float u {(corner & 1) ? 0.5f : -0.5f}, v {(corner & 2) ? 0.5f : -0.5f};
+                    vkli::Vertex vertex {};
+                    vertex.position[axis] = 0.5f * sign;
+                    vertex.position[(axis + 1) % 3] = u;
+                    vertex.position[(axis + 2) % 3] = v;
+                    vertex.normal[axis] = sign;
+                    vertices.push_back(vertex);
+                }
+                for(uint32_t i : {0u, 1u, 2u, 2u, 1u, 3u}) indices.push_back(base + i);
+            }
+        pool.AddMesh(vertices, indices);
+    }
+
+    void AddSphere(vkli::GeometryPool& pool, uint32_t rings, uint32_t segments) {
+        std::vector<vkli::Vertex> vertices;
+        std::vector<uint32_t> indices;
+        for(uint32_t r = 0; r <= rings; r++)
+            for(uint32_t s = 0; s <= segments; s++) {
+                float theta {3.14159265f * r / rings}, phi {2.0f * 3.14159265f * s / segments};
+                vkli::Vertex vertex {
+                    {0.5f * std::sin(theta) * std::cos(phi), 0.5f * std::cos(theta), 0.5f * std::sin(theta) * std::sin(phi)},
+                    {std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)}
+                };
+                vertices.push_back(vertex);
+            }
+        for(uint32_t r = 0; r < rings; r++)
+            for(uint32_t s = 0; s < segments; s++) {
+                uint32_t a {r * (segments + 1) + s}, b {a + segments + 1};
+                for(uint32_t i : {a, b, a + 1, a + 1, b, b + 1}) indices.push_back(i);
+            }
+        pool.AddMesh(vertices, indices);
+    }
+
+    struct Target {
+        VkImage image {VK_NULL_HANDLE};
+        VkDeviceMemory memory {VK_NULL_HANDLE};
+        VkImageView view {VK_NULL_HANDLE};
+    };
+
+    Target CreateTarget(VkDevice dev, VkPhysicalDevice pdev, VkFormat format, VkImageUsageFlags usage,
+                        VkImageAspectFlags aspect) {
+        Target target;
+        VkImageCreateInfo image_info {
+            VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_IMAGE_TYPE_2D,
+            format,
+            {extent.width, extent.height, 1},
+            1,
+            1,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_TILING_OPTIMAL,
+            usage,
+            VK_SHARING_MODE_EXCLUSIVE,
+            0,
+            nullptr,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        };
+        if(vkCreateImage(dev, &image_info, nullptr, &target.image) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Render target creation failed");
+        VkMemoryRequirements reqs;
+        vkGetImageMemoryRequirements(dev, target.image, &reqs);
+        VkMemoryAllocateInfo alloc_info {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            nullptr,
+            reqs.size,
+            vkli::helpers::FindMemoryType(pdev, reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+        };
+        if(vkAllocateMemory(dev, &alloc_info, nullptr, &target.memory) != VK_SUCCESS ||
+           vkBindImageMemory(dev, target.image, target.memory, 0) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Render target memory allocation failed");
+        VkImageViewCreateInfo view_info {
+            VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            nullptr,
+            0,
+            target.image,
+            VK_IMAGE_VIEW_TYPE_2D,
+            format,
+            {},
+            {aspect, 0, 1, 0, 1}
+        };
+        if(vkCreateImageView(dev, &view_info, nullptr, &target.view) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Render target view creation failed");
+        return target;
+    }
+
+    void DestroyTarget(VkDevice dev, Target& target) {
+        vkDestroyImageView(dev, target.view, nullptr);
+        vkDestroyImage(dev, target.image, nullptr);
+        vkFreeMemory(dev, target.memory, nullptr);
+    }
+
+    VkRenderPass CreateRenderPass(VkDevice dev) {
+        const std::array<VkAttachmentDescription, 2> attachments {{
+            {
+                0,
+                colour_format,
+                VK_SAMPLE_COUNT_1_BIT,
+                VK_ATTACHMENT_LOAD_OP_CLEAR,
+                VK_ATTACHMENT_STORE_OP_STORE,
+                VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+            },
+            {
+                0,
+                depth_format,
+                VK_SAMPLE_COUNT_1_BIT,
+                VK_ATTACHMENT_LOAD_OP_CLEAR,
+                VK_ATTACHMENT_STORE_OP_STORE, // read by the depth pyramid
+                VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+                VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+            }
+        }};
+        VkAttachmentReference colour_ref {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        VkAttachmentReference depth_ref {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+        VkSubpassDescription subpass {
+            0,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            0,
+            nullptr,
+            1,
+            &colour_ref,
+            nullptr,
+            &depth_ref,
+            0,
+            nullptr
+        };
+        const std::array<VkSubpassDependency, 2> dependencies {{
+            // the previous frame's pyramid build must be done reading depth before it is cleared,
+            {
+                VK_SUBPASS_EXTERNAL,
+                0,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                0,
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                0
+            },
+            // and this frame's must wait for the depth writes and the final layout transition.
+            {
+                0,
+                VK_SUBPASS_EXTERNAL,
+                VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                VK_ACCESS_SHADER_READ_BIT,
+                0
+            }
+        }};
+        VkRenderPassCreateInfo render_pass_info {
+            VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+            nullptr,
+            0,
+            static_cast<uint32_t>(attachments.size()),
+            attachments.data(),
+            1,
+            &subpass,
+            static_cast<uint32_t>(dependencies.size()),
+            dependencies.data()
+        };
+        VkRenderPass render_pass;
+        if(vkCreateRenderPass(dev, &render_pass_info, nullptr, &render_pass) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Render pass creation failed");
+        return render_pass;
+    }
+
+    VkPipeline CreatePipeline(VkDevice dev, VkRenderPass render_pass, VkPipelineLayout layout) {
+        VkShaderModule vert {vkli::helpers::CreateShaderModule(dev, mesh_vert, sizeof(mesh_vert))};
+        VkShaderModule frag {vkli::helpers::CreateShaderModule(dev, mesh_frag, sizeof(mesh_frag))};
+        const std::array<VkPipelineShaderStageCreateInfo, 2> stages {{
+            {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, VK_SHADER_STAGE_VERTEX_BIT, vert, "main", nullptr},
+            {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, VK_SHADER_STAGE_FRAGMENT_BIT, frag, "main", nullptr}
+        }};
+        VkVertexInputBindingDescription binding {0, sizeof(vkli::Vertex), VK_VERTEX_INPUT_RATE_VERTEX};
+        const std::array<VkVertexInputAttributeDescription, 2> attributes {{
+            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(vkli::Vertex, position)},
+            {1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(vkli::Vertex, normal)}
+        }};
+        VkPipelineVertexInputStateCreateInfo vertex_input {
+            VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+            nullptr,
+            0,
+            1,
+            &binding,
+            static_cast<uint32_t>(attributes.size()),
+            attributes.data()
+        };
+        VkPipelineInputAssemblyStateCreateInfo input_assembly {
+            VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+            VK_FALSE
+        };
+        VkViewport viewport {0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f};
+        VkRect2D scissor {{0, 0}, extent};
+        VkPipelineViewportStateCreateInfo viewport_state {
+            VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+            nullptr,
+            0,
+            1,
+            &viewport,
+            1,
+            &scissor
+        };
+        VkPipelineRasterizationStateCreateInfo rasterization {VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+        rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterization.cullMode = VK_CULL_MODE_NONE;
+        rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterization.lineWidth = 1.0f;
+        VkPipelineMultisampleStateCreateInfo multisample {VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+        multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        VkPipelineDepthStencilStateCreateInfo depth_stencil {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+        depth_stencil.depthTestEnable = VK_TRUE;
+        depth_stencil.depthWriteEnable = VK_TRUE;
+        depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+        VkPipelineColorBlendAttachmentState blend_attachment {};
+        blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        VkPipelineColorBlendStateCreateInfo blend {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+        blend.attachmentCount = 1;
+        blend.pAttachments = &blend_attachment;
+
+        VkGraphicsPipelineCreateInfo pipeline_info {VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+        pipeline_info.stageCount = static_cast<uint32_t>(stages.size());
+        pipeline_info.pStages = stages.data();
+        pipeline_info.pVertexInputState = &vertex_input;
+        pipeline_info.pInputAssemblyState = &input_assembly;
+        pipeline_info.pViewportState = &viewport_state;
+        pipeline_info.pRasterizationState = &rasterization;
+        pipeline_info.pMultisampleState = &multisample;
+        pipeline_info.pDepthStencilState = &depth_stencil;
+        pipeline_info.pColorBlendState = &blend;
+        pipeline_info.layout = layout;
+        pipeline_info.renderPass = render_pass;
+        pipeline_info.subpass = 0;
+
+        VkPipeline pipeline;
+        VkResult result {vkCreateGraphicsPipelines(dev, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline)};
+        vkDestroyShaderModule(dev, vert, nullptr);
+        vkDestroyShaderModule(dev, frag, nullptr);
+        if(result != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Graphics pipeline creation failed");
+        return pipeline;
+    }
+
+    struct Stats {
+        double cpu_ms {0.0};  // recording and submitting
+        double cull_ms {0.0}; // GPU, culling dispatch and depth pyramid
+        double draw_ms {0.0}; // GPU, render pass
+        uint64_t visible {0};
+    };
+
+    int Run(uint32_t n_instances, uint32_t n_frames) {
+        vkli::VkLoader loader;
+        std::vector<std::string> layers, instance_extensions, device_extensions;
+        if(!loader.CreateInstance(layers, instance_extensions))
+            return EXIT_FAILURE;
+
+        vkli::DeviceFeatures features;
+        vkli::CullingPass::RequireFeatures(features);
+        if(!loader.CreateDevice(device_extensions, &features))
+            return EXIT_FAILURE;
+
+        VkDevice dev {loader.GetDevice()};
+        VkPhysicalDevice pdev {loader.GetPhysicalDevice()};
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(pdev, &props);
+        std::printf("device: %s, %u instances, %u frames per mode\n", props.deviceName, n_instances, n_frames);
+
+        // the scene: a jittered grid of cubes and spheres, the camera turns around in the middle of it.
+        vkli::GeometryPool pool {loader};
+        AddCube(pool);
+        AddSphere(pool, 8, 16);
+        AddSphere(pool, 16, 32);
+        if(!pool.Upload())
+            return EXIT_FAILURE;
+
+        std::mt19937 rng {1234};
+        std::uniform_real_distribution<float> jitter {-1.0f, 1.0f};
+        std::uniform_real_distribution<float> scale_dist {0.5f, 1.5f};
+        std::vector<vkli::Instance> instances(n_instances);
+        // side * 2 instances along x and z, and about side / 2 along y
+        const uint32_t side {static_cast<uint32_t>(std::ceil(std::cbrt(n_instances / 0.5f) / 2.0f))};
+        const uint32_t grid_layers {(n_instances + 4 * side * side - 1) / (4 * side * side)};
+        const float spacing {4.0f};
+        for(uint32_t i = 0; i < n_instances; i++) {
+            float x {float(i % (2 * side)) - side}, z {float((i / (2 * side)) % (2 * side)) - side};
+            float y {float(i / (4 * side * side)) - grid_layers / 2.0f};
+            float scale {scale_dist(rng)}, angle {jitter(rng) * 3.14159265f};
+            vkli::Instance& instance {instances[i]};
+            instance = {};
+            instance.model[0] = scale * std::cos(angle);
+            instance.model[2] = -scale * std::sin(angle);
+            instance.model[5] = scale;
+            instance.model[8] = scale * std::sin(angle);
+            instance.model[10] = scale * std::cos(angle);
+            instance.model[12] = (x + 0.3f * jitter(rng)) * spacing;
+            instance.model[13] = (y + 0.3f * jitter(rng)) * spacing;
+            instance.model[14] = (z + 0.3f * jitter(rng)) * spacing;
+            instance.model[15] = 1.0f;
+            instance.mesh = i % pool.Meshes().size();
+        }
+
+        Target colour {CreateTarget(dev, pdev, colour_format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT)};
+        Target depth {CreateTarget(dev, pdev, depth_format,
+                                   VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                   VK_IMAGE_ASPECT_DEPTH_BIT)};
+        vkli::DepthPyramid pyramid {loader, depth.image, depth.view, extent};
+        vkli::CullingPass culling {loader, pool, instances, pyramid};
+
+        VkRenderPass render_pass {CreateRenderPass(dev)};
+        const std::array<VkImageView, 2> fb_views {colour.view, depth.view};
+        VkFramebufferCreateInfo fb_info {
+            VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            nullptr,
+            0,
+            render_pass,
+            static_cast<uint32_t>(fb_views.size()),
+            fb_views.data(),
+            extent.width,
+            extent.height,
+            1
+        };
+        VkFramebuffer framebuffer;
+        if(vkCreateFramebuffer(dev, &fb_info, nullptr, &framebuffer) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Framebuffer creation failed");
+
+        VkDescriptorSetLayoutBinding binding {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr};
+        VkDescriptorSetLayoutCreateInfo set_layout_info {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO, nullptr, 0, 1, &binding};
+        VkDescriptorSetLayout set_layout;
+        if(vkCreateDescriptorSetLayout(dev, &set_layout_info, nullptr, &set_layout) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Descriptor set layout creation failed");
+        VkDescriptorPoolSize pool_size {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1};
+        VkDescriptorPoolCreateInfo desc_pool_info {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO, nullptr, 0, 1, 1, &pool_size};
+        VkDescriptorPool desc_pool;
+        if(vkCreateDescriptorPool(dev, &desc_pool_info, nullptr, &desc_pool) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Descriptor pool creation failed");
+        VkDescriptorSetAllocateInfo set_info {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO, nullptr, desc_pool, 1, &set_layout};
+        VkDescriptorSet set;
+        if(vkAllocateDescriptorSets(dev, &set_info, &set) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Descriptor set allocation failed");
+        VkDescriptorBufferInfo instance_info {culling.GetInstanceBuffer(), 0, VK_WHOLE_SIZE};
+        VkWriteDescriptorSet write {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, set, 0, 0, 1,
+                                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &instance_info, nullptr};
+        vkUpdateDescriptorSets(dev, 1, &write, 0, nullptr);
+
+        VkPushConstantRange push_range {VK_SHADER_STAGE_VERTEX_BIT, 0, 16 * sizeof(float)};
+        VkPipelineLayoutCreateInfo layout_info {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO, nullptr, 0, 1, &set_layout, 1, &push_range};
+        VkPipelineLayout pipeline_layout;
+        if(vkCreatePipelineLayout(dev, &layout_info, nullptr, &pipeline_layout) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Pipeline layout creation failed");
+        VkPipeline pipeline {CreatePipeline(dev, render_pass, pipeline_layout)};
+
+        VkCommandPoolCreateInfo cmd_pool_info {
+            VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            nullptr,
+            VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            loader.GetQueueFamily()
+        };
+        VkCommandPool cmd_pool;
+        if(vkCreateCommandPool(dev, &cmd_pool_info, nullptr, &cmd_pool) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Command pool creation failed");
+        VkCommandBufferAllocateInfo cmd_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, nullptr, cmd_pool,
+                                              VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1};
+        VkCommandBuffer cmd;
+        if(vkAllocateCommandBuffers(dev, &cmd_info, &cmd) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Command buffer allocation failed");
+        VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
+        VkFence fence;
+        if(vkCreateFence(dev, &fence_info, nullptr, &fence) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Fence creation failed");
+
+        // T0 frame start, T1 culling done, T2 drawing done, T3 depth pyramid built
+        VkQueryPoolCreateInfo query_info {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO, nullptr, 0, VK_QUERY_TYPE_TIMESTAMP, 4, 0};
+        VkQueryPool queries;
+        if(vkCreateQueryPool(dev, &query_info, nullptr, &queries) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Query pool creation failed");
+        uint32_t queue_family_count {0};
+        vkGetPhysicalDeviceQueueFamilyProperties(pdev, &queue_family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+        vkGetPhysicalDeviceQueueFamilyProperties(pdev, &queue_family_count, queue_families.data());
+        const bool timestamps {queue_families[loader.GetQueueFamily()].timestampValidBits > 0};
+        if(!timestamps)
+            std::printf("the queue does not support timestamps, GPU times are not measured\n");
+
+        // the CPU path culls the same bounding spheres as cull.comp.
+        std::vector<std::array<float, 4>> spheres(n_instances);
+        for(uint32_t i = 0; i < n_instances; i++) {
+            const float *m {instances[i].model};
+            const float *s {pool.Meshes()[instances[i].mesh].sphere};
+            float scale {std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2])};
+            spheres[i] = {m[0] * s[0] + m[4] * s[1] + m[8] * s[2] + m[12],
+                          m[1] * s[0] + m[5] * s[1] + m[9] * s[2] + m[13],
+                          m[2] * s[0] + m[6] * s[1] + m[10] * s[2] + m[14], s[3] * scale};
+        }
+
+        float proj[16];
+        Perspective(1.0f, float(extent.width) / extent.height, 0.1f, 2.0f * side * spacing, proj);
+        std::array<VkClearValue, 2> clears;
+        clears[0].color = {{0.1f, 0.1f, 0.15f, 1.0f}};
+        clears[1].depthStencil = {1.0f, 0};
+        VkRenderPassBeginInfo rp_begin {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO, nullptr, render_pass, framebuffer,
+                                        {{0, 0}, extent}, static_cast<uint32_t>(clears.size()), clears.data()};
+        VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr,
+                                             VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, nullptr};
+
+        std::array<Stats, MODE_COUNT> stats;
+        // every mode renders the same views, so the GPU frustum counts can be checked frame by
+        // frame against the CPU path. Spheres that graze a plane may round either way.
+        std::vector<uint64_t> cpu_counts(n_frames + 1);
+        const uint64_t tolerance {std::max<uint64_t>(1, n_instances / 10000)};
+        uint32_t mismatched_frames {0};
+        uint64_t max_difference {0};
+        for(int mode = 0; mode < MODE_COUNT; mode++) {
+            // frame 0 is a warm up frame, so occlusion culling starts with a built pyramid
+            for(uint32_t frame = 0; frame <= n_frames; frame++) {
+                float angle {0.01f * frame}, view[16], view_proj[16];
+                LookAt({0.0f, 0.0f, 0.0f}, {std::sin(angle), 0.1f, std::cos(angle)}, view);
+                Multiply(proj, view, view_proj);
+
+                auto cpu_start {std::chrono::steady_clock::now()};
+                uint64_t cpu_visible {0};
+                vkBeginCommandBuffer(cmd, &begin_info);
+                vkCmdResetQueryPool(cmd, queries, 0, 4);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries, 0);
+                if(mode != MODE_CPU)
+                    culling.Record(cmd, view, proj, mode == MODE_GPU_OCCLUSION);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, queries, 1);
+
+                vkCmdBeginRenderPass(cmd, &rp_begin, VK_SUBPASS_CONTENTS_INLINE);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &set, 0, nullptr);
+                vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(view_proj), view_proj);
+                if(mode == MODE_CPU) {
+                    // the same planes as CullingPass::Record, see there.
+                    float planes[6][4];
+                    for(int c = 0; c < 4; c++) {
+                        const float *col {view_proj + c * 4}; // col[r] is row r, column c
+                        planes[0][c] = col[3] + col[0];
+                        planes[1][c] = col[3] - col[0];
+                        planes[2][c] = col[3] + col[1];
+                        planes[3][c] = col[3] - col[1];
+                        planes[4][c] = col[2];
+                        planes[5][c] = col[3] - col[2];
+                    }
+                    pool.Bind(cmd);
+                    for(uint32_t i = 0; i < n_instances; i++) {
+                        const std::array<float, 4>& s {spheres[i]};
+                        bool visible {true};
+                        for(int p = 0; p < 6 && visible; p++) {
+                            float length {std::sqrt(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] +
+                                                    planes[p][2] * planes[p][2])};
+                            visible = planes[p][0] * s[0] + planes[p][1] * s[1] + planes[p][2] * s[2] + planes[p][3] > -s[3] * length;
+                        }
+                        if(!visible) continue;
+                        const vkli::MeshInfo& mesh {pool.Meshes()[instances[i].mesh]};
+                        vkCmdDrawIndexed(cmd, mesh.index_count, 1, mesh.first_index, mesh.vertex_offset, i);
+                        cpu_visible++;
+                    }
+                } else {
+                    culling.Draw(cmd);
+                }
+                vkCmdEndRenderPass(cmd);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries, 2);
+                if(mode == MODE_GPU_OCCLUSION)
+                    pyramid.Build(cmd);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries, 3);
+                vkEndCommandBuffer(cmd);
+
+                VkSubmitInfo submit_info {VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr, 0, nullptr, nullptr, 1, &cmd, 0, nullptr};
+                if(vkQueueSubmit(loader.GetQueue(), 1, &submit_info, fence) != VK_SUCCESS)
+                    throw std::runtime_error("[ERROR] Queue submission failed");
+                auto cpu_end {std::chrono::steady_clock::now()};
+                vkWaitForFences(dev, 1, &fence, VK_TRUE, UINT64_MAX);
+                vkResetFences(dev, 1, &fence);
+                if(mode == MODE_CPU) {
+                    cpu_counts[frame] = cpu_visible;
+                } else if(mode == MODE_GPU_FRUSTUM) {
+                    uint64_t gpu_visible {culling.VisibleCount()};
+                    uint64_t difference {gpu_visible > cpu_counts[frame] ? gpu_visible - cpu_counts[frame]
+                                                                         : cpu_counts[frame] - gpu_visible};
+                    if(difference > 0) mismatched_frames++;
+                    max_difference = std::max(max_difference, difference);
+                }
+                if(frame == 0) continue;
+
+                Stats& s {stats[mode]};
+                s.cpu_ms += std::chrono::duration<double, std::milli>(cpu_end - cpu_start).count();
+                s.visible += mode == MODE_CPU ? cpu_visible : culling.VisibleCount();
+                uint64_t ticks[4];
+                if(timestamps && vkGetQueryPoolResults(dev, queries, 0, 4, sizeof(ticks), ticks, sizeof(uint64_t),
+                                                       VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+                    // the pyramid build is part of the cost of occlusion culling.
+                    s.cull_ms += (ticks[1] - ticks[0] + ticks[3] - ticks[2]) * props.limits.timestampPeriod * 1e-6;
+                    s.draw_ms += (ticks[2] - ticks[1]) * props.limits.timestampPeriod * 1e-6;
+                }
+            }
+        }
+
+        std::printf("\n%-26s %12s %12s %12s %12s\n", "mode", "cpu ms", "gpu cull ms", "gpu draw ms", "visible");
+        for(int mode = 0; mode < MODE_COUNT; mode++)
+            std::printf("%-26s %12.3f %12.3f %12.3f %12llu\n", mode_names[mode], stats[mode].cpu_ms / n_frames,
+                        stats[mode].cull_ms / n_frames, stats[mode].draw_ms / n_frames,
+                        static_cast<unsigned long long>(stats[mode].visible / n_frames));
+        std::printf("\ngpu frustum vs cpu visible counts: %u of %u frames differ, by at most %llu instances\n",
+                    mismatched_frames, n_frames + 1, static_cast<unsigned long long>(max_difference));
+        const bool counts_match {max_difference <= tolerance};
+        if(!counts_match)
+            std::printf("the gpu frustum culling does not match the cpu path\n");
+
+        vkDeviceWaitIdle(dev);
+        vkDestroyQueryPool(dev, queries, nullptr);
+        vkDestroyFence(dev, fence, nullptr);
+        vkDestroyCommandPool(dev, cmd_pool, nullptr);
+        vkDestroyPipeline(dev, pipeline, nullptr);
+        vkDestroyPipelineLayout(dev, pipeline_layout, nullptr);
+        vkDestroyDescriptorPool(dev, desc_pool, nullptr);
+        vkDestroyDescriptorSetLayout(dev, set_layout, nullptr);
+        vkDestroyFramebuffer(dev, framebuffer, nullptr);
+        vkDestroyRenderPass(dev, render_pass, nullptr);
+        DestroyTarget(dev, depth);
+        DestroyTarget(dev, colour);
+        return counts_match ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t n_instances {argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 131072};
+    uint32_t n_frames {argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 100};
+    if(n_instances == 0 || n_frames == 0) {
+        std::fprintf(stderr, "usage: %s [instances] [frames]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        return Run(n_instances, n_frames);
+    } catch(std::runtime_error& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
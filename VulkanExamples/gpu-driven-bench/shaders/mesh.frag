@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) in vec3 normal;
+layout(location = 1) in vec3 tint;
+
+layout(location = 0) out vec4 colour;
+
+void main() {
+    float light = max(dot(normalize(normal), normalize(vec3(0.3, -1.0, 0.5))), 0.0);
+    colour = vec4(tint * (0.2 + 0.8 * light), 1.0);
+}
@@ -0,0 +1,27 @@
+#version 450
+
+// Draws one instance of the culling pass, gl_InstanceIndex is the instance index in both the
+// indirect and the CPU driven path.
+
+struct Instance {
+    mat4 model;
+    uint mesh;
+    uint pad0, pad1, pad2;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Instances { Instance instances[]; };
+layout(push_constant) uniform Camera { mat4 view_proj; };
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+
+layout(location = 0) out vec3 out_normal;
+layout(location = 1) out vec3 out_tint;
+
+void main() {
+    mat4 model = instances[gl_InstanceIndex].model;
+    gl_Position = view_proj * model * vec4(position, 1.0);
+    out_normal = mat3(model) * normal;
+    uint hash = uint(gl_InstanceIndex) * 2654435761u;
+    out_tint = vec3(hash & 255u, (hash >> 8) & 255u, (hash >> 16) & 255u) / 255.0;
+}
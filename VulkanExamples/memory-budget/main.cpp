@@ -0,0 +1,331 @@
+/*
+    memory-budget: Streams a working set much larger than the memory budget through
+    ResidencyPolicy and ResidencyManager.
+
+    The first part drives ResidencyPolicy with simulated heaps, no device needed, checks that
+    every plan keeps its promises and compares the result with an allocator that has no policy.
+    The second part does the same with real buffers on the device, under an artificial budget
+    limit, and prints the heap budgets as VK_EXT_memory_budget (or vkli's own accounting) sees them.
+
+    usage: memory-budget [budget limit MiB] [frames]
+
+    Uses VK_EXT_memory_budget and VK_EXT_memory_priority (with its memoryPriority feature) when
+    every device has them. Exits with a failure if a plan breaks a rule.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/vkli.hpp"
+#include "vkli/residency.hpp"
+#include "vkli/deletion.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+    const VkDeviceSize MiB {1024 * 1024};
+    const uint32_t resource_count {160};
+    const uint32_t working_set {40};    // resources used by every frame
+    const VkDeviceSize resource_size {16 * MiB};
+
+    // every 16th resource is critical, the others cycle through the priorities, and every
+    // other one can live in host memory.
+    vkli::ResidencyPriority PriorityOf(uint32_t i) {
+        return i % 16 == 0 ? vkli::ResidencyPriority::Critical : vkli::ResidencyPriority(i % 3);
+    }
+    bool DemotableOf(uint32_t i) {
+        return i % 16 != 0 && i % 2 == 1;
+    }
+    // the working set slides along the resources, two per frame, and wraps around.
+    bool InWorkingSet(uint32_t i, uint64_t frame) {
+        return (i + resource_count - (frame * 2) % resource_count) % resource_count < working_set;
+    }
+
+    void PrintHeaps(const std::vector<vkli::HeapSnapshot>& heaps) {
+        for(uint32_t i = 0; i < heaps.size(); i++)
+            std::printf("  heap %u: %8.1f of %8.1f MiB%s%s\n", i, heaps[i].usage / double(MiB),
+                        heaps[i].budget / double(MiB), heaps[i].device_local ? ", device local" : "",
+                        heaps[i].host_visible ? ", host visible" : "");
+    }
+
+    // resource bookkeeping of the simulation, what the application would keep.
+    struct Simulated {
+        uint64_t id {0}; // 0 while not loaded
+        uint32_t heap {0};
+        uint64_t last_used {0};
+    };
+
+    // heap 0 is device local, heap 1 host memory, as on a discrete GPU.
+    bool Simulate(VkDeviceSize device_budget, uint32_t n_frames) {
+        vkli::ResidencyPolicy policy;
+        const vkli::ResidencyPolicyConfig& config {policy.Config()};
+        std::vector<vkli::HeapSnapshot> heaps {{device_budget, 0, true, false}, {8 * device_budget, 0, false, true}};
+        std::vector<Simulated> resources(resource_count);
+        uint64_t loads {0}, evictions {0}, demotions {0}, promotions {0}, over_budget {0}, violations {0};
+
+        for(uint64_t frame = 1; frame <= n_frames; frame++) {
+            for(uint32_t i = 0; i < resource_count; i++) {
+                if(!InWorkingSet(i, frame)) continue;
+                Simulated& r {resources[i]};
+                if(r.id == 0) {
+                    // what ResidencyManager::Allocate does: device memory if it fits, else host
+                    // memory for demotable resources, else device memory over the budget.
+                    r.heap = policy.Fits(heaps[0], resource_size) || !DemotableOf(i) ? 0 : 1;
+                    r.id = policy.Track(r.heap, 0, resource_size, PriorityOf(i), DemotableOf(i), frame);
+                    heaps[r.heap].usage += resource_size;
+                    loads++;
+                }
+                policy.Use(r.id, frame);
+                r.last_used = frame;
+            }
+
+            for(const vkli::ResidencyAction& action : policy.Plan(heaps, frame)) {
+                auto it {std::find_if(resources.begin(), resources.end(),
+                                      [&](const Simulated& r) { return r.id == action.resource; })};
+                if(it == resources.end()) {
+                    std::printf("frame %llu: plan names an unknown resource\n", static_cast<unsigned long long>(frame));
+                    violations++;
+                    continue;
+                }
+                const uint32_t i {static_cast<uint32_t>(it - resources.begin())};
+                if(action.kind != vkli::ResidencyAction::Promote &&
+                   (PriorityOf(i) == vkli::ResidencyPriority::Critical || it->last_used + config.frames_in_flight > frame ||
+                    (action.kind == vkli::ResidencyAction::Demote && !DemotableOf(i)))) {
+                    std::printf("frame %llu: plan moves resource %u, which it must not\n",
+                                static_cast<unsigned long long>(frame), i);
+                    violations++;
+                }
+                heaps[it->heap].usage -= resource_size;
+                if(action.kind == vkli::ResidencyAction::Evict) {
+                    policy.Untrack(it->id);
+                    it->id = 0;
+                    evictions++;
+                } else {
+                    policy.Move(it->id, action.heap);
+                    it->heap = action.heap;
+                    heaps[it->heap].usage += resource_size;
+                    (action.kind == vkli::ResidencyAction::Demote ? demotions : promotions)++;
+                }
+            }
+            for(const vkli::HeapSnapshot& heap : heaps)
+                if(heap.usage > heap.budget) over_budget++;
+        }
+
+        // without a policy the device heap fills up and the next allocation fails.
+        const uint64_t unmanaged_frames {(device_budget / resource_size - working_set) / 2 + 1};
+        std::printf("simulated: %u resources of %.0f MiB, %u used per frame, %.0f MiB device budget\n",
+                    resource_count, resource_size / double(MiB), working_set, device_budget / double(MiB));
+        std::printf("  %llu loads, %llu evictions, %llu demotions, %llu promotions, %llu frames over a budget "
+                    "in %u frames\n", static_cast<unsigned long long>(loads), static_cast<unsigned long long>(evictions),
+                    static_cast<unsigned long long>(demotions), static_cast<unsigned long long>(promotions),
+                    static_cast<unsigned long long>(over_budget), n_frames);
+        std::printf("  an allocator without a policy runs out of device memory in frame %llu\n",
+                    static_cast<unsigned long long>(unmanaged_frames));
+        PrintHeaps(heaps);
+        return violations == 0 && over_budget == 0;
+    }
+
+    // a buffer with its memory from the manager, what the application would keep.
+    struct Resident {
+        VkBuffer buffer {VK_NULL_HANDLE};
+        vkli::ResidencyAllocation allocation;
+        uint32_t index {0};
+    };
+
+    VkBuffer CreateBuffer(VkDevice dev) {
+        VkBufferCreateInfo buffer_info {
+            VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            nullptr,
+            0,
+            resource_size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_SHARING_MODE_EXCLUSIVE,
+            0,
+            nullptr
+        };
+        VkBuffer buffer;
+        if(vkCreateBuffer(dev, &buffer_info, nullptr, &buffer) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Buffer creation failed");
+        return buffer;
+    }
+
+    bool Supported(const vkli::VkLoader& loader, const char *extension) {
+        for(const vkli::Extensions& extensions : loader.m_instinfo.dev_exts) {
+            if(std::none_of(extensions.begin(), extensions.end(),
+                            [&](const VkExtensionProperties& e) { return std::strcmp(e.extensionName, extension) == 0; }))
+                return false;
+        }
+        return !loader.m_instinfo.dev_exts.empty();
+    }
+
+    // the memoryPriority feature, on every device. Only valid once Supported has found the extension.
+    bool MemoryPrioritySupported(const vkli::VkLoader& loader) {
+        for(uint32_t i = 0; i < loader.m_instinfo.n_dev; i++) {
+            if(loader.m_instinfo.dev_props[i].apiVersion < VK_API_VERSION_1_1) return false;
+            VkPhysicalDeviceMemoryPriorityFeaturesEXT priority {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PRIORITY_FEATURES_EXT};
+            VkPhysicalDeviceFeatures2 features2 {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, &priority};
+            vkGetPhysicalDeviceFeatures2(loader.m_instinfo.devices[i], &features2);
+            if(!priority.memoryPriority) return false;
+        }
+        return loader.m_instinfo.n_dev > 0;
+    }
+
+    int Run(VkDeviceSize budget_limit, uint32_t n_frames) {
+        if(!Simulate(budget_limit, n_frames)) {
+            std::printf("the residency policy broke a rule\n");
+            return EXIT_FAILURE;
+        }
+
+        vkli::VkLoader loader;
+        std::vector<std::string> layers, instance_extensions, device_extensions;
+        if(!loader.CreateInstance(layers, instance_extensions))
+            return EXIT_FAILURE;
+
+        vkli::ResidencyConfig config;
+        config.budget_limit = budget_limit;
+        config.memory_budget = Supported(loader, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        config.memory_priority = Supported(loader, VK_EXT_MEMORY_PRIORITY_EXTENSION_NAME) &&
+                                 MemoryPrioritySupported(loader);
+        if(config.memory_budget) device_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if(config.memory_priority) device_extensions.push_back(VK_EXT_MEMORY_PRIORITY_EXTENSION_NAME);
+        vkli::DeviceFeatures features;
+        features.queue_flags = VK_QUEUE_COMPUTE_BIT;
+        // the hints are ignored unless the feature is enabled along with the extension.
+        VkPhysicalDeviceMemoryPriorityFeaturesEXT priority_features {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PRIORITY_FEATURES_EXT};
+        priority_features.memoryPriority = VK_TRUE;
+        if(config.memory_priority) features.next = &priority_features;
+        if(!loader.CreateDevice(device_extensions, &features))
+            return EXIT_FAILURE;
+
+        VkDevice dev {loader.GetDevice()};
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(loader.GetPhysicalDevice(), &props);
+        std::printf("\ndevice: %s, budgets from %s, memory priority hints %s\n", props.deviceName,
+                    config.memory_budget ? "VK_EXT_memory_budget" : "vkli's own accounting",
+                    config.memory_priority ? "on" : "off");
+
+        vkli::ResidencyManager manager {loader, config};
+        std::printf("heaps before, every budget limited to %.0f MiB:\n", budget_limit / double(MiB));
+        PrintHeaps(manager.Heaps());
+
+        // nothing is submitted here, but buffers and memory go through the loader's deletion queue
+        // and are only destroyed once the frames that could use them have finished, as they would
+        // be in a renderer.
+        std::vector<Resident> resources(resource_count);
+        vkli::DeletionQueue& deletion {loader.GetDeletionQueue()};
+        const uint32_t frames_in_flight {config.policy.frames_in_flight};
+        for(uint32_t i = 0; i < resource_count; i++) resources[i].index = i;
+
+        for(uint64_t frame = 1; frame <= n_frames; frame++) {
+            if(frame > frames_in_flight) deletion.Collect(frame - frames_in_flight);
+
+            for(Resident& r : resources) {
+                if(!InWorkingSet(r.index, frame)) continue;
+                if(r.buffer == VK_NULL_HANDLE) {
+                    r.buffer = CreateBuffer(dev);
+                    VkMemoryRequirements reqs;
+                    vkGetBufferMemoryRequirements(dev, r.buffer, &reqs);
+                    r.allocation = manager.Allocate(reqs, PriorityOf(r.index), DemotableOf(r.index), frame);
+                    if(r.allocation.memory == VK_NULL_HANDLE ||
+                       vkBindBufferMemory(dev, r.buffer, r.allocation.memory, 0) != VK_SUCCESS) {
+                        vkDestroyBuffer(dev, r.buffer, nullptr);
+                        manager.Free(r.allocation);
+                        r.buffer = VK_NULL_HANDLE;
+                        continue;
+                    }
+                }
+                manager.Use(r.allocation, frame);
+            }
+
+            for(const vkli::ResidencyAction& action : manager.Update(frame)) {
+                auto it {std::find_if(resources.begin(), resources.end(),
+                                      [&](const Resident& r) { return r.allocation.resource == action.resource; })};
+                if(it == resources.end()) continue;
+                if(action.kind == vkli::ResidencyAction::Evict) {
+                    manager.Release(it->allocation);
+                    deletion.Destroy(it->buffer, frame);
+                    manager.Free(it->allocation, frame);
+                    it->buffer = VK_NULL_HANDLE;
+                    continue;
+                }
+                // a buffer cannot be bound to other memory, so a moved resource gets a new one.
+                VkBuffer buffer {CreateBuffer(dev)};
+                VkMemoryRequirements reqs;
+                vkGetBufferMemoryRequirements(dev, buffer, &reqs);
+                vkli::MemoryTarget target {action.kind == vkli::ResidencyAction::Demote ? vkli::MemoryTarget::Host
+                                                                                        : vkli::MemoryTarget::Device};
+                vkli::ResidencyAllocation moved {manager.Move(it->allocation, reqs, target)};
+                if(moved.memory == VK_NULL_HANDLE || vkBindBufferMemory(dev, buffer, moved.memory, 0) != VK_SUCCESS) {
+                    vkDestroyBuffer(dev, buffer, nullptr);
+                    manager.Free(moved);
+                    continue;
+                }
+                // a renderer records a copy from the old buffer to the new one here.
+                deletion.Destroy(it->buffer, frame);
+                manager.Free(it->allocation, frame);
+                it->buffer = buffer;
+                it->allocation = moved;
+            }
+
+            if(frame % 60 == 0) {
+                uint32_t device {0}, host {0};
+                for(const Resident& r : resources)
+                    if(r.buffer != VK_NULL_HANDLE) (r.allocation.device_local ? device : host)++;
+                std::printf("frame %4llu: %3u resources in device memory, %3u in host memory\n",
+                            static_cast<unsigned long long>(frame), device, host);
+            }
+        }
+
+        vkli::ResidencyStats stats {manager.Stats()};
+        std::printf("%llu allocations, %llu in host memory for lack of budget, %llu failed\n",
+                    static_cast<unsigned long long>(stats.allocated), static_cast<unsigned long long>(stats.fallbacks),
+                    static_cast<unsigned long long>(stats.failed));
+        std::printf("%llu evictions, %llu demotions, %llu promotions\n", static_cast<unsigned long long>(stats.evictions),
+                    static_cast<unsigned long long>(stats.demotions), static_cast<unsigned long long>(stats.promotions));
+        std::printf("heaps after:\n");
+        PrintHeaps(manager.Heaps());
+
+        // nothing was submitted, so what is still queued can go now.
+        deletion.Drain();
+        for(Resident& r : resources) {
+            if(r.buffer == VK_NULL_HANDLE) continue;
+            vkDestroyBuffer(dev, r.buffer, nullptr);
+            manager.Free(r.allocation);
+        }
+        return stats.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t budget_mib {argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 1536};
+    uint32_t n_frames {argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 600};
+    // the critical resources and a working set have to fit, or nothing can help.
+    if(budget_mib * MiB < 2 * working_set * resource_size || n_frames == 0) {
+        std::fprintf(stderr, "usage: %s [budget limit MiB, at least %llu] [frames]\n", argv[0],
+                     static_cast<unsigned long long>(2 * working_set * resource_size / MiB));
+        return EXIT_FAILURE;
+    }
+
+    try {
+        return Run(budget_mib * MiB, n_frames);
+    } catch(std::runtime_error& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,184 @@
+/*
+    pixelconv-bench: Times every pixel conversion kernel at every SIMD level the CPU supports,
+    after checking each level's output against the scalar kernels, and reports GB/s of source
+    and destination bytes. Also lists which of the 3 byte formats the devices cannot sample, the
+    ones the texture streamer expands on upload.
+
+    usage: pixelconv-bench [megapixels] [iterations]
+
+    Needs no device, the format list is skipped without a Vulkan Loader. Exits with a failure if
+    any level gives a different result from the scalar kernels.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/vkli.hpp"
+#include "vkli/pixelconv.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+    struct Kernel {
+        const char *name;
+        double bytes; // read and written by one run
+        std::function<void()> run;
+        std::function<std::vector<uint8_t>()> output;
+        std::function<void()> clear; // fills the destination with a sentinel
+    };
+
+    template<typename T>
+    std::vector<uint8_t> Bytes(const std::vector<T>& v, size_t count) {
+        std::vector<uint8_t> out(count * sizeof(T));
+        std::memcpy(out.data(), v.data(), out.size());
+        return out;
+    }
+
+    void ListUnsupportedFormats() {
+        try {
+            vkli::VkLoader loader;
+            std::vector<std::string> layers, extensions;
+            if(!loader.CreateInstance(layers, extensions)) return;
+            const VkFormat formats[] {VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_R8G8B8_SRGB,
+                                      VK_FORMAT_B8G8R8_UNORM, VK_FORMAT_B8G8R8_SRGB};
+            const char *names[] {"R8G8B8_UNORM", "R8G8B8_SRGB", "B8G8R8_UNORM", "B8G8R8_SRGB"};
+            const VkFormatFeatureFlags needed {VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT};
+            for(uint32_t d = 0; d < loader.m_instinfo.n_dev; d++) {
+                std::printf("%s cannot sample:", loader.m_instinfo.dev_props[d].deviceName);
+                for(size_t f = 0; f < std::size(formats); f++) {
+                    VkFormatProperties props;
+                    vkGetPhysicalDeviceFormatProperties(loader.m_instinfo.devices[d], formats[f], &props);
+                    if((props.optimalTilingFeatures & needed) != needed) std::printf(" %s", names[f]);
+                }
+                std::printf("\n");
+            }
+        } catch(std::runtime_error& e) {
+            std::printf("no Vulkan Loader, skipping the format list\n");
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    const double megapixels {argc > 1 ? std::strtod(argv[1], nullptr) : 16.0};
+    const uint32_t iterations {argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 10};
+    // a square image, so the downsample kernel sees real rows. Odd on purpose, to cover the tails.
+    const uint32_t side {static_cast<uint32_t>(std::sqrt(megapixels * 1e6)) | 1u};
+    const size_t pixels {size_t(side) * side};
+    if(megapixels <= 0.0 || side < 3 || iterations == 0) {
+        std::fprintf(stderr, "usage: %s [megapixels] [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ListUnsupportedFormats();
+
+    // random bytes, and floats that are mostly in [0, 1] but include everything awkward.
+    std::mt19937 rng {1234};
+    std::vector<uint8_t> rgb(pixels * 3), rgba(pixels * 4);
+    for(uint8_t& b : rgb) b = static_cast<uint8_t>(rng());
+    for(uint8_t& b : rgba) b = static_cast<uint8_t>(rng());
+    std::vector<float> floats(pixels * 4);
+    std::uniform_real_distribution<float> unit {-0.1f, 1.1f};
+    std::uniform_int_distribution<uint32_t> bits;
+    for(size_t i = 0; i < floats.size(); i++) {
+        if(i % 7 == 0) {
+            uint32_t b {bits(rng)};
+            std::memcpy(&floats[i], &b, sizeof(b));
+        } else {
+            floats[i] = unit(rng);
+        }
+    }
+    const float specials[] {0.0f, -0.0f, 65504.0f, 65520.0f, 6.1e-5f, 5.96e-8f, 2.98e-8f, 1e-10f,
+                            std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+                            std::numeric_limits<float>::quiet_NaN(), 0.5f, 1.0f, 1.0f - 1e-7f};
+    std::copy(std::begin(specials), std::end(specials), floats.begin() + 8);
+
+    // the destinations stand in for mapped staging memory. They are refilled with a sentinel before
+    // every level runs, so a level that skips some of its output cannot pass with what the level
+    // before it left there.
+    std::vector<uint8_t> out_rgba(pixels * 4), out_mip((side / 2) * (side / 2) * 4);
+    std::vector<float> out_float(pixels * 4);
+    std::vector<uint16_t> out_half(pixels * 4);
+    const auto clear_rgba = [&] { std::fill(out_rgba.begin(), out_rgba.end(), uint8_t{0xcd}); };
+    const auto clear_float = [&] {
+        std::fill(out_float.begin(), out_float.end(), std::numeric_limits<float>::quiet_NaN());
+    };
+    const auto clear_half = [&] { std::fill(out_half.begin(), out_half.end(), uint16_t{0xcdcd}); };
+    const auto clear_mip = [&] { std::fill(out_mip.begin(), out_mip.end(), uint8_t{0xcd}); };
+    const std::vector<Kernel> kernels {
+        {"RGB8 -> RGBA8", pixels * 7.0,
+         [&] { vkli::ExpandRgbToRgba(rgb.data(), out_rgba.data(), pixels); },
+         [&] { return out_rgba; }, clear_rgba},
+        {"RGBA8 <-> BGRA8", pixels * 8.0,
+         [&] { vkli::SwizzleRgbaToBgra(rgba.data(), out_rgba.data(), pixels); },
+         [&] { return out_rgba; }, clear_rgba},
+        {"sRGB8 -> linear F32", pixels * 20.0,
+         [&] { vkli::SrgbToLinear(rgba.data(), out_float.data(), pixels); },
+         [&] { return Bytes(out_float, out_float.size()); }, clear_float},
+        {"linear F32 -> sRGB8", pixels * 20.0,
+         [&] { vkli::LinearToSrgb(floats.data(), out_rgba.data(), pixels); },
+         [&] { return out_rgba; }, clear_rgba},
+        {"F32 -> F16", pixels * 24.0,
+         [&] { vkli::FloatToHalf(floats.data(), out_half.data(), pixels * 4); },
+         [&] { return Bytes(out_half, out_half.size()); }, clear_half},
+        {"RGBA8 2x2 downsample", pixels * 5.0,
+         [&] { vkli::DownsampleRgba(rgba.data(), side, side, out_mip.data()); },
+         [&] { return out_mip; }, clear_mip}
+    };
+
+    const vkli::SimdLevel best {vkli::DetectSimdLevel()};
+    std::printf("%ux%u pixels, best of %u runs, CPU supports %s\n\n", side, side, iterations,
+                vkli::SimdLevelName(best));
+    std::printf("%-24s", "kernel");
+    for(int l = 0; l <= int(best); l++) std::printf(" %10s GB/s", vkli::SimdLevelName(vkli::SimdLevel(l)));
+    std::printf("\n");
+
+    bool correct {true};
+    for(const Kernel& kernel : kernels) {
+        std::printf("%-24s", kernel.name);
+        std::vector<uint8_t> reference;
+        for(int l = 0; l <= int(best); l++) {
+            vkli::SetSimdLevel(vkli::SimdLevel(l));
+            kernel.clear();
+            double best_s {1e30};
+            for(uint32_t i = 0; i < iterations; i++) {
+                auto start {std::chrono::steady_clock::now()};
+                kernel.run();
+                best_s = std::min(best_s, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            std::vector<uint8_t> output {kernel.output()};
+            bool match {true};
+            if(l == 0) reference = std::move(output);
+            else match = output == reference;
+            correct = correct && match;
+            std::printf(" %15.2f%s", kernel.bytes / best_s * 1e-9, match ? " " : "!");
+        }
+        std::printf("\n");
+    }
+    vkli::SetSimdLevel(best);
+
+    if(!correct) {
+        std::printf("\nresults marked ! differ from the scalar kernels\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*
+    texture-streaming: Measures time to first frame with TextureStreamer, the time until every
+    texture has its mip tail resident and could be drawn, against the time until every level of
+    every texture is resident, which is the earliest a loader that uploads everything up front
+    could draw its first frame.
+
+    usage: texture-streaming [KTX2 or DDS files...]
+
+    Without files, 16 RGBA8 2048x2048 DDS files with full mip chains are written to the temporary
+    directory first, and removed again at the end.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/vkli.hpp"
+#include "vkli/streaming.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    const uint32_t synthetic_count {16};
+    const uint32_t synthetic_size {2048};
+
+    double Ms(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    void Put32(std::vector<uint8_t>& data, size_t offset, uint32_t value) {
+        for(int i = 0; i < 4; i++) data[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    // an uncompressed RGBA8 DDS file with a full mip chain, every level a different shade.
+    void WriteDds(const std::string& path, uint32_t size, uint32_t seed) {
+        uint32_t levels {1};
+        while((size >> levels) > 0) levels++;
+
+        std::vector<uint8_t> header(128, 0);
+        std::copy_n("DDS ", 4, header.begin());
+        Put32(header, 4, 124);
+        Put32(header, 8, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000); // CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT
+        Put32(header, 12, size);
+        Put32(header, 16, size);
+        Put32(header, 20, size * 4); // pitch
+        Put32(header, 28, levels);
+        Put32(header, 76, 32);       // pixel format size
+        Put32(header, 80, 0x41);     // DDPF_RGB | DDPF_ALPHAPIXELS
+        Put32(header, 88, 32);
+        Put32(header, 92, 0x000000ff);
+        Put32(header, 96, 0x0000ff00);
+        Put32(header, 100, 0x00ff0000);
+        Put32(header, 104, 0xff000000);
+        Put32(header, 108, 0x1000 | 0x400000 | 0x8); // TEXTURE | MIPMAP | COMPLEX
+
+        std::ofstream out {path, std::ios::binary};
+        out.write(reinterpret_cast<const char *>(header.data()), header.size());
+        std::vector<uint8_t> level;
+        for(uint32_t l = 0; l < levels; l++) {
+            uint32_t extent {std::max(1u, size >> l)};
+            level.assign(size_t(extent) * extent * 4, static_cast<uint8_t>(seed * 37 + l * 16));
+            out.write(reinterpret_cast<const char *>(level.data()), level.size());
+        }
+        if(!out) throw std::runtime_error("[ERROR] Cannot write " + path);
+    }
+
+    int Run(const std::vector<std::string>& files) {
+        vkli::VkLoader loader;
+        std::vector<std::string> layers, instance_extensions, device_extensions;
+        if(!loader.CreateInstance(layers, instance_extensions) || !loader.CreateDevice(device_extensions))
+            return EXIT_FAILURE;
+
+        vkli::TextureStreamer streamer {loader};
+        auto start {Clock::now()};
+        std::vector<vkli::TextureId> ids;
+        for(size_t i = 0; i < files.size(); i++)
+            ids.push_back(streamer.Load(files[i], static_cast<float>(files.size() - i)));
+
+        // a frame loop that does nothing but stream. The first frame could be drawn once every
+        // texture has something resident, or has failed.
+        Clock::time_point first_frame {};
+        uint64_t frames {0};
+        while(!streamer.Idle()) {
+            streamer.Update();
+            frames++;
+            if(first_frame == Clock::time_point{}) {
+                bool drawable {true};
+                for(vkli::TextureId id : ids) {
+                    vkli::StreamedTexture tex {streamer.Get(id)};
+                    if(tex.state != vkli::TEXTURE_FAILED && (tex.state == vkli::TEXTURE_LOADING || tex.resident_level == tex.levels))
+                        drawable = false;
+                }
+                if(drawable) first_frame = Clock::now();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        streamer.Update();
+        auto everything {Clock::now()};
+        if(first_frame == Clock::time_point{}) first_frame = everything;
+
+        uint32_t failed {0};
+        uint64_t bytes {0};
+        for(size_t i = 0; i < ids.size(); i++) {
+            vkli::StreamedTexture tex {streamer.Get(ids[i])};
+            if(tex.state == vkli::TEXTURE_FAILED) failed++;
+            else bytes += std::filesystem::file_size(files[i]);
+        }
+
+        std::printf("%zu textures, %.1f MiB, %u failed, %llu frames\n", files.size(), bytes / (1024.0 * 1024.0),
+                    failed, static_cast<unsigned long long>(frames));
+        std::printf("%-24s %10.2f ms\n", "first frame (streamed)", Ms(start, first_frame));
+        std::printf("%-24s %10.2f ms\n", "everything resident", Ms(start, everything));
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> files(argv + 1, argv + argc);
+    bool synthetic {files.empty()};
+    try {
+        if(synthetic) {
+            auto dir {std::filesystem::temp_directory_path()};
+            for(uint32_t i = 0; i < synthetic_count; i++) {
+                files.push_back((dir / ("texture-streaming-" + std::to_string(i) + ".dds")).string());
+                WriteDds(files.back(), synthetic_size, i);
+            }
+        }
+        int result {Run(files)};
+        if(synthetic) for(const auto& file : files) std::filesystem::remove(file);
+        return result;
+    } catch(std::runtime_error& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        if(synthetic) for(const auto& file : files) std::filesystem::remove(file);
+        return EXIT_FAILURE;
+    }
+}
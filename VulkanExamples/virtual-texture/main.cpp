@@ -0,0 +1,604 @@
+/*
+    virtual-texture: Flies low over a procedural terrain megatexture that is much larger than the
+    memory it is given, rendering headless. Only the tiles the camera sees are resident, and the
+    statistics show how the page pool keeps up with what the feedback asks for.
+
+    usage: virtual-texture [texture size] [pool MiB] [frames]
+
+    Needs sparseBinding, sparseResidencyImage2D, shaderResourceResidency, fragmentStoresAndAtomics
+    and a graphics queue with sparse binding.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, version 3.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vkli/vkli.hpp"
+#include "vkli/virtualtexture.hpp"
+#include "vkli/helpers.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ground.vert.h"
+#include "ground.frag.h"
+
+namespace {
+    const VkExtent2D extent {1280, 720};
+    const VkFormat colour_format {VK_FORMAT_R8G8B8A8_UNORM};
+    const uint32_t frames_in_flight {2};
+    const float texels_per_unit {16.0f};
+
+    struct Vec3 { float x, y, z; };
+    Vec3 Sub(Vec3 a, Vec3 b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+    float Dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    Vec3 Cross(Vec3 a, Vec3 b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+    Vec3 Normalise(Vec3 a) { float l {std::sqrt(Dot(a, a))}; return {a.x / l, a.y / l, a.z / l}; }
+
+    // +z forward, +y down, like the other examples.
+    void LookAt(Vec3 eye, Vec3 target, float out[16]) {
+        Vec3 z {Normalise(Sub(target, eye))};
+        Vec3 x {Normalise(Cross(z, {0.0f, -1.0f, 0.0f}))};
+        Vec3 y {Cross(z, x)};
+        const Vec3 axes[3] {x, y, z};
+        for(int r = 0; r < 3; r++) {
+            out[0 + r] = axes[r].x;
+            out[4 + r] = axes[r].y;
+            out[8 + r] = axes[r].z;
+            out[12 + r] = -Dot(axes[r], eye);
+        }
+        out[3] = out[7] = out[11] = 0.0f;
+        out[15] = 1.0f;
+    }
+
+    void Perspective(float fov_y, float aspect, float znear, float zfar, float out[16]) {
+        float f {1.0f / std::tan(fov_y / 2.0f)};
+        std::fill(out, out + 16, 0.0f);
+        out[0] = f / aspect;
+        out[5] = f;
+        out[10] = zfar / (zfar - znear);
+        out[11] = 1.0f;
+        out[14] = -znear * zfar / (zfar - znear);
+    }
+
+    void Multiply(const float a[16], const float b[16], float out[16]) {
+        for(int c = 0; c < 4; c++)
+            for(int r = 0; r < 4; r++) {
+                out[c * 4 + r] = 0.0f;
+                for(int k = 0; k < 4; k++) out[c * 4 + r] += a[k * 4 + r] * b[c * 4 + k];
+            }
+    }
+
+    // terrain coloured by height, from a few octaves of value noise. Every level is evaluated at
+    // the centres of its texels rather than filtered, which is plenty for a demo.
+    class TerrainProvider : public vkli::PageProvider {
+        public:
+            bool Fill(uint32_t level, VkOffset2D offset, VkExtent2D size, void *dst) override {
+                uint8_t *out {static_cast<uint8_t *>(dst)};
+                const float scale {float(1u << level)};
+                for(uint32_t y = 0; y < size.height; y++)
+                    for(uint32_t x = 0; x < size.width; x++, out += 4) {
+                        float u {(offset.x + x + 0.5f) * scale}, v {(offset.y + y + 0.5f) * scale};
+                        Colour(Height(u, v), level, out);
+                    }
+                m_Texels += uint64_t{size.width} * size.height;
+                return true;
+            }
+            uint64_t Texels() const { return m_Texels; }
+        private:
+            static float Hash(int32_t x, int32_t y) {
+                uint32_t h {static_cast<uint32_t>(x) * 374761393u + static_cast<uint32_t>(y) * 668265263u};
+                h = (h ^ (h >> 13)) * 1274126177u;
+                return float((h ^ (h >> 16)) & 0xffffff) / float(0x1000000);
+            }
+            static float Noise(float u, float v) {
+                float fu {std::floor(u)}, fv {std::floor(v)};
+                int32_t x {int32_t(fu)}, y {int32_t(fv)};
+                float tu {u - fu}, tv {v - fv};
+                tu = tu * tu * (3.0f - 2.0f * tu);
+                tv = tv * tv * (3.0f - 2.0f * tv);
+                float top {Hash(x, y) + (Hash(x + 1, y) - Hash(x, y)) * tu};
+                float bottom {Hash(x, y + 1) + (Hash(x + 1, y + 1) - Hash(x, y + 1)) * tu};
+                return top + (bottom - top) * tv;
+            }
+            static float Height(float u, float v) {
+                return 0.55f * Noise(u / 1024.0f, v / 1024.0f) + 0.3f * Noise(u / 256.0f, v / 256.0f) +
+                       0.15f * Noise(u / 32.0f, v / 32.0f);
+            }
+            static void Colour(float h, uint32_t level, uint8_t *out) {
+                struct Band { float top; uint8_t rgb[3]; };
+                static const Band bands[] {
+                    {0.35f, {40, 70, 150}}, {0.40f, {210, 200, 140}}, {0.62f, {70, 130, 50}},
+                    {0.75f, {110, 100, 90}}, {2.00f, {240, 240, 245}}
+                };
+                const Band *band {bands};
+                while(h > band->top) band++;
+                // contour lines, and a slight tint per level to make the LOD visible.
+                float shade {std::fmod(h, 0.025f) < 0.002f ? 0.6f : 1.0f};
+                for(int c = 0; c < 3; c++) {
+                    float tint {c == int(level % 3) ? 1.1f : 1.0f};
+                    out[c] = static_cast<uint8_t>(std::min(255.0f, band->rgb[c] * shade * tint));
+                }
+                out[3] = 255;
+            }
+        private:
+            uint64_t m_Texels {0};
+    };
+
+    VkRenderPass CreateRenderPass(VkDevice dev) {
+        VkAttachmentDescription attachment {
+            0,
+            colour_format,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_ATTACHMENT_LOAD_OP_CLEAR,
+            VK_ATTACHMENT_STORE_OP_STORE,
+            VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+        };
+        VkAttachmentReference colour_ref {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        VkSubpassDescription subpass {
+            0,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            0,
+            nullptr,
+            1,
+            &colour_ref,
+            nullptr,
+            nullptr,
+            0,
+            nullptr
+        };
+        // the previous frame must be done writing the target before it is cleared.
+        VkSubpassDependency dependency {
+            VK_SUBPASS_EXTERNAL,
+            0,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            0,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            0
+        };
+        VkRenderPassCreateInfo render_pass_info {
+            VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+            nullptr,
+            0,
+            1,
+            &attachment,
+            1,
+            &subpass,
+            1,
+            &dependency
+        };
+        VkRenderPass render_pass;
+        if(vkCreateRenderPass(dev, &render_pass_info, nullptr, &render_pass) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Render pass creation failed");
+        return render_pass;
+    }
+
+    VkPipeline CreatePipeline(VkDevice dev, VkRenderPass render_pass, VkPipelineLayout layout) {
+        VkShaderModule vert {vkli::helpers::CreateShaderModule(dev, ground_vert, sizeof(ground_vert))};
+        VkShaderModule frag {vkli::helpers::CreateShaderModule(dev, ground_frag, sizeof(ground_frag))};
+        const std::array<VkPipelineShaderStageCreateInfo, 2> stages {{
+            {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, VK_SHADER_STAGE_VERTEX_BIT, vert, "main", nullptr},
+            {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, VK_SHADER_STAGE_FRAGMENT_BIT, frag, "main", nullptr}
+        }};
+        VkPipelineVertexInputStateCreateInfo vertex_input {VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+        VkPipelineInputAssemblyStateCreateInfo input_assembly {
+            VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+            VK_FALSE
+        };
+        VkViewport viewport {0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f};
+        VkRect2D scissor {{0, 0}, extent};
+        VkPipelineViewportStateCreateInfo viewport_state {
+            VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+            nullptr,
+            0,
+            1,
+            &viewport,
+            1,
+            &scissor
+        };
+        VkPipelineRasterizationStateCreateInfo rasterization {VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+        rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterization.cullMode = VK_CULL_MODE_NONE;
+        rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterization.lineWidth = 1.0f;
+        VkPipelineMultisampleStateCreateInfo multisample {VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+        multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        VkPipelineColorBlendAttachmentState blend_attachment {};
+        blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        VkPipelineColorBlendStateCreateInfo blend {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+        blend.attachmentCount = 1;
+        blend.pAttachments = &blend_attachment;
+
+        VkGraphicsPipelineCreateInfo pipeline_info {VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+        pipeline_info.stageCount = static_cast<uint32_t>(stages.size());
+        pipeline_info.pStages = stages.data();
+        pipeline_info.pVertexInputState = &vertex_input;
+        pipeline_info.pInputAssemblyState = &input_assembly;
+        pipeline_info.pViewportState = &viewport_state;
+        pipeline_info.pRasterizationState = &rasterization;
+        pipeline_info.pMultisampleState = &multisample;
+        pipeline_info.pColorBlendState = &blend;
+        pipeline_info.layout = layout;
+        pipeline_info.renderPass = render_pass;
+        pipeline_info.subpass = 0;
+
+        VkPipeline pipeline;
+        VkResult result {vkCreateGraphicsPipelines(dev, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline)};
+        vkDestroyShaderModule(dev, vert, nullptr);
+        vkDestroyShaderModule(dev, frag, nullptr);
+        if(result != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Graphics pipeline creation failed");
+        return pipeline;
+    }
+
+    struct PushConstants {
+        float view_proj[16];
+        float half_size;
+    };
+
+    int Run(uint32_t size, uint32_t pool_mib, uint32_t n_frames) {
+        vkli::VkLoader loader;
+        std::vector<std::string> layers, instance_extensions, device_extensions;
+        if(!loader.CreateInstance(layers, instance_extensions))
+            return EXIT_FAILURE;
+
+        vkli::DeviceFeatures features;
+        vkli::VirtualTexture::RequireFeatures(features);
+        features.core.fragmentStoresAndAtomics = VK_TRUE;
+        if(!loader.CreateDevice(device_extensions, &features))
+            return EXIT_FAILURE;
+
+        VkDevice dev {loader.GetDevice()};
+        VkPhysicalDevice pdev {loader.GetPhysicalDevice()};
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(pdev, &props);
+        size = std::min(size, props.limits.maxImageDimension2D);
+
+        // the pool is sized for the standard 64KiB sparse blocks.
+        TerrainProvider provider;
+        vkli::VirtualTextureConfig config;
+        config.extent = {size, size};
+        config.pool_pages = std::max(pool_mib * 16u, 1u);
+        config.frames_in_flight = frames_in_flight;
+        vkli::VirtualTexture megatexture {loader, provider, config};
+        const vkli::VirtualTextureStats initial {megatexture.Stats()};
+        std::printf("device: %s, %ux%u virtual texture (%.0f MiB), pool of %u pages (%.0f MiB)\n", props.deviceName,
+                    size, size, initial.virtual_size / 1048576.0, config.pool_pages,
+                    config.pool_pages * initial.page_size / 1048576.0);
+
+        // the render target
+        VkImage target;
+        VkDeviceMemory target_memory;
+        VkImageView target_view;
+        VkImageCreateInfo image_info {
+            VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            nullptr,
+            0,
+            VK_IMAGE_TYPE_2D,
+            colour_format,
+            {extent.width, extent.height, 1},
+            1,
+            1,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+            VK_SHARING_MODE_EXCLUSIVE,
+            0,
+            nullptr,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        };
+        if(vkCreateImage(dev, &image_info, nullptr, &target) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Render target creation failed");
+        VkMemoryRequirements reqs;
+        vkGetImageMemoryRequirements(dev, target, &reqs);
+        VkMemoryAllocateInfo alloc_info {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            nullptr,
+            reqs.size,
+            vkli::helpers::FindMemoryType(pdev, reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+        };
+        if(vkAllocateMemory(dev, &alloc_info, nullptr, &target_memory) != VK_SUCCESS ||
+           vkBindImageMemory(dev, target, target_memory, 0) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Render target memory allocation failed");
+        VkImageViewCreateInfo view_info {
+            VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            nullptr,
+            0,
+            target,
+            VK_IMAGE_VIEW_TYPE_2D,
+            colour_format,
+            {},
+            {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+        };
+        if(vkCreateImageView(dev, &view_info, nullptr, &target_view) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Render target view creation failed");
+
+        VkRenderPass render_pass {CreateRenderPass(dev)};
+        VkFramebufferCreateInfo framebuffer_info {
+            VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            nullptr,
+            0,
+            render_pass,
+            1,
+            &target_view,
+            extent.width,
+            extent.height,
+            1
+        };
+        VkFramebuffer framebuffer;
+        if(vkCreateFramebuffer(dev, &framebuffer_info, nullptr, &framebuffer) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Framebuffer creation failed");
+
+        // VirtualTextureInfo, read by the fragment shader
+        VkBuffer info_buffer;
+        VkDeviceMemory info_memory;
+        VkBufferCreateInfo buffer_info {
+            VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            nullptr,
+            0,
+            sizeof(vkli::VirtualTextureInfo),
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_SHARING_MODE_EXCLUSIVE,
+            0,
+            nullptr
+        };
+        if(vkCreateBuffer(dev, &buffer_info, nullptr, &info_buffer) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Uniform buffer creation failed");
+        vkGetBufferMemoryRequirements(dev, info_buffer, &reqs);
+        alloc_info.allocationSize = reqs.size;
+        alloc_info.memoryTypeIndex = vkli::helpers::FindMemoryType(pdev, reqs.memoryTypeBits,
+                                                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        void *mapped;
+        if(vkAllocateMemory(dev, &alloc_info, nullptr, &info_memory) != VK_SUCCESS ||
+           vkBindBufferMemory(dev, info_buffer, info_memory, 0) != VK_SUCCESS ||
+           vkMapMemory(dev, info_memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Uniform buffer memory allocation failed");
+        std::memcpy(mapped, &megatexture.Info(), sizeof(vkli::VirtualTextureInfo));
+        vkUnmapMemory(dev, info_memory);
+
+        // one descriptor set per frame in flight, for its feedback buffer.
+        const std::array<VkDescriptorSetLayoutBinding, 3> bindings {{
+            {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
+            {1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr},
+            {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr}
+        }};
+        VkDescriptorSetLayoutCreateInfo set_layout_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            nullptr,
+            0,
+            static_cast<uint32_t>(bindings.size()),
+            bindings.data()
+        };
+        VkDescriptorSetLayout set_layout;
+        if(vkCreateDescriptorSetLayout(dev, &set_layout_info, nullptr, &set_layout) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Descriptor set layout creation failed");
+        const std::array<VkDescriptorPoolSize, 3> pool_sizes {{
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frames_in_flight},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frames_in_flight},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames_in_flight}
+        }};
+        VkDescriptorPoolCreateInfo desc_pool_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            nullptr,
+            0,
+            frames_in_flight,
+            static_cast<uint32_t>(pool_sizes.size()),
+            pool_sizes.data()
+        };
+        VkDescriptorPool desc_pool;
+        if(vkCreateDescriptorPool(dev, &desc_pool_info, nullptr, &desc_pool) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Descriptor pool creation failed");
+        std::array<VkDescriptorSetLayout, frames_in_flight> set_layouts;
+        set_layouts.fill(set_layout);
+        VkDescriptorSetAllocateInfo set_info {
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            nullptr,
+            desc_pool,
+            frames_in_flight,
+            set_layouts.data()
+        };
+        std::array<VkDescriptorSet, frames_in_flight> sets;
+        if(vkAllocateDescriptorSets(dev, &set_info, sets.data()) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Allocating descriptor sets failed");
+        for(uint32_t slot = 0; slot < frames_in_flight; slot++) {
+            VkDescriptorImageInfo image {megatexture.GetSampler(), megatexture.GetView(), VK_IMAGE_LAYOUT_GENERAL};
+            VkDescriptorBufferInfo info {info_buffer, 0, VK_WHOLE_SIZE};
+            VkDescriptorBufferInfo feedback {megatexture.GetFeedbackBuffer(slot), 0, VK_WHOLE_SIZE};
+            const std::array<VkWriteDescriptorSet, 3> writes {{
+                {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, sets[slot], 0, 0, 1,
+                 VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &image, nullptr, nullptr},
+                {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, sets[slot], 1, 0, 1,
+                 VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, nullptr, &info, nullptr},
+                {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr, sets[slot], 2, 0, 1,
+                 VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &feedback, nullptr}
+            }};
+            vkUpdateDescriptorSets(dev, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+
+        VkPushConstantRange push_range {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants)};
+        VkPipelineLayoutCreateInfo pipeline_layout_info {
+            VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            nullptr,
+            0,
+            1,
+            &set_layout,
+            1,
+            &push_range
+        };
+        VkPipelineLayout pipeline_layout;
+        if(vkCreatePipelineLayout(dev, &pipeline_layout_info, nullptr, &pipeline_layout) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Pipeline layout creation failed");
+        VkPipeline pipeline {CreatePipeline(dev, render_pass, pipeline_layout)};
+
+        VkCommandPoolCreateInfo cmd_pool_info {
+            VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            nullptr,
+            VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            loader.GetQueueFamily()
+        };
+        VkCommandPool cmd_pool;
+        if(vkCreateCommandPool(dev, &cmd_pool_info, nullptr, &cmd_pool) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Command pool creation failed");
+        VkCommandBufferAllocateInfo cmd_info {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            nullptr,
+            cmd_pool,
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            frames_in_flight
+        };
+        std::array<VkCommandBuffer, frames_in_flight> cmds;
+        std::array<VkFence, frames_in_flight> fences;
+        if(vkAllocateCommandBuffers(dev, &cmd_info, cmds.data()) != VK_SUCCESS)
+            throw std::runtime_error("[ERROR] Allocating command buffers failed");
+        VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, VK_FENCE_CREATE_SIGNALED_BIT};
+        for(VkFence& fence : fences)
+            if(vkCreateFence(dev, &fence_info, nullptr, &fence) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Fence creation failed");
+
+        // the camera flies across the terrain at a low height, swaying from side to side.
+        const float half_size {size / texels_per_unit / 2.0f};
+        float proj[16];
+        Perspective(1.0f, float(extent.width) / extent.height, 0.5f, 4.0f * half_size, proj);
+
+        uint64_t uploads {0}, evictions {0}, frames_missing {0};
+        uint32_t peak_resident {0};
+        double update_ms {0.0};
+        std::printf("\n%8s %10s %10s %10s %10s %10s\n", "frame", "requested", "resident", "uploaded", "evicted", "missing");
+        for(uint32_t frame = 0; frame < n_frames; frame++) {
+            const uint32_t slot {frame % frames_in_flight};
+            if(vkWaitForFences(dev, 1, &fences[slot], VK_TRUE, UINT64_MAX) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Waiting for a frame failed");
+            vkResetFences(dev, 1, &fences[slot]);
+
+            auto start {std::chrono::steady_clock::now()};
+            VkSemaphore bound {megatexture.Update(slot)};
+            update_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            const vkli::VirtualTextureStats stats {megatexture.Stats()};
+            uploads += stats.uploaded;
+            evictions += stats.evicted;
+            frames_missing += stats.missing ? 1 : 0;
+            peak_resident = std::max(peak_resident, stats.resident_pages);
+            if(frame % 30 == 0 || frame + 1 == n_frames)
+                std::printf("%8u %10u %10u %10u %10u %10u\n", frame, stats.requested, stats.resident_pages,
+                            stats.uploaded, stats.evicted, stats.missing);
+
+            float t {float(frame) / std::max(n_frames - 1, 1u)};
+            Vec3 eye {0.3f * half_size * std::sin(t * 6.2831853f), -6.0f, (1.6f * t - 0.8f) * half_size};
+            float view[16];
+            LookAt(eye, {eye.x, 0.0f, eye.z + 40.0f}, view);
+            PushConstants push;
+            Multiply(proj, view, push.view_proj);
+            push.half_size = half_size;
+
+            VkCommandBuffer cmd {cmds[slot]};
+            VkCommandBufferBeginInfo begin_info {
+                VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                nullptr,
+                VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                nullptr
+            };
+            if(vkResetCommandBuffer(cmd, 0) != VK_SUCCESS || vkBeginCommandBuffer(cmd, &begin_info) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Beginning a command buffer failed");
+            megatexture.RecordBegin(cmd);
+            VkClearValue clear;
+            clear.color = {{0.5f, 0.7f, 0.9f, 1.0f}};
+            VkRenderPassBeginInfo pass_info {
+                VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+                nullptr,
+                render_pass,
+                framebuffer,
+                {{0, 0}, extent},
+                1,
+                &clear
+            };
+            vkCmdBeginRenderPass(cmd, &pass_info, VK_SUBPASS_CONTENTS_INLINE);
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &sets[slot], 0, nullptr);
+            vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push), &push);
+            vkCmdDraw(cmd, 6, 1, 0, 0);
+            vkCmdEndRenderPass(cmd);
+            megatexture.RecordEnd(cmd);
+            if(vkEndCommandBuffer(cmd) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Recording a command buffer failed");
+
+            VkPipelineStageFlags wait_stage {VK_PIPELINE_STAGE_TRANSFER_BIT};
+            VkSubmitInfo submit_info {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+            submit_info.waitSemaphoreCount = bound != VK_NULL_HANDLE ? 1 : 0;
+            submit_info.pWaitSemaphores = &bound;
+            submit_info.pWaitDstStageMask = &wait_stage;
+            submit_info.commandBufferCount = 1;
+            submit_info.pCommandBuffers = &cmd;
+            VkSemaphore released {megatexture.GetReleaseSemaphore(slot)};
+            submit_info.signalSemaphoreCount = 1;
+            submit_info.pSignalSemaphores = &released;
+            if(vkQueueSubmit(loader.GetQueue(), 1, &submit_info, fences[slot]) != VK_SUCCESS)
+                throw std::runtime_error("[ERROR] Submitting a frame failed");
+        }
+        vkDeviceWaitIdle(dev);
+
+        const vkli::VirtualTextureStats stats {megatexture.Stats()};
+        std::printf("\n%llu tiles uploaded (%.0f MiB of texels generated), %llu evicted, %llu of %u frames "
+                    "missed tiles\n", static_cast<unsigned long long>(uploads), provider.Texels() * 4.0 / 1048576.0,
+                    static_cast<unsigned long long>(evictions), static_cast<unsigned long long>(frames_missing), n_frames);
+        std::printf("at most %u pages (%.1f MiB) resident for a %.0f MiB texture, Update took %.3f ms per frame\n",
+                    peak_resident, peak_resident * stats.page_size / 1048576.0, stats.virtual_size / 1048576.0,
+                    update_ms / n_frames);
+
+        for(VkFence fence : fences) vkDestroyFence(dev, fence, nullptr);
+        vkDestroyCommandPool(dev, cmd_pool, nullptr);
+        vkDestroyPipeline(dev, pipeline, nullptr);
+        vkDestroyPipelineLayout(dev, pipeline_layout, nullptr);
+        vkDestroyDescriptorPool(dev, desc_pool, nullptr);
+        vkDestroyDescriptorSetLayout(dev, set_layout, nullptr);
+        vkDestroyBuffer(dev, info_buffer, nullptr);
+        vkFreeMemory(dev, info_memory, nullptr);
+        vkDestroyFramebuffer(dev, framebuffer, nullptr);
+        vkDestroyRenderPass(dev, render_pass, nullptr);
+        vkDestroyImageView(dev, target_view, nullptr);
+        vkDestroyImage(dev, target, nullptr);
+        vkFreeMemory(dev, target_memory, nullptr);
+        return EXIT_SUCCESS;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t size {argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 16384};
+    uint32_t pool_mib {argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 64};
+    uint32_t n_frames {argc > 3 ? static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10)) : 600};
+    if(size < 1024 || pool_mib == 0 || n_frames == 0) {
+        std::fprintf(stderr, "usage: %s [texture size, at least 1024] [pool MiB] [frames]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        return Run(size, pool_mib, n_frames);
+    } catch(std::runtime_error& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,42 @@
+#version 450
+#extension GL_ARB_sparse_texture2 : require
+
+// Samples the virtual texture at the finest resident level at or above the wanted one, and asks
+// for the wanted tile through the feedback buffer, see vkli/virtualtexture.hpp.
+
+layout(location = 0) in vec2 uv;
+layout(location = 0) out vec4 colour;
+
+layout(set = 0, binding = 0) uniform sampler2D megatexture;
+// VirtualTextureInfo
+layout(set = 0, binding = 1, std140) uniform Info {
+    uvec4 size;        // width, height, tile width, tile height
+    uvec4 levels;      // levels below the mip tail, all levels
+    uvec4 level_tiles[16];
+} info;
+layout(set = 0, binding = 2, std430) buffer Feedback { uint feedback[]; };
+
+void main() {
+    float lod = max(textureQueryLod(megatexture, uv).y, 0.0);
+
+    // one pixel in 16 is enough to find every tile on screen.
+    uint level = uint(lod);
+    if(level < info.levels.x && ((uint(gl_FragCoord.x) | uint(gl_FragCoord.y)) & 3u) == 0u) {
+        uvec4 tiles = info.level_tiles[level];
+        uvec2 level_size = max(info.size.xy >> level, uvec2(1));
+        uvec2 tile = min(uvec2(clamp(uv, 0.0, 1.0) * vec2(level_size)) / info.size.zw, tiles.yz - 1u);
+        uint bit = tiles.x + tile.y * tiles.y + tile.x;
+        atomicOr(feedback[bit >> 5], 1u << (bit & 31u));
+    }
+
+    // the explicit LOD keeps the loop free of implicit derivatives. Magenta means not even the
+    // mip tail was found, which cannot happen.
+    colour = vec4(1.0, 0.0, 1.0, 1.0);
+    for(float l = floor(lod); l < float(info.levels.y); l += 1.0) {
+        vec4 texel;
+        if(sparseTexelsResidentARB(sparseTextureLodARB(megatexture, uv, max(lod, l), texel))) {
+            colour = texel;
+            break;
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#version 450
+
+// A square ground plane at y = 0 from two triangles, without any vertex buffer. uv covers the
+// whole virtual texture once.
+
+layout(push_constant) uniform Params {
+    mat4 view_proj;
+    float half_size;
+};
+
+layout(location = 0) out vec2 uv;
+
+const vec2 corners[6] = vec2[](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+                               vec2(0.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+
+void main() {
+    vec2 corner = corners[gl_VertexIndex];
+    uv = corner;
+    gl_Position = view_proj * vec4((corner.x * 2.0 - 1.0) * half_size, 0.0, (corner.y * 2.0 - 1.0) * half_size, 1.0);
+}